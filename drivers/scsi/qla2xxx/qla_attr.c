@@ -1249,6 +1249,44 @@ qla2x00_total_isp_aborts_show(struct device *dev,
 	    ha->qla_stats.total_isp_aborts);
 }
 
+static ssize_t
+qla2x00_tgt_cmd_pool_show(struct device *dev,
+			  struct device_attribute *attr, char *buf)
+{
+	scsi_qla_host_t *vha = shost_priv(class_to_shost(dev));
+	struct qla_tgt *tgt = vha->hw->qla_tgt;
+
+	if (!tgt)
+		return snprintf(buf, PAGE_SIZE, "\n");
+
+	return snprintf(buf, PAGE_SIZE, "size=%d free=%d empty=%lu "
+	    "alloc_failed=%lu\n", tgt->cmd_pool.size, tgt->cmd_pool.nr_free,
+	    tgt->cmd_pool.empty_count, tgt->cmd_pool.alloc_fail_count);
+}
+
+static ssize_t
+qla2x00_tgt_ctio_batch_show(struct device *dev,
+			    struct device_attribute *attr, char *buf)
+{
+	scsi_qla_host_t *vha = shost_priv(class_to_shost(dev));
+	struct qla_tgt *tgt = vha->hw->qla_tgt;
+	unsigned long ctios = 0, doorbells = 0;
+	int i;
+
+	if (!tgt || !tgt->ctio_batches)
+		return snprintf(buf, PAGE_SIZE, "\n");
+
+	for (i = 0; i < tgt->nr_handle_pools; i++) {
+		ctios += tgt->ctio_batches[i].ctio_count;
+		doorbells += tgt->ctio_batches[i].doorbell_count;
+	}
+
+	return snprintf(buf, PAGE_SIZE, "ctios=%lu doorbells=%lu "
+	    "avg_batch=%lu.%02lu\n", ctios, doorbells,
+	    doorbells ? ctios / doorbells : 0,
+	    doorbells ? (ctios % doorbells) * 100 / doorbells : 0);
+}
+
 static ssize_t
 qla24xx_84xx_fw_version_show(struct device *dev,
 	struct device_attribute *attr, char *buf)
@@ -1419,6 +1457,8 @@ static DEVICE_ATTR(84xx_fw_version, S_IRUGO, qla24xx_84xx_fw_version_show,
 		   NULL);
 static DEVICE_ATTR(total_isp_aborts, S_IRUGO, qla2x00_total_isp_aborts_show,
 		   NULL);
+static DEVICE_ATTR(tgt_cmd_pool, S_IRUGO, qla2x00_tgt_cmd_pool_show, NULL);
+static DEVICE_ATTR(tgt_ctio_batch, S_IRUGO, qla2x00_tgt_ctio_batch_show, NULL);
 static DEVICE_ATTR(mpi_version, S_IRUGO, qla2x00_mpi_version_show, NULL);
 static DEVICE_ATTR(phy_version, S_IRUGO, qla2x00_phy_version_show, NULL);
 static DEVICE_ATTR(flash_block_size, S_IRUGO, qla2x00_flash_block_size_show,
@@ -1449,6 +1489,8 @@ struct device_attribute *qla2x00_host_attrs[] = {
 	&dev_attr_optrom_fw_version,
 	&dev_attr_84xx_fw_version,
 	&dev_attr_total_isp_aborts,
+	&dev_attr_tgt_cmd_pool,
+	&dev_attr_tgt_ctio_batch,
 	&dev_attr_mpi_version,
 	&dev_attr_phy_version,
 	&dev_attr_flash_block_size,
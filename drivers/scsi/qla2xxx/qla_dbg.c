@@ -11,7 +11,7 @@
  * ----------------------------------------------------------------------
  * |             Level            |   Last Value Used  |     Holes	|
  * ----------------------------------------------------------------------
- * | Module Init and Probe        |       0x0116       |  		|
+ * | Module Init and Probe        |       0x0117       |  		|
  * | Mailbox commands             |       0x1129       |		|
  * | Device Discovery             |       0x2083       |		|
  * | Queue Command and IO tracing |       0x302e       |     0x3008     |
@@ -25,7 +25,7 @@
  * | ISP82XX Specific             |       0xb051       |    		|
  * | MultiQ                       |       0xc00b       |		|
  * | Misc                         |       0xd00b       |		|
- * | Target Mode		  |	  0xe037       |		|
+ * | Target Mode		  |	  0xe038       |		|
  * | Target Mode Management	  |	  0xe14e       |		|
  * | Target Mode SCSI Packets	  |	  0xe20b       |		|
  * | Target Mode Scatterlists	  |	  0xe30c       |		|
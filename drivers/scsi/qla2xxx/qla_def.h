@@ -2862,7 +2862,6 @@ struct qla_hw_data {
 	struct qla_tgt_func_tmpl *tgt_ops;
 	struct qla_tgt *qla_tgt;
 	struct qla_tgt_cmd *cmds[MAX_OUTSTANDING_COMMANDS];
-	uint16_t current_handle;
 
 	struct qla_tgt_vp_map *tgt_vp_map;
 	struct mutex tgt_mutex;
@@ -93,6 +93,7 @@ extern int ql2xextended_error_logging;
 extern int ql2xiidmaenable;
 extern int ql2xmaxqueues;
 extern int ql2xmultique_tag;
+extern int ql2xtgtmultiq;
 extern int ql2xfwloadbin;
 extern int ql2xetsenable;
 extern int ql2xshiftctondsd;
@@ -194,6 +195,8 @@ extern int qla24xx_dif_start_scsi(srb_t *);
 
 extern void *qla2x00_alloc_iocbs(scsi_qla_host_t *, srb_t *);
 extern void qla2x00_isp_cmd(struct scsi_qla_host *, struct req_que *);
+extern void qla2x00_adjust_req_ring(struct scsi_qla_host *, struct req_que *);
+extern void qla2x00_set_req_q_in(struct scsi_qla_host *, struct req_que *);
 extern int qla2x00_issue_marker(scsi_qla_host_t *, int);
 
 /*
@@ -558,18 +558,16 @@ int qla2x00_issue_marker(scsi_qla_host_t *vha, int ha_locked)
 }
 
 /**
- * qla2x00_isp_cmd() - Modify the request ring pointer.
- * @ha: HA context
+ * qla2x00_adjust_req_ring() - Advance the request ring pointer past the
+ * IOCB just built, without notifying the firmware.
+ * @vha: HA context
+ * @req: request queue
  *
  * Note: The caller must hold the hardware lock before calling this routine.
  */
 void
-qla2x00_isp_cmd(struct scsi_qla_host *vha, struct req_que *req)
+qla2x00_adjust_req_ring(struct scsi_qla_host *vha, struct req_que *req)
 {
-	struct qla_hw_data *ha = vha->hw;
-	device_reg_t __iomem *reg = ISP_QUE_REG(ha, req->id);
-	struct device_reg_2xxx __iomem *ioreg = &ha->iobase->isp;
-
 	ql_dbg(ql_dbg_io + ql_dbg_buffer, vha, 0x302d,
 	    "IOCB data:\n");
 	ql_dump_buffer(ql_dbg_io + ql_dbg_buffer, vha, 0x302e,
@@ -582,6 +580,23 @@ qla2x00_isp_cmd(struct scsi_qla_host *vha, struct req_que *req)
 		req->ring_ptr = req->ring;
 	} else
 		req->ring_ptr++;
+}
+EXPORT_SYMBOL(qla2x00_adjust_req_ring);
+
+/**
+ * qla2x00_set_req_q_in() - Hand all IOCBs up to the current request ring
+ * pointer to the firmware.
+ * @vha: HA context
+ * @req: request queue
+ *
+ * Note: The caller must hold the hardware lock before calling this routine.
+ */
+void
+qla2x00_set_req_q_in(struct scsi_qla_host *vha, struct req_que *req)
+{
+	struct qla_hw_data *ha = vha->hw;
+	device_reg_t __iomem *reg = ISP_QUE_REG(ha, req->id);
+	struct device_reg_2xxx __iomem *ioreg = &ha->iobase->isp;
 
 	/* Set chip new ring index. */
 	if (IS_QLA82XX(ha)) {
@@ -618,6 +633,20 @@ qla2x00_isp_cmd(struct scsi_qla_host *vha, struct req_que *req)
 	}
 
 }
+EXPORT_SYMBOL(qla2x00_set_req_q_in);
+
+/**
+ * qla2x00_isp_cmd() - Modify the request ring pointer.
+ * @ha: HA context
+ *
+ * Note: The caller must hold the hardware lock before calling this routine.
+ */
+void
+qla2x00_isp_cmd(struct scsi_qla_host *vha, struct req_que *req)
+{
+	qla2x00_adjust_req_ring(vha, req);
+	qla2x00_set_req_q_in(vha, req);
+}
 EXPORT_SYMBOL(qla2x00_isp_cmd);
 
 /**
@@ -149,6 +149,14 @@ MODULE_PARM_DESC(ql2xmultique_tag,
 		"Default is 0 for no affinity of request and response IO. "
 		"Set it to 1 to turn on the cpu affinity.");
 
+int ql2xtgtmultiq;
+module_param(ql2xtgtmultiq, int, S_IRUGO);
+MODULE_PARM_DESC(ql2xtgtmultiq,
+		"Enables per-CPU request queues for target mode CTIOs. "
+		"Requires ql2xmultique_tag=1. "
+		"Default is 0 - all CTIOs use a single request queue. "
+		"Set it to 1 to pair a request queue with each response queue.");
+
 int ql2xfwloadbin;
 module_param(ql2xfwloadbin, int, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(ql2xfwloadbin,
@@ -389,6 +397,7 @@ static int qla25xx_setup_mode(struct scsi_qla_host *vha)
 {
 	uint16_t options = 0;
 	int ques, req, ret;
+	int tgt_qs = ql2xtgtmultiq;
 	struct qla_hw_data *ha = vha->hw;
 
 	if (!(ha->fw_attributes & BIT_6)) {
@@ -416,6 +425,16 @@ static int qla25xx_setup_mode(struct scsi_qla_host *vha)
 				    "Failed to create response queue.\n");
 				goto fail2;
 			}
+			if (!tgt_qs)
+				continue;
+			/* target CTIOs completing on this response queue */
+			if (!qla25xx_create_req_que(ha, BIT_7, 0, 0, ret,
+			    QLA_DEFAULT_QUE_QOS)) {
+				ql_log(ql_log_warn, vha, 0x0117,
+				    "Failed to create target request queue "
+				    "for response queue %d.\n", ret);
+				tgt_qs = 0;
+			}
 		}
 		ha->flags.cpu_affinity_enabled = 1;
 		ql_dbg(ql_dbg_multiq, vha, 0xc007,
@@ -2006,6 +2025,9 @@ skip_pio:
 			ha->max_rsp_queues = (ha->msix_count - 1 > cpus) ?
 				(cpus + 1) : (ha->msix_count - 1);
 			ha->max_req_queues = 2;
+			if (ql2xtgtmultiq)
+				ha->max_req_queues = min(QLA_MQ_SIZE,
+				    ha->max_req_queues + ha->max_rsp_queues - 1);
 		} else if (ql2xmaxqueues > 1) {
 			ha->max_req_queues = ql2xmaxqueues > QLA_MQ_SIZE ?
 			    QLA_MQ_SIZE : ql2xmaxqueues;
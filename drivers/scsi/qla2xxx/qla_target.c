@@ -57,6 +57,26 @@ MODULE_PARM_DESC(qlini_mode,
 
 static int ql2x_ini_mode = QLA2XXX_INI_MODE_EXCLUSIVE;
 
+static int qlctio_batch;
+module_param(qlctio_batch, int, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(qlctio_batch,
+	"Number of CTIOs that may be queued on a request ring before the "
+	"firmware is notified. Default is 0 - notify for every CTIO.");
+
+static int qlctio_batch_usecs = 20;
+module_param(qlctio_batch_usecs, int, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(qlctio_batch_usecs,
+	"Maximum time in microseconds a batched CTIO waits for the firmware "
+	"to be notified. Default is 20.");
+
+static int qlfast_atio;
+module_param(qlfast_atio, int, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(qlfast_atio,
+	"Look up the session of a new command while processing its ATIO, "
+	"so that the command work submits it without taking the hardware "
+	"lock. Sessions that are not known yet and multi-entry ATIOs still "
+	"go through the lookup in the command work. Default is 0 - off.");
+
 /*
  * From scsi/fc/fc_fcp.h
  */
@@ -888,6 +908,42 @@ EXPORT_SYMBOL(qla_tgt_stop_phase2);
 	}					\
 } while (0)
 
+static void qla_tgt_free_handle_pools(struct qla_tgt *tgt)
+{
+	int i;
+
+	if (!tgt->handle_pools)
+		return;
+	for (i = 0; i < tgt->nr_handle_pools; i++)
+		kfree(tgt->handle_pools[i].free);
+	kfree(tgt->handle_pools);
+	tgt->handle_pools = NULL;
+}
+
+static void qla_tgt_free_cmd_pool(struct qla_tgt *tgt)
+{
+	struct qla_tgt_cmd_pool *pool = &tgt->cmd_pool;
+	struct qla_tgt_cmd *cmd, *tmp;
+
+	list_for_each_entry_safe(cmd, tmp, &pool->free_list, cmd_list) {
+		list_del(&cmd->cmd_list);
+		kmem_cache_free(qla_tgt_cmd_cachep, cmd);
+	}
+	pool->nr_free = 0;
+}
+
+static void qla_tgt_free_ctio_batches(struct qla_tgt *tgt)
+{
+	int i;
+
+	if (!tgt->ctio_batches)
+		return;
+	for (i = 0; i < tgt->nr_handle_pools; i++)
+		hrtimer_cancel(&tgt->ctio_batches[i].timer);
+	kfree(tgt->ctio_batches);
+	tgt->ctio_batches = NULL;
+}
+
 /* Called from qla_tgt_remove_target() -> qla2x00_remove_one() */
 void qla_tgt_release(struct qla_tgt *tgt)
 {
@@ -902,6 +958,10 @@ void qla_tgt_release(struct qla_tgt *tgt)
 
 	assert_work_queue_empty(&tgt->sess_work);
 	assert_work_queue_empty(&tgt->srr_work);
+	qla_tgt_free_ctio_batches(tgt);
+	qla_tgt_free_handle_pools(tgt);
+	qla_tgt_free_cmd_pool(tgt);
+	kfree(tgt->cpu_qs);
 	kfree(tgt);
 }
 
@@ -994,7 +1054,7 @@ static void qla_tgt_send_notify_ack(struct scsi_qla_host *vha,
 		"qla_target(%d): Sending 24xx Notify Ack %d\n",
 		vha->vp_idx, nack->u.isp24.status);
 
-	qla2x00_isp_cmd(vha, vha->req);
+	qla2x00_isp_cmd(vha, vha->hw->req_q_map[0]);
 }
 
 /*
@@ -1070,7 +1130,7 @@ static void qla_tgt_24xx_send_abts_resp(struct scsi_qla_host *vha,
 
 	ha->qla_tgt->abts_resp_expected++;
 
-	qla2x00_isp_cmd(vha, vha->req);
+	qla2x00_isp_cmd(vha, vha->hw->req_q_map[0]);
 }
 
 /*
@@ -1116,7 +1176,7 @@ static void qla_tgt_24xx_retry_term_exchange(struct scsi_qla_host *vha,
 	dev_info(&vha->hw->pdev->dev, "Terminate CTIO exch addr %x ox_id %x\n",
 		 ctio->exchange_addr, ctio->u.status1.ox_id);
 
-	qla2x00_isp_cmd(vha, vha->req);
+	qla2x00_isp_cmd(vha, vha->hw->req_q_map[0]);
 
 	qla_tgt_24xx_send_abts_resp(vha, (abts_recv_from_24xx_t *)entry,
 		FCP_TMF_CMPL, true);
@@ -1129,21 +1189,22 @@ static int __qla_tgt_24xx_handle_abts(struct scsi_qla_host *vha,
 	struct qla_hw_data *ha = vha->hw;
 	struct se_session *se_sess = sess->se_sess;
 	struct qla_tgt_mgmt_cmd *mcmd;
-	struct se_cmd *se_cmd;
+	struct se_cmd *se_cmd = NULL, *match = NULL;
 	u32 lun = 0;
 	int rc;
 
 	spin_lock(&se_sess->sess_cmd_lock);
-	list_for_each_entry(se_cmd, &se_sess->sess_cmd_list, se_cmd_list) {
-		struct qla_tgt_cmd *cmd =
-			container_of(se_cmd, struct qla_tgt_cmd, se_cmd);
-		if (cmd->tag == abts->exchange_addr_to_abort) {
-			lun = cmd->unpacked_lun;
-			break;
-		}
-	}
+	/*
+	 * Matches are returned newest first, abort the oldest one.
+	 */
+	while ((match = __target_find_sess_cmd(se_sess,
+				abts->exchange_addr_to_abort, match)))
+		se_cmd = match;
+	if (se_cmd)
+		lun = container_of(se_cmd, struct qla_tgt_cmd,
+				se_cmd)->unpacked_lun;
 	spin_unlock(&se_sess->sess_cmd_lock);
-	if (!lun) {
+	if (!se_cmd) {
 		pr_err("unable to find cmd on sess_cmd_list for tag 0x%x\n",
 		       abts->exchange_addr_to_abort);
 		return -ENOENT;
@@ -1281,7 +1342,7 @@ static void qla_tgt_24xx_send_task_mgmt_ctio(struct scsi_qla_host *vha,
 	ctio->u.status1.response_len = __constant_cpu_to_le16(8);
 	ctio->u.status1.sense_data[0] = resp_code;
 
-	qla2x00_isp_cmd(vha, vha->req);
+	qla2x00_isp_cmd(vha, vha->hw->req_q_map[0]);
 }
 
 void qla_tgt_free_mcmd(struct qla_tgt_mgmt_cmd *mcmd)
@@ -1387,33 +1448,32 @@ static inline void qla_tgt_unmap_sg(struct scsi_qla_host *vha, struct qla_tgt_cm
 	cmd->sg_mapped = 0;
 }
 
-static int qla_tgt_check_reserve_free_req(struct scsi_qla_host *vha, uint32_t req_cnt)
+static int qla_tgt_check_reserve_free_req(struct scsi_qla_host *vha,
+	struct req_que *req, uint32_t req_cnt)
 {
-	struct qla_hw_data *ha = vha->hw;
-	device_reg_t __iomem *reg = ha->iobase;
 	uint32_t cnt;
 
-	if (vha->req->cnt < (req_cnt + 2)) {
-		cnt = (uint16_t)RD_REG_DWORD(&reg->isp24.req_q_out);
+	if (req->cnt < (req_cnt + 2)) {
+		cnt = (uint16_t)RD_REG_DWORD(req->req_q_out);
 
 		ql_dbg(ql_dbg_tgt, vha, 0xe00d, "Request ring circled: cnt=%d, "
-			"vha->->ring_index=%d, vha->req->cnt=%d, req_cnt=%d\n",
-			cnt, vha->req->ring_index, vha->req->cnt, req_cnt);
-		if  (vha->req->ring_index < cnt)
-			vha->req->cnt = cnt - vha->req->ring_index;
+			"req->id=%d, req->ring_index=%d, req->cnt=%d, req_cnt=%d\n",
+			cnt, req->id, req->ring_index, req->cnt, req_cnt);
+		if  (req->ring_index < cnt)
+			req->cnt = cnt - req->ring_index;
 		else
-			vha->req->cnt = vha->req->length -
-			    (vha->req->ring_index - cnt);
+			req->cnt = req->length -
+			    (req->ring_index - cnt);
 	}
 
-	if (unlikely(vha->req->cnt < (req_cnt + 2))) {
+	if (unlikely(req->cnt < (req_cnt + 2))) {
 		ql_dbg(ql_dbg_tgt, vha, 0xe00e, "qla_target(%d): There is no room in the "
-			"request ring: vha->req->ring_index=%d, vha->req->cnt=%d, "
-			"req_cnt=%d\n", vha->vp_idx, vha->req->ring_index,
-			vha->req->cnt, req_cnt);
+			"request ring %d: req->ring_index=%d, req->cnt=%d, "
+			"req_cnt=%d\n", vha->vp_idx, req->id, req->ring_index,
+			req->cnt, req_cnt);
 		return -EAGAIN;
 	}
-	vha->req->cnt -= req_cnt;
+	req->cnt -= req_cnt;
 
 	return 0;
 }
@@ -1421,47 +1481,41 @@ static int qla_tgt_check_reserve_free_req(struct scsi_qla_host *vha, uint32_t re
 /*
  * ha->hardware_lock supposed to be held on entry. Might drop it, then reaquire
  */
-static inline void *qla_tgt_get_req_pkt(struct scsi_qla_host *vha)
+static inline void *qla_tgt_get_req_pkt(struct scsi_qla_host *vha,
+	struct req_que *req)
 {
 	assert_spin_locked(&vha->hw->hardware_lock);
 	/* Adjust ring index. */
-	vha->req->ring_index++;
-	if (vha->req->ring_index == vha->req->length) {
-		vha->req->ring_index = 0;
-		vha->req->ring_ptr = vha->req->ring;
+	req->ring_index++;
+	if (req->ring_index == req->length) {
+		req->ring_index = 0;
+		req->ring_ptr = req->ring;
 	} else {
-		vha->req->ring_ptr++;
+		req->ring_ptr++;
 	}
-	return (cont_entry_t *)vha->req->ring_ptr;
+	return (cont_entry_t *)req->ring_ptr;
 }
 
 /* ha->hardware_lock supposed to be held on entry */
-static inline uint32_t qla_tgt_make_handle(struct scsi_qla_host *vha)
+static inline uint32_t qla_tgt_make_handle(struct scsi_qla_host *vha,
+	struct qla_tgt_handle_pool *pool)
 {
-	struct qla_hw_data *ha = vha->hw;
-	uint32_t h;
+	assert_spin_locked(&vha->hw->hardware_lock);
+	if (unlikely(pool->nr_free == 0)) {
+		printk(KERN_INFO "qla_target(%d): Ran out of "
+			"empty cmd slots in ha %p\n", vha->vp_idx, vha->hw);
+		return QLA_TGT_NULL_HANDLE;
+	}
 
-	assert_spin_locked(&ha->hardware_lock);
-	h = ha->current_handle;
-	/* always increment cmd handle */
-	do {
-		++h;
-		if (h > MAX_OUTSTANDING_COMMANDS)
-			h = 1; /* 0 is QLA_TGT_NULL_HANDLE */
-		if (h == ha->current_handle) {
-			printk(KERN_INFO "qla_target(%d): Ran out of "
-				"empty cmd slots in ha %p\n", vha->vp_idx, ha);
-			h = QLA_TGT_NULL_HANDLE;
-			break;
-		}
-	} while ((h == QLA_TGT_NULL_HANDLE) ||
-		 (h == QLA_TGT_SKIP_HANDLE) ||
-		 (ha->cmds[h-1] != NULL));
+	return pool->free[--pool->nr_free];
+}
 
-	if (h != QLA_TGT_NULL_HANDLE)
-		ha->current_handle = h;
+/* ha->hardware_lock supposed to be held on entry */
+static inline void qla_tgt_free_handle(struct qla_tgt_cmd *cmd, uint32_t h)
+{
+	struct qla_tgt_handle_pool *pool = cmd->handles;
 
-	return h;
+	pool->free[pool->nr_free++] = h;
 }
 
 /* ha->hardware_lock supposed to be held on entry */
@@ -1473,7 +1527,7 @@ static int qla_tgt_24xx_build_ctio_pkt(struct qla_tgt_prm *prm, struct scsi_qla_
 	atio_from_isp_t *atio = &prm->cmd->atio;
 
 	assert_spin_locked(&ha->hardware_lock);
-	pkt = (ctio7_to_24xx_t *)vha->req->ring_ptr;
+	pkt = (ctio7_to_24xx_t *)prm->cmd->req->ring_ptr;
 	prm->pkt = pkt;
 	memset(pkt, 0, sizeof(*pkt));
 
@@ -1481,7 +1535,7 @@ static int qla_tgt_24xx_build_ctio_pkt(struct qla_tgt_prm *prm, struct scsi_qla_
 	pkt->entry_count = (uint8_t)prm->req_cnt;
 	pkt->vp_index = vha->vp_idx;
 
-	h = qla_tgt_make_handle(vha);
+	h = qla_tgt_make_handle(vha, prm->cmd->handles);
 	if (unlikely(h == QLA_TGT_NULL_HANDLE)) {
 		/*
 		 * CTIO type 7 from the firmware doesn't provide a way to
@@ -1523,7 +1577,8 @@ static void qla_tgt_load_cont_data_segments(struct qla_tgt_prm *prm, struct scsi
 	/* Build continuation packets */
 	while (prm->seg_cnt > 0) {
 		cont_a64_entry_t *cont_pkt64 =
-			(cont_a64_entry_t *)qla_tgt_get_req_pkt(vha);
+			(cont_a64_entry_t *)qla_tgt_get_req_pkt(vha,
+							prm->cmd->req);
 
 		/*
 		 * Make sure that from cont_pkt64 none of
@@ -1881,6 +1936,59 @@ skip_explict_conf:
 	/* Sense with len > 24, is it possible ??? */
 }
 
+/* ha->hardware_lock supposed to be held on entry */
+static void qla_tgt_flush_ctio_batch(struct qla_tgt_ctio_batch *batch)
+{
+	assert_spin_locked(&batch->vha->hw->hardware_lock);
+	if (!batch->pending)
+		return;
+
+	qla2x00_set_req_q_in(batch->vha, batch->req);
+	batch->pending = 0;
+	batch->doorbell_count++;
+}
+
+static enum hrtimer_restart qla_tgt_ctio_batch_timeout(struct hrtimer *timer)
+{
+	struct qla_tgt_ctio_batch *batch = container_of(timer,
+			struct qla_tgt_ctio_batch, timer);
+	struct qla_hw_data *ha = batch->vha->hw;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ha->hardware_lock, flags);
+	qla_tgt_flush_ctio_batch(batch);
+	spin_unlock_irqrestore(&ha->hardware_lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * ha->hardware_lock supposed to be held on entry. Hands the CTIOs just
+ * built on cmd->req to the firmware. With qlctio_batch set, the doorbell
+ * is rung once the batch is full or qlctio_batch_usecs after its first
+ * CTIO, whichever comes first.
+ */
+static void qla_tgt_submit_ctio(struct scsi_qla_host *vha,
+	struct qla_tgt_cmd *cmd)
+{
+	struct qla_tgt_ctio_batch *batch = cmd->batch;
+	int max_batch = ACCESS_ONCE(qlctio_batch);
+
+	qla2x00_adjust_req_ring(vha, cmd->req);
+	batch->ctio_count++;
+	batch->pending++;
+
+	if (max_batch <= 1 || batch->pending >= max_batch) {
+		qla_tgt_flush_ctio_batch(batch);
+		return;
+	}
+
+	if (batch->pending == 1)
+		hrtimer_start(&batch->timer,
+			ns_to_ktime((u64)qlctio_batch_usecs * NSEC_PER_USEC),
+			HRTIMER_MODE_REL);
+}
+
 /*
  * Callback to setup response of xmit_type of QLA_TGT_XMIT_DATA and * QLA_TGT_XMIT_STATUS
  * for >= 24xx silicon
@@ -1915,7 +2023,7 @@ int qla_tgt_xmit_response(struct qla_tgt_cmd *cmd, int xmit_type, uint8_t scsi_s
 	spin_lock_irqsave(&ha->hardware_lock, flags);
 
         /* Does F/W have an IOCBs for this request */
-	res = qla_tgt_check_reserve_free_req(vha, full_req_cnt);
+	res = qla_tgt_check_reserve_free_req(vha, cmd->req, full_req_cnt);
 	if (unlikely(res))
 		goto out_unmap_unlock;
 
@@ -1952,7 +2060,7 @@ int qla_tgt_xmit_response(struct qla_tgt_cmd *cmd, int xmit_type, uint8_t scsi_s
 			 * req_pkt().
 			 */
 			ctio7_to_24xx_t *ctio =
-				(ctio7_to_24xx_t *)qla_tgt_get_req_pkt(vha);
+				(ctio7_to_24xx_t *)qla_tgt_get_req_pkt(vha, cmd->req);
 
 			memcpy(ctio, pkt, sizeof(*ctio));
 			ctio->entry_count = 1;
@@ -1981,7 +2089,7 @@ int qla_tgt_xmit_response(struct qla_tgt_cmd *cmd, int xmit_type, uint8_t scsi_s
 	ql_dbg(ql_dbg_tgt, vha, 0xe01a, "Xmitting CTIO7 response pkt for 24xx:"
 			" %p scsi_status: 0x%02x\n", pkt, scsi_status);
 
-	qla2x00_isp_cmd(vha, vha->req);
+	qla_tgt_submit_ctio(vha, cmd);
 	spin_unlock_irqrestore(&ha->hardware_lock, flags);
 
 	return 0;
@@ -2024,7 +2132,7 @@ int qla_tgt_rdy_to_xfer(struct qla_tgt_cmd *cmd)
 	spin_lock_irqsave(&ha->hardware_lock, flags);
 
 	/* Does F/W have an IOCBs for this request */
-	res = qla_tgt_check_reserve_free_req(vha, prm.req_cnt);
+	res = qla_tgt_check_reserve_free_req(vha, cmd->req, prm.req_cnt);
 	if (res != 0)
 		goto out_unlock_free_unmap;
 
@@ -2038,7 +2146,7 @@ int qla_tgt_rdy_to_xfer(struct qla_tgt_cmd *cmd)
 
 	cmd->state = QLA_TGT_STATE_NEED_DATA;
 
-	qla2x00_isp_cmd(vha, vha->req);
+	qla_tgt_submit_ctio(vha, cmd);
 	spin_unlock_irqrestore(&ha->hardware_lock, flags);
 
 	return res;
@@ -2064,6 +2172,10 @@ static int __qla_tgt_send_term_exchange(struct scsi_qla_host *vha, struct qla_tg
 
 	ql_dbg(ql_dbg_tgt, vha, 0xe01c, "Sending TERM EXCH CTIO (ha=%p)\n", ha);
 
+	/* The firmware must not see the TERM before CTIOs still batched */
+	if (cmd && cmd->batch)
+		qla_tgt_flush_ctio_batch(cmd->batch);
+
 	pkt = (request_t *)qla2x00_alloc_iocbs(vha, NULL);
 	if (pkt == NULL) {
 		printk(KERN_ERR "qla_target(%d): %s failed: unable to allocate "
@@ -2105,7 +2217,7 @@ static int __qla_tgt_send_term_exchange(struct scsi_qla_host *vha, struct qla_tg
 	if (ctio24->u.status1.residual != 0)
 		ctio24->u.status1.scsi_status |= SS_RESIDUAL_UNDER;
 
-	qla2x00_isp_cmd(vha, vha->req);
+	qla2x00_isp_cmd(vha, vha->hw->req_q_map[0]);
 	return ret;
 }
 
@@ -2136,6 +2248,55 @@ done:
 	}
 }
 
+/*
+ * ha->hardware_lock supposed to be held on entry. Only the fields in front
+ * of sense_buffer are cleared, the ATIO is copied in by the caller.
+ */
+static struct qla_tgt_cmd *qla_tgt_alloc_cmd(struct qla_tgt *tgt)
+{
+	struct qla_tgt_cmd_pool *pool = &tgt->cmd_pool;
+	struct qla_tgt_cmd *cmd = NULL;
+
+	assert_spin_locked(&tgt->ha->hardware_lock);
+	spin_lock(&pool->lock);
+	if (likely(!list_empty(&pool->free_list))) {
+		cmd = list_first_entry(&pool->free_list, struct qla_tgt_cmd,
+				cmd_list);
+		list_del(&cmd->cmd_list);
+		pool->nr_free--;
+	}
+	spin_unlock(&pool->lock);
+
+	if (unlikely(!cmd)) {
+		pool->empty_count++;
+		cmd = kmem_cache_alloc(qla_tgt_cmd_cachep, GFP_ATOMIC);
+		if (!cmd) {
+			pool->alloc_fail_count++;
+			return NULL;
+		}
+	}
+
+	memset(cmd, 0, offsetof(struct qla_tgt_cmd, atio));
+	return cmd;
+}
+
+static void qla_tgt_release_cmd(struct qla_tgt *tgt, struct qla_tgt_cmd *cmd)
+{
+	struct qla_tgt_cmd_pool *pool = &tgt->cmd_pool;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	if (pool->nr_free < pool->size) {
+		list_add(&cmd->cmd_list, &pool->free_list);
+		pool->nr_free++;
+		cmd = NULL;
+	}
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	if (cmd)
+		kmem_cache_free(qla_tgt_cmd_cachep, cmd);
+}
+
 void qla_tgt_free_cmd(struct qla_tgt_cmd *cmd)
 {
 	BUG_ON(cmd->sg_mapped);
@@ -2143,7 +2304,7 @@ void qla_tgt_free_cmd(struct qla_tgt_cmd *cmd)
 	if (unlikely(cmd->free_sg))
 		kfree(cmd->sg);
 	assert_work_queue_empty(&cmd->work);
-	kmem_cache_free(qla_tgt_cmd_cachep, cmd);
+	qla_tgt_release_cmd(cmd->tgt, cmd);
 }
 EXPORT_SYMBOL(qla_tgt_free_cmd);
 
@@ -2260,6 +2421,7 @@ static inline struct qla_tgt_cmd *qla_tgt_get_cmd(struct scsi_qla_host *vha, uin
 	if (ha->cmds[handle] != NULL) {
 		struct qla_tgt_cmd *cmd = ha->cmds[handle];
 		ha->cmds[handle] = NULL;
+		qla_tgt_free_handle(cmd, handle + 1);
 		return cmd;
 	} else
 		return NULL;
@@ -2484,6 +2646,12 @@ void qla_tgt_flush_ctio(scsi_qla_host_t *vha)
 
 			if (cmd->sg_mapped)
 				qla_tgt_unmap_sg(vha, cmd);
+			/*
+			 * Release the handle first, free_cmd() and handle_data()
+			 * may release cmd back to qla_tgt_cmd_pool.
+			 */
+			ha->cmds[h] = NULL;
+			qla_tgt_free_handle(cmd, h + 1);
 
 			switch (cmd->state) {
 			case QLA_TGT_STATE_PROCESSED:
@@ -2500,8 +2668,6 @@ void qla_tgt_flush_ctio(scsi_qla_host_t *vha)
 					 cmd, cmd->state);
 				break;
 			}
-
-			ha->cmds[h] = NULL;
 		}
 	}
 }
@@ -2554,9 +2720,22 @@ static void qla_tgt_do_work(struct work_struct *work)
 	uint32_t data_length;
 	int ret, fcp_task_attr, data_dir, bidi = 0;;
 
+	/* Session already looked up and referenced in ATIO context */
+	sess = cmd->sess;
+
 	if (tgt->tgt_stop)
 		goto out_term;
 
+	if (sess)
+		goto have_sess;
+
+	if (ha->tgt_ops) {
+		sess = ha->tgt_ops->get_sess_by_s_id(vha,
+					atio->u.isp24.fcp_hdr.s_id);
+		if (sess)
+			goto have_sess;
+	}
+
 	spin_lock_irqsave(&ha->hardware_lock, flags);
 
 	if (!ha->tgt_ops) {
@@ -2596,6 +2775,7 @@ static void qla_tgt_do_work(struct work_struct *work)
 			goto out_term;
 	}
 
+have_sess:
 	cmd->sess = sess;
 	cmd->loop_id = sess->loop_id;
 	cmd->conf_compl_supported = sess->conf_compl_supported;
@@ -2631,7 +2811,12 @@ static void qla_tgt_do_work(struct work_struct *work)
 		goto out_term;
 	/*
 	 * Drop extra session reference from qla_tgt_handle_cmd_for_atio*(
+	 * With qlfast_atio, hardware_lock is only taken for the final put.
 	 */
+	if (qlfast_atio) {
+		ha->tgt_ops->put_sess_nolock(sess);
+		return;
+	}
 	spin_lock_irqsave(&ha->hardware_lock, flags);
 	ha->tgt_ops->put_sess(sess);
 	spin_unlock_irqrestore(&ha->hardware_lock, flags);
@@ -2645,7 +2830,7 @@ out_term:
 	 */
 	spin_lock_irqsave(&ha->hardware_lock, flags);
 	qla_tgt_send_term_exchange(vha, NULL, &cmd->atio, 1);
-	kmem_cache_free(qla_tgt_cmd_cachep, cmd);
+	qla_tgt_release_cmd(tgt, cmd);
 	if (sess)
 		ha->tgt_ops->put_sess(sess);
 	spin_unlock_irqrestore(&ha->hardware_lock, flags);
@@ -2667,7 +2852,7 @@ static int qla_tgt_handle_cmd_for_atio(struct scsi_qla_host *vha,
 		return -EFAULT;
 	}
 
-	cmd = kmem_cache_zalloc(qla_tgt_cmd_cachep, GFP_ATOMIC);
+	cmd = qla_tgt_alloc_cmd(tgt);
 	if (!cmd) {
 		printk(KERN_INFO "qla_target(%d): Allocation of cmd "
 			"failed\n", vha->vp_idx);
@@ -2684,9 +2869,37 @@ static int qla_tgt_handle_cmd_for_atio(struct scsi_qla_host *vha,
 	cmd->tgt = ha->qla_tgt;
 	cmd->vha = vha;
 
+	/*
+	 * We already hold hardware_lock here, so resolve a known session now
+	 * instead of retaking the lock in qla_tgt_do_work(). The session
+	 * reference is dropped there as usual.
+	 */
+	if (qlfast_atio && ha->tgt_ops && atio->u.raw.entry_count == 1)
+		cmd->sess = ha->tgt_ops->get_sess_by_s_id(vha,
+					atio->u.isp24.fcp_hdr.s_id);
+
 	WARN_ON(work_pending(&cmd->work));
 	INIT_WORK(&cmd->work, qla_tgt_do_work);
-	queue_work(qla_tgt_wq, &cmd->work);
+	if (tgt->nr_cpu_qs) {
+		/*
+		 * There is only one ATIO ring, so spread the exchanges over
+		 * the per-CPU request queues here: the command is processed,
+		 * completed and has its CTIOs built and completed on one CPU.
+		 */
+		struct qla_tgt_cpu_q *q = &tgt->cpu_qs[
+			le32_to_cpu(atio->u.isp24.exchange_addr) % tgt->nr_cpu_qs];
+
+		cmd->req = q->req;
+		cmd->handles = q->handles;
+		cmd->batch = q->batch;
+		cmd->se_cmd.original_cpu = q->cpu;
+		queue_work_on(q->cpu, qla_tgt_wq, &cmd->work);
+	} else {
+		cmd->req = vha->req;
+		cmd->handles = &tgt->handle_pools[0];
+		cmd->batch = &tgt->ctio_batches[0];
+		queue_work(qla_tgt_wq, &cmd->work);
+	}
 	return 0;
 
 }
@@ -3563,7 +3776,7 @@ static void qla_tgt_send_busy(struct scsi_qla_host *vha,
 	if (ctio24->u.status1.residual != 0)
 		ctio24->u.status1.scsi_status |= SS_RESIDUAL_UNDER;
 
-	qla2x00_isp_cmd(vha, vha->req);
+	qla2x00_isp_cmd(vha, vha->hw->req_q_map[0]);
 }
 
 /* ha->hardware_lock supposed to be held on entry */
@@ -4185,6 +4398,143 @@ static void qla_tgt_sess_work_fn(struct work_struct *work)
 	spin_unlock_irqrestore(&ha->hardware_lock, flags);
 }
 
+/*
+ * Collect the request queues created by qla25xx_setup_mode() for
+ * ql2xtgtmultiq. Such a queue is bound to response queue N, which
+ * qla25xx_msix_rsp_q() services on CPU N - 1.
+ */
+static void qla_tgt_setup_cpu_qs(struct qla_hw_data *ha, struct qla_tgt *tgt)
+{
+	struct scsi_qla_host *vha = tgt->vha;
+	struct req_que *req;
+	int i, cpu;
+
+	if (!ql2xtgtmultiq || !ha->mqenable || !ha->flags.cpu_affinity_enabled)
+		return;
+
+	tgt->cpu_qs = kcalloc(ha->max_req_queues, sizeof(*tgt->cpu_qs),
+			GFP_KERNEL);
+	if (!tgt->cpu_qs) {
+		printk(KERN_ERR "qla_target(%d): Unable to allocate per-CPU "
+			"queue map, using a single request queue\n",
+			vha->vp_idx);
+		return;
+	}
+
+	for (i = 1; i < ha->max_req_queues; i++) {
+		req = ha->req_q_map[i];
+		if (!req || !req->rsp || !req->rsp->id)
+			continue;
+		cpu = req->rsp->id - 1;
+		if (!cpu_online(cpu))
+			continue;
+		tgt->cpu_qs[tgt->nr_cpu_qs].cpu = cpu;
+		tgt->cpu_qs[tgt->nr_cpu_qs].req = req;
+		tgt->nr_cpu_qs++;
+	}
+
+	if (!tgt->nr_cpu_qs) {
+		kfree(tgt->cpu_qs);
+		tgt->cpu_qs = NULL;
+		return;
+	}
+	printk(KERN_INFO "qla_target(%d): using %d per-CPU CTIO request "
+		"queues\n", vha->vp_idx, tgt->nr_cpu_qs);
+}
+
+/*
+ * Split the ha->cmds[] handle space between the request queues carrying
+ * CTIOs, so that handle allocation and release are O(1) stack operations
+ * instead of a scan of ha->cmds[].
+ */
+static int qla_tgt_setup_handle_pools(struct qla_tgt *tgt)
+{
+	struct qla_tgt_handle_pool *pool;
+	uint32_t h = 1;
+	int i, j, per_pool;
+
+	tgt->nr_handle_pools = tgt->nr_cpu_qs ? tgt->nr_cpu_qs : 1;
+	per_pool = MAX_OUTSTANDING_COMMANDS / tgt->nr_handle_pools;
+
+	tgt->handle_pools = kcalloc(tgt->nr_handle_pools,
+			sizeof(*tgt->handle_pools), GFP_KERNEL);
+	if (!tgt->handle_pools)
+		return -ENOMEM;
+
+	for (i = 0; i < tgt->nr_handle_pools; i++) {
+		pool = &tgt->handle_pools[i];
+		pool->free = kmalloc(per_pool * sizeof(*pool->free),
+				GFP_KERNEL);
+		if (!pool->free) {
+			qla_tgt_free_handle_pools(tgt);
+			return -ENOMEM;
+		}
+		/* Lowest handle of the slice on top of the stack */
+		for (j = 0; j < per_pool; j++)
+			pool->free[j] = h + per_pool - 1 - j;
+		pool->nr_free = per_pool;
+		h += per_pool;
+
+		if (tgt->nr_cpu_qs)
+			tgt->cpu_qs[i].handles = pool;
+	}
+
+	return 0;
+}
+
+/*
+ * Preallocate one command per firmware exchange. A short fill is not
+ * fatal, qla_tgt_alloc_cmd() falls back to the slab.
+ */
+static void qla_tgt_setup_cmd_pool(struct qla_hw_data *ha, struct qla_tgt *tgt)
+{
+	struct qla_tgt_cmd_pool *pool = &tgt->cmd_pool;
+	struct qla_tgt_cmd *cmd;
+	int i;
+
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->free_list);
+	pool->size = ha->fw_xcb_count ? : QLA_TGT_CMD_POOL_DEFAULT;
+	if (pool->size > MAX_OUTSTANDING_COMMANDS)
+		pool->size = MAX_OUTSTANDING_COMMANDS;
+
+	for (i = 0; i < pool->size; i++) {
+		cmd = kmem_cache_alloc(qla_tgt_cmd_cachep, GFP_KERNEL);
+		if (!cmd)
+			break;
+		list_add(&cmd->cmd_list, &pool->free_list);
+		pool->nr_free++;
+	}
+	ql_dbg(ql_dbg_tgt, tgt->vha, 0xe038, "Preallocated %d of %d target "
+		"commands\n", pool->nr_free, pool->size);
+}
+
+/* One deferred doorbell per request queue with a handle pool */
+static int qla_tgt_setup_ctio_batches(struct qla_tgt *tgt)
+{
+	struct qla_tgt_ctio_batch *batch;
+	int i;
+
+	tgt->ctio_batches = kcalloc(tgt->nr_handle_pools,
+			sizeof(*tgt->ctio_batches), GFP_KERNEL);
+	if (!tgt->ctio_batches)
+		return -ENOMEM;
+
+	for (i = 0; i < tgt->nr_handle_pools; i++) {
+		batch = &tgt->ctio_batches[i];
+		batch->vha = tgt->vha;
+		hrtimer_init(&batch->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		batch->timer.function = qla_tgt_ctio_batch_timeout;
+		if (tgt->nr_cpu_qs) {
+			batch->req = tgt->cpu_qs[i].req;
+			tgt->cpu_qs[i].batch = batch;
+		} else
+			batch->req = tgt->vha->req;
+	}
+
+	return 0;
+}
+
 /* Must be called under tgt_host_action_mutex */
 int qla_tgt_add_target(struct qla_hw_data *ha, struct scsi_qla_host *base_vha)
 {
@@ -4217,6 +4567,22 @@ int qla_tgt_add_target(struct qla_hw_data *ha, struct scsi_qla_host *base_vha)
 	INIT_WORK(&tgt->srr_work, qla_tgt_handle_srr_work);
 	atomic_set(&tgt->tgt_global_resets_count, 0);
 
+	qla_tgt_setup_cpu_qs(ha, tgt);
+	if (qla_tgt_setup_handle_pools(tgt) != 0) {
+		printk(KERN_ERR "Unable to allocate CTIO handle pools\n");
+		kfree(tgt->cpu_qs);
+		kfree(tgt);
+		return -ENOMEM;
+	}
+	if (qla_tgt_setup_ctio_batches(tgt) != 0) {
+		printk(KERN_ERR "Unable to allocate CTIO batches\n");
+		qla_tgt_free_handle_pools(tgt);
+		kfree(tgt->cpu_qs);
+		kfree(tgt);
+		return -ENOMEM;
+	}
+	qla_tgt_setup_cmd_pool(ha, tgt);
+
 	ha->qla_tgt = tgt;
 
 	printk(KERN_INFO "qla_target(%d): using 64 Bit PCI "
@@ -645,8 +645,13 @@ struct qla_tgt_func_tmpl {
 						const uint16_t);
 	struct qla_tgt_sess *(*find_sess_by_s_id)(struct scsi_qla_host *,
 						const uint8_t *);
+	/* Lookup plus session reference, callable without hardware_lock */
+	struct qla_tgt_sess *(*get_sess_by_s_id)(struct scsi_qla_host *,
+						const uint8_t *);
 	void (*clear_nacl_from_fcport_map)(struct qla_tgt_sess *);
 	void (*put_sess)(struct qla_tgt_sess *);
+	/* put_sess() that takes hardware_lock only for the final reference */
+	void (*put_sess_nolock)(struct qla_tgt_sess *);
 	void (*shutdown_sess)(struct qla_tgt_sess *);
 };
 
@@ -697,6 +702,9 @@ int qla2x00_wait_for_hba_online(struct scsi_qla_host *);
 #define QLA_TGT_STATE_PROCESSED         3	/* target done processing */
 #define QLA_TGT_STATE_ABORTED           4	/* Command aborted */
 
+/* Preallocated commands when the firmware doesn't report its exchange count */
+#define QLA_TGT_CMD_POOL_DEFAULT	2048
+
 /* Special handles */
 #define QLA_TGT_NULL_HANDLE             0
 #define QLA_TGT_SKIP_HANDLE             (0xFFFFFFFF & ~CTIO_COMPLETION_HANDLE_MARK)
@@ -740,6 +748,59 @@ struct qla_port_24xx_data {
 	uint16_t reserved;
 };
 
+/*
+ * Free CTIO handles of one request queue, used as a stack. Each pool owns
+ * a contiguous slice of ha->cmds[], so a handle still indexes ha->cmds[]
+ * directly. Protected by hardware_lock.
+ */
+struct qla_tgt_handle_pool {
+	uint16_t *free;
+	int nr_free;
+};
+
+/*
+ * CTIOs already placed on a request ring but not yet handed to the
+ * firmware, see qla_tgt_submit_ctio(). Protected by hardware_lock.
+ */
+struct qla_tgt_ctio_batch {
+	struct scsi_qla_host *vha;
+	struct req_que *req;
+	int pending;
+	struct hrtimer timer;
+	/* For the average number of CTIOs per doorbell */
+	unsigned long ctio_count;
+	unsigned long doorbell_count;
+};
+
+/*
+ * Preallocated qla_tgt_cmd descriptors, so that ATIO handling doesn't
+ * depend on GFP_ATOMIC allocations. Commands are taken under hardware_lock
+ * and returned from any context; the counters are updated under
+ * hardware_lock.
+ */
+struct qla_tgt_cmd_pool {
+	spinlock_t lock;
+	struct list_head free_list;
+	int nr_free;
+	int size;
+	/* ATIOs that found the pool empty and fell back to the slab */
+	unsigned long empty_count;
+	/* ATIOs refused because the slab allocation failed as well */
+	unsigned long alloc_fail_count;
+};
+
+/*
+ * CPU <-> request queue pairing used to steer CTIOs when ql2xtgtmultiq
+ * is enabled. Each request queue reports its completions on the response
+ * queue whose work runs on the same CPU.
+ */
+struct qla_tgt_cpu_q {
+	int cpu;
+	struct req_que *req;
+	struct qla_tgt_handle_pool *handles;
+	struct qla_tgt_ctio_batch *batch;
+};
+
 struct qla_tgt {
 	struct scsi_qla_host *vha;
 	struct qla_hw_data *ha;
@@ -795,6 +856,18 @@ struct qla_tgt {
 
 	atomic_t tgt_global_resets_count;
 
+	/* Per-CPU CTIO request queues, read-only after qla_tgt_add_target() */
+	int nr_cpu_qs;
+	struct qla_tgt_cpu_q *cpu_qs;
+
+	/* CTIO handle pools, one per cpu_qs[] entry or one for vha->req */
+	int nr_handle_pools;
+	struct qla_tgt_handle_pool *handle_pools;
+	/* Deferred doorbells, one per handle pool */
+	struct qla_tgt_ctio_batch *ctio_batches;
+
+	struct qla_tgt_cmd_pool cmd_pool;
+
 	struct list_head tgt_list_entry;
 };
 
@@ -827,8 +900,6 @@ struct qla_tgt_cmd {
 	struct se_cmd se_cmd;
 	struct work_struct free_work;
 	struct work_struct work;
-	/* Sense buffer that will be mapped into outgoing status */
-	unsigned char sense_buffer[TRANSPORT_SENSE_BUFFER];
 
 	unsigned int conf_compl_supported:1;/* to save extra sess dereferences */
 	unsigned int sg_mapped:1;
@@ -849,8 +920,19 @@ struct qla_tgt_cmd {
 	uint16_t loop_id;		    /* to save extra sess dereferences */
 	struct qla_tgt *tgt;		    /* to save extra sess dereferences */
 	struct scsi_qla_host *vha;
+	struct req_que *req;		    /* request queue for CTIOs */
+	struct qla_tgt_handle_pool *handles; /* CTIO handles of req */
+	struct qla_tgt_ctio_batch *batch;   /* deferred doorbell of req */
 	struct list_head cmd_list;
+	ktime_t submit_time;		    /* handed to target core */
+	ktime_t done_time;		    /* response queued by target core */
 
+	/* Sense buffer that will be mapped into outgoing status */
+	unsigned char sense_buffer[TRANSPORT_SENSE_BUFFER];
+	/*
+	 * Not cleared when the command is taken from qla_tgt_cmd_pool,
+	 * it is overwritten from the incoming ATIO. Keep new fields above.
+	 */
 	atio_from_isp_t atio;
 };
 
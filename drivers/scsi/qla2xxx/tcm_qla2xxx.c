@@ -377,6 +377,12 @@ struct se_node_acl *tcm_qla2xxx_alloc_fabric_acl(struct se_portal_group *se_tpg)
 		pr_err("Unable to alocate struct tcm_qla2xxx_nacl\n");
 		return NULL;
 	}
+	nacl->lat_hist = alloc_percpu(struct tcm_qla2xxx_lat_hist);
+	if (!nacl->lat_hist) {
+		pr_err("Unable to allocate nacl->lat_hist\n");
+		kfree(nacl);
+		return NULL;
+	}
 
 	return &nacl->se_node_acl;
 }
@@ -387,6 +393,7 @@ static void tcm_qla2xxx_release_fabric_acl(
 {
 	struct tcm_qla2xxx_nacl *nacl = container_of(se_nacl,
 			struct tcm_qla2xxx_nacl, se_node_acl);
+	free_percpu(nacl->lat_hist);
 	kfree(nacl);
 }
 
@@ -405,6 +412,69 @@ static void tcm_qla2xxx_complete_free(struct work_struct *work)
 	transport_generic_free_cmd(&cmd->se_cmd, 0);
 }
 
+static void tcm_qla2xxx_lat_record(struct tcm_qla2xxx_lat_hist __percpu *hist,
+				   int stage, ktime_t start, ktime_t end)
+{
+	s64 usecs;
+	int bucket;
+
+	if (!start.tv64 || !end.tv64)
+		return;
+
+	usecs = ktime_us_delta(end, start);
+	bucket = (usecs > 0) ? fls64(usecs) : 0;
+	if (bucket >= TCM_QLA2XXX_LAT_BUCKETS)
+		bucket = TCM_QLA2XXX_LAT_BUCKETS - 1;
+
+	this_cpu_inc(hist->buckets[stage][bucket]);
+}
+
+/*
+ * Account a finished command to the histograms of its initiator and LUN.
+ * Commands that never reached target_submit_cmd() are not counted.
+ */
+static void tcm_qla2xxx_lat_account(struct qla_tgt_cmd *cmd)
+{
+	struct se_session *se_sess = cmd->se_cmd.se_sess;
+	struct tcm_qla2xxx_tpg *tpg;
+	struct tcm_qla2xxx_nacl *nacl;
+	struct se_lun *se_lun;
+	struct tcm_qla2xxx_lat_hist __percpu *lun_hist = NULL;
+	ktime_t stamp[TCM_QLA2XXX_LAT_STAGES + 1];
+	int i;
+
+	if (!cmd->submit_time.tv64 || !se_sess || !se_sess->se_node_acl)
+		return;
+
+	stamp[0] = cmd->se_cmd.recv_time;
+	stamp[1] = cmd->submit_time;
+	stamp[2] = cmd->done_time;
+	stamp[3] = cmd->se_cmd.ctio_time;
+	stamp[4] = ktime_get();
+
+	nacl = container_of(se_sess->se_node_acl, struct tcm_qla2xxx_nacl,
+			se_node_acl);
+	tpg = container_of(se_sess->se_tpg, struct tcm_qla2xxx_tpg, se_tpg);
+
+	/*
+	 * lun_lat[] is indexed by the TPG LUN, not by the LUN the initiator
+	 * addressed through its mapped LUN ACL.
+	 */
+	se_lun = cmd->se_cmd.se_lun;
+
+	rcu_read_lock();
+	if (tpg->lport->lun_lat && tpg->lport_tpgt == 1 && se_lun &&
+	    se_lun->unpacked_lun < TRANSPORT_MAX_LUNS_PER_TPG)
+		lun_hist = rcu_dereference(tpg->lport->lun_lat[se_lun->unpacked_lun]);
+
+	for (i = 0; i < TCM_QLA2XXX_LAT_STAGES; i++) {
+		tcm_qla2xxx_lat_record(nacl->lat_hist, i, stamp[i], stamp[i + 1]);
+		if (lun_hist)
+			tcm_qla2xxx_lat_record(lun_hist, i, stamp[i], stamp[i + 1]);
+	}
+	rcu_read_unlock();
+}
+
 /*
  * Called from qla_target_template->free_cmd(), and will call
  * tcm_qla2xxx_release_cmd via normal struct target_core_fabric_ops
@@ -412,6 +482,8 @@ static void tcm_qla2xxx_complete_free(struct work_struct *work)
  */
 static void tcm_qla2xxx_free_cmd(struct qla_tgt_cmd *cmd)
 {
+	tcm_qla2xxx_lat_account(cmd);
+
 	WARN_ON(work_pending(&cmd->free_work));
 	/* It's also a problem if the work for the command we're
 	 * freeing is still pending... */
@@ -666,6 +738,7 @@ static int tcm_qla2xxx_handle_cmd(scsi_qla_host_t *vha, struct qla_tgt_cmd *cmd,
 		return -EINVAL;
 	}
 
+	cmd->submit_time = ktime_get();
 	return target_submit_cmd(se_cmd, se_sess, cdb, &cmd->sense_buffer[0],
 				 cmd->unpacked_lun, data_length, fcp_task_attr,
 				 data_dir, flags);
@@ -763,6 +836,8 @@ static int tcm_qla2xxx_queue_data_in(struct se_cmd *se_cmd)
 {
 	struct qla_tgt_cmd *cmd = container_of(se_cmd, struct qla_tgt_cmd, se_cmd);
 
+	if (!cmd->done_time.tv64)
+		cmd->done_time = ktime_get();
 	cmd->bufflen = se_cmd->data_length;
 	cmd->dma_data_direction = tcm_qla2xxx_mapping_dir(se_cmd);
 	cmd->aborted = (se_cmd->transport_state & CMD_T_ABORTED);
@@ -782,6 +857,8 @@ static int tcm_qla2xxx_queue_status(struct se_cmd *se_cmd)
 	struct qla_tgt_cmd *cmd = container_of(se_cmd, struct qla_tgt_cmd, se_cmd);
 	int xmit_type = QLA_TGT_XMIT_STATUS;
 
+	if (!cmd->done_time.tv64)
+		cmd->done_time = ktime_get();
 	cmd->bufflen = se_cmd->data_length;
 	cmd->sg = NULL;
 	cmd->sg_cnt = 0;
@@ -855,10 +932,20 @@ static inline int radix_tree_update(struct radix_tree_root *root,
 {
 	void **old = radix_tree_lookup_slot(root, index);
 
-	*old = item;
+	rcu_assign_pointer(*old, item);
 	return 0;
 }
 
+/*
+ * Expected to be called with struct qla_hw_data->hardware_lock held, after
+ * changing _lport_fcport_map, lport_loopid_map or nacl->qla_tgt_sess.
+ */
+static inline void tcm_qla2xxx_sess_map_changed(struct tcm_qla2xxx_lport *lport)
+{
+	smp_wmb();
+	lport->sess_map_gen++;
+}
+
 /*
  * Expected to be called with struct qla_hw_data->hardware_lock held
  */
@@ -886,6 +973,7 @@ static void tcm_qla2xxx_clear_nacl_from_fcport_map(struct qla_tgt_sess *sess)
 		radix_tree_insert(&lport->_lport_fcport_map,
 				nacl->nport_id, node);
 	}
+	tcm_qla2xxx_sess_map_changed(lport);
 
 	pr_debug("Removed from fcport_map: %p for WWNN: 0x%016LX,"
 			       " port_id: 0x%06x\n", se_nacl, nacl->nport_wwnn,
@@ -924,6 +1012,31 @@ static void tcm_qla2xxx_put_sess(struct qla_tgt_sess *sess)
 	__tcm_qla2xxx_put_session(sess->se_sess);
 }
 
+/*
+ * Called from kref_put_and_lock() with qla_hw_data->hardware_lock held
+ */
+static void tcm_qla2xxx_release_session_unlock(struct kref *kref)
+{
+	struct se_session *se_sess = container_of(kref,
+			struct se_session, sess_kref);
+	struct qla_tgt_sess *sess = se_sess->fabric_sess_ptr;
+	struct qla_hw_data *ha = sess->vha->hw;
+
+	tcm_qla2xxx_release_session(kref);
+	spin_unlock(&ha->hardware_lock);
+}
+
+static void tcm_qla2xxx_put_sess_nolock(struct qla_tgt_sess *sess)
+{
+	struct qla_hw_data *ha = sess->vha->hw;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	kref_put_and_lock(&sess->se_sess->sess_kref,
+			tcm_qla2xxx_release_session_unlock, &ha->hardware_lock);
+	local_irq_restore(flags);
+}
+
 static void tcm_qla2xxx_shutdown_sess(struct qla_tgt_sess *sess)
 {
 	target_sess_cmd_list_set_waiting(sess->se_sess);
@@ -975,6 +1088,7 @@ static void tcm_qla2xxx_drop_nodeacl(struct se_node_acl *se_acl)
 				struct tcm_qla2xxx_nacl, se_node_acl);
 
 	core_tpg_del_initiator_node_acl(se_tpg, se_acl, 1);
+	synchronize_rcu();
 	kfree(nacl);
 }
 
@@ -1227,6 +1341,51 @@ static void tcm_qla2xxx_drop_tpg(struct se_portal_group *se_tpg)
 	kfree(tpg);
 }
 
+static int tcm_qla2xxx_port_link(
+	struct se_portal_group *se_tpg,
+	struct se_lun *lun)
+{
+	struct tcm_qla2xxx_tpg *tpg = container_of(se_tpg,
+			struct tcm_qla2xxx_tpg, se_tpg);
+	struct tcm_qla2xxx_lport *lport = tpg->lport;
+	struct tcm_qla2xxx_lat_hist __percpu *hist;
+
+	if (!lport->lun_lat || tpg->lport_tpgt != 1 ||
+	    lun->unpacked_lun >= TRANSPORT_MAX_LUNS_PER_TPG)
+		return 0;
+
+	hist = alloc_percpu(struct tcm_qla2xxx_lat_hist);
+	if (!hist) {
+		pr_err("Unable to allocate latency histogram for LUN %u\n",
+			lun->unpacked_lun);
+		return -ENOMEM;
+	}
+	rcu_assign_pointer(lport->lun_lat[lun->unpacked_lun], hist);
+	return 0;
+}
+
+static void tcm_qla2xxx_port_unlink(
+	struct se_portal_group *se_tpg,
+	struct se_lun *lun)
+{
+	struct tcm_qla2xxx_tpg *tpg = container_of(se_tpg,
+			struct tcm_qla2xxx_tpg, se_tpg);
+	struct tcm_qla2xxx_lport *lport = tpg->lport;
+	struct tcm_qla2xxx_lat_hist __percpu *hist;
+
+	if (!lport->lun_lat || tpg->lport_tpgt != 1 ||
+	    lun->unpacked_lun >= TRANSPORT_MAX_LUNS_PER_TPG)
+		return;
+
+	hist = lport->lun_lat[lun->unpacked_lun];
+	if (!hist)
+		return;
+	rcu_assign_pointer(lport->lun_lat[lun->unpacked_lun], NULL);
+	/* Wait for tcm_qla2xxx_lat_account() still using hist */
+	synchronize_rcu();
+	free_percpu(hist);
+}
+
 static struct se_portal_group *tcm_qla2xxx_npiv_make_tpg(
 	struct se_wwn *wwn,
 	struct config_group *group,
@@ -1302,6 +1461,68 @@ static struct qla_tgt_sess *tcm_qla2xxx_find_sess_by_s_id(
 	return nacl->qla_tgt_sess;
 }
 
+/*
+ * Lockless version of tcm_qla2xxx_find_sess_by_s_id() that also takes the
+ * session reference. Sessions and node ACLs are only freed after an RCU
+ * grace period, and a session whose last reference is already gone is
+ * reported as not found, for the caller to retry under hardware_lock.
+ */
+static struct qla_tgt_sess *tcm_qla2xxx_get_sess_by_s_id(
+	scsi_qla_host_t *vha,
+	const uint8_t *s_id)
+{
+	struct tcm_qla2xxx_lport *lport;
+	struct tcm_qla2xxx_sess_cache *cache;
+	struct se_node_acl *se_nacl;
+	struct tcm_qla2xxx_nacl *nacl;
+	struct qla_tgt_sess *sess = NULL;
+	unsigned long flags;
+	unsigned int gen;
+	u32 key;
+
+	key = (((unsigned long)s_id[0] << 16) |
+	       ((unsigned long)s_id[1] << 8) |
+	       (unsigned long)s_id[2]);
+
+	rcu_read_lock();
+	lport = ACCESS_ONCE(vha->hw->target_lport_ptr);
+	if (!lport)
+		goto out;
+
+	gen = ACCESS_ONCE(lport->sess_map_gen);
+	smp_rmb();
+
+	/* Also used from ATIO context, keep interrupts off the entry */
+	local_irq_save(flags);
+	cache = this_cpu_ptr(lport->sess_cache);
+	if (cache->sess && cache->key == key && cache->gen == gen)
+		sess = cache->sess;
+	local_irq_restore(flags);
+
+	if (!sess) {
+		se_nacl = radix_tree_lookup(&lport->_lport_fcport_map, key);
+		if (!se_nacl)
+			goto out;
+		nacl = container_of(se_nacl, struct tcm_qla2xxx_nacl, se_node_acl);
+		sess = rcu_dereference(nacl->qla_tgt_sess);
+		if (!sess)
+			goto out;
+
+		local_irq_save(flags);
+		cache = this_cpu_ptr(lport->sess_cache);
+		cache->key = key;
+		cache->gen = gen;
+		cache->sess = sess;
+		local_irq_restore(flags);
+	}
+
+	if (!kref_get_unless_zero(&sess->se_sess->sess_kref))
+		sess = NULL;
+out:
+	rcu_read_unlock();
+	return sess;
+}
+
 /*
  * Expected to be called with struct qla_hw_data->hardware_lock held
  */
@@ -1336,20 +1557,20 @@ static void tcm_qla2xxx_set_sess_by_s_id(
 					(int)key);
 
 		qla_tgt_sess->se_sess = se_sess;
-		nacl->qla_tgt_sess = qla_tgt_sess;
+		rcu_assign_pointer(nacl->qla_tgt_sess, qla_tgt_sess);
 		return;
 	}
 
 	if (nacl->qla_tgt_sess) {
 		radix_tree_update(&lport->_lport_fcport_map, key, new_se_nacl);
 		qla_tgt_sess->se_sess = se_sess;
-		nacl->qla_tgt_sess = qla_tgt_sess;
+		rcu_assign_pointer(nacl->qla_tgt_sess, qla_tgt_sess);
 		return;
 	}
 
 	radix_tree_update(&lport->_lport_fcport_map, key, new_se_nacl);
 	qla_tgt_sess->se_sess = se_sess;
-	nacl->qla_tgt_sess = qla_tgt_sess;
+	rcu_assign_pointer(nacl->qla_tgt_sess, qla_tgt_sess);
 }
 
 static void tcm_qla2xxx_clear_sess_by_s_id(
@@ -1376,7 +1597,7 @@ static void tcm_qla2xxx_clear_sess_by_s_id(
 
 	if (!slot) {
 		qla_tgt_sess->se_sess = se_sess;
-		nacl->qla_tgt_sess = qla_tgt_sess;
+		rcu_assign_pointer(nacl->qla_tgt_sess, qla_tgt_sess);
 		return;
 	}
 
@@ -1454,29 +1675,29 @@ static void tcm_qla2xxx_set_sess_by_loop_id(
 		 loop_id, se_sess, qla_tgt_sess, !!saved_nacl);
 
 	if (!saved_nacl) {
-		fc_loopid->se_nacl = new_se_nacl;
+		rcu_assign_pointer(fc_loopid->se_nacl, new_se_nacl);
 		if (qla_tgt_sess->se_sess != se_sess)
 			qla_tgt_sess->se_sess = se_sess;
 		if (nacl->qla_tgt_sess != qla_tgt_sess)
-			nacl->qla_tgt_sess = qla_tgt_sess;
+			rcu_assign_pointer(nacl->qla_tgt_sess, qla_tgt_sess);
 		return;
 	}
 
 	if (nacl->qla_tgt_sess) {
-		fc_loopid->se_nacl = new_se_nacl;
+		rcu_assign_pointer(fc_loopid->se_nacl, new_se_nacl);
 		if (qla_tgt_sess->se_sess != se_sess)
 			qla_tgt_sess->se_sess = se_sess;
 		if (nacl->qla_tgt_sess != qla_tgt_sess)
-			nacl->qla_tgt_sess = qla_tgt_sess;
+			rcu_assign_pointer(nacl->qla_tgt_sess, qla_tgt_sess);
 		return;
 	}
 
 	pr_debug("Replacing existing fc_loopid->se_nacl w/o active nacl->qla_tgt_sess\n");
-	fc_loopid->se_nacl = new_se_nacl;
+	rcu_assign_pointer(fc_loopid->se_nacl, new_se_nacl);
 	if (qla_tgt_sess->se_sess != se_sess)
 		qla_tgt_sess->se_sess = se_sess;
 	if (nacl->qla_tgt_sess != qla_tgt_sess)
-		nacl->qla_tgt_sess = qla_tgt_sess;
+		rcu_assign_pointer(nacl->qla_tgt_sess, qla_tgt_sess);
 
 	pr_debug("Setup nacl->qla_tgt_sess %p by loop_id for se_nacl: %p, initiatorname: %s\n",
 			nacl->qla_tgt_sess, new_se_nacl,
@@ -1504,11 +1725,11 @@ static void tcm_qla2xxx_clear_sess_by_loop_id(
 		 loop_id, se_sess, qla_tgt_sess, !!saved_nacl);
 
 	if (!saved_nacl) {
-		fc_loopid->se_nacl = new_se_nacl;
+		rcu_assign_pointer(fc_loopid->se_nacl, new_se_nacl);
 		if (qla_tgt_sess->se_sess != se_sess)
 			qla_tgt_sess->se_sess = se_sess;
 		if (nacl->qla_tgt_sess != qla_tgt_sess)
-			nacl->qla_tgt_sess = qla_tgt_sess;
+			rcu_assign_pointer(nacl->qla_tgt_sess, qla_tgt_sess);
 		return;
 	}
 
@@ -1532,6 +1753,9 @@ static void tcm_qla2xxx_free_session(struct qla_tgt_sess *sess)
 	BUG_ON(!ha->target_lport_ptr);
 	BUG_ON(!se_sess);
 
+	/* Wait for tcm_qla2xxx_get_sess_by_s_id() readers of sess */
+	synchronize_rcu();
+
 	target_wait_for_sess_cmds(se_sess, 0);
 
 	transport_deregister_session_configfs(sess->se_sess);
@@ -1564,6 +1788,7 @@ static void tcm_qla2xxx_unset_sess(struct se_session *se_sess)
 			sess, be_sid);
 	tcm_qla2xxx_clear_sess_by_loop_id(lport, NULL, nacl, se_sess,
 			sess, sess->loop_id);
+	tcm_qla2xxx_sess_map_changed(lport);
 }
 
 /*
@@ -1637,6 +1862,7 @@ static int tcm_qla2xxx_check_initiator_node_acl(
 			qla_tgt_sess, s_id);
 	tcm_qla2xxx_set_sess_by_loop_id(lport, se_nacl, nacl, se_sess,
 			qla_tgt_sess, loop_id);
+	tcm_qla2xxx_sess_map_changed(lport);
 	/*
 	 * Finally register the new FC Nexus with TCM
 	 */
@@ -1682,7 +1908,8 @@ static void tcm_qla2xxx_update_sess(struct qla_tgt_sess *sess, port_id_t s_id,
 		if (lport->lport_loopid_map[sess->loop_id].se_nacl == se_nacl)
 			lport->lport_loopid_map[sess->loop_id].se_nacl = NULL;
 
-		lport->lport_loopid_map[loop_id].se_nacl = se_nacl;
+		rcu_assign_pointer(lport->lport_loopid_map[loop_id].se_nacl,
+				   se_nacl);
 
 		sess->loop_id = loop_id;
 	}
@@ -1715,6 +1942,7 @@ static void tcm_qla2xxx_update_sess(struct qla_tgt_sess *sess, port_id_t s_id,
 		sess->s_id = s_id;
 		nacl->nport_id = key;
 	}
+	tcm_qla2xxx_sess_map_changed(lport);
 
 	sess->conf_compl_supported = conf_compl_supported;
 }
@@ -1731,9 +1959,11 @@ static struct qla_tgt_func_tmpl tcm_qla2xxx_template = {
 	.check_initiator_node_acl = tcm_qla2xxx_check_initiator_node_acl,
 	.update_sess		= tcm_qla2xxx_update_sess,
 	.find_sess_by_s_id	= tcm_qla2xxx_find_sess_by_s_id,
+	.get_sess_by_s_id	= tcm_qla2xxx_get_sess_by_s_id,
 	.find_sess_by_loop_id	= tcm_qla2xxx_find_sess_by_loop_id,
 	.clear_nacl_from_fcport_map = tcm_qla2xxx_clear_nacl_from_fcport_map,
 	.put_sess		= tcm_qla2xxx_put_sess,
+	.put_sess_nolock	= tcm_qla2xxx_put_sess_nolock,
 	.shutdown_sess		= tcm_qla2xxx_shutdown_sess,
 };
 
@@ -1752,6 +1982,22 @@ static int tcm_qla2xxx_init_lport(struct tcm_qla2xxx_lport *lport)
 	       * 65536);
 	pr_debug("qla2xxx: Allocated lport_loopid_map of %lu bytes\n",
 	       sizeof(struct tcm_qla2xxx_fc_loopid) * 65536);
+
+	lport->sess_cache = alloc_percpu(struct tcm_qla2xxx_sess_cache);
+	if (!lport->sess_cache) {
+		pr_err("Unable to allocate lport->sess_cache\n");
+		vfree(lport->lport_loopid_map);
+		return -ENOMEM;
+	}
+
+	lport->lun_lat = vzalloc(sizeof(*lport->lun_lat) *
+				TRANSPORT_MAX_LUNS_PER_TPG);
+	if (!lport->lun_lat) {
+		pr_err("Unable to allocate lport->lun_lat\n");
+		free_percpu(lport->sess_cache);
+		vfree(lport->lport_loopid_map);
+		return -ENOMEM;
+	}
 	return 0;
 }
 
@@ -1804,6 +2050,135 @@ static const struct file_operations sessions_debugfs_fops = {
 	.llseek		= default_llseek,
 };
 
+static const char * const latency_stage_names[TCM_QLA2XXX_LAT_STAGES] = {
+	[TCM_QLA2XXX_LAT_ATIO_SUBMIT]	= "atio->submit",
+	[TCM_QLA2XXX_LAT_SUBMIT_DONE]	= "submit->done",
+	[TCM_QLA2XXX_LAT_DONE_CTIO]	= "done->ctio",
+	[TCM_QLA2XXX_LAT_CTIO_COMPL]	= "ctio->compl",
+};
+
+static void latency_hist_sum(struct tcm_qla2xxx_lat_hist __percpu *hist,
+			     struct tcm_qla2xxx_lat_hist *sum)
+{
+	int cpu, s, b;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		struct tcm_qla2xxx_lat_hist *h = per_cpu_ptr(hist, cpu);
+
+		for (s = 0; s < TCM_QLA2XXX_LAT_STAGES; s++)
+			for (b = 0; b < TCM_QLA2XXX_LAT_BUCKETS; b++)
+				sum->buckets[s][b] += h->buckets[s][b];
+	}
+}
+
+/*
+ * Print the non-empty buckets of sum, bucket b counts commands that
+ * took less than 2^b microseconds.
+ */
+static int latency_debugfs_show(char *buf, int size, int off, const char *name,
+				struct tcm_qla2xxx_lat_hist *sum)
+{
+	int s, b;
+
+	off += snprintf(buf + off, size - off, "%s\n", name);
+	for (s = 0; s < TCM_QLA2XXX_LAT_STAGES && off < size; s++) {
+		off += snprintf(buf + off, size - off, "  %-13s",
+				latency_stage_names[s]);
+		for (b = 0; b < TCM_QLA2XXX_LAT_BUCKETS && off < size; b++) {
+			if (!sum->buckets[s][b])
+				continue;
+			off += snprintf(buf + off, size - off, " <%lluus:%lu",
+					1ULL << b, sum->buckets[s][b]);
+		}
+		if (off < size)
+			off += snprintf(buf + off, size - off, "\n");
+	}
+	return min(off, size);
+}
+
+static int latency_debugfs_open(struct inode *inode, struct file *filp)
+{
+	struct tcm_qla2xxx_lport *lport = inode->i_private;
+	struct qla_hw_data *ha = lport->qla_vha->hw;
+	struct tcm_qla2xxx_lat_hist __percpu *hist;
+	struct tcm_qla2xxx_lat_hist *sum;
+	struct se_node_acl *se_nacl;
+	struct tcm_qla2xxx_nacl *nacl;
+	unsigned long flags, index = 0;
+	char name[TRANSPORT_IQN_LEN + 16];
+	int size = 32 * PAGE_SIZE, off = 0;
+	char *buf;
+	u32 i;
+
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+	buf = vzalloc(size);
+	if (!buf) {
+		kfree(sum);
+		return -ENOMEM;
+	}
+
+	rcu_read_lock();
+	for (i = 0; i < TRANSPORT_MAX_LUNS_PER_TPG && off < size; i++) {
+		hist = rcu_dereference(lport->lun_lat[i]);
+		if (!hist)
+			continue;
+		snprintf(name, sizeof(name), "lun %u", i);
+		latency_hist_sum(hist, sum);
+		off = latency_debugfs_show(buf, size, off, name, sum);
+	}
+	rcu_read_unlock();
+	/*
+	 * Initiators are only released after being cleared from
+	 * _lport_fcport_map under hardware_lock, so snapshot one of them at
+	 * a time under the lock and format it after dropping the lock.
+	 */
+	while (off < size) {
+		spin_lock_irqsave(&ha->hardware_lock, flags);
+		if (radix_tree_gang_lookup(&lport->_lport_fcport_map,
+				(void **)&se_nacl, index, 1) != 1) {
+			spin_unlock_irqrestore(&ha->hardware_lock, flags);
+			break;
+		}
+		nacl = container_of(se_nacl, struct tcm_qla2xxx_nacl,
+				se_node_acl);
+		index = nacl->nport_id + 1;
+		snprintf(name, sizeof(name), "initiator %s",
+			se_nacl->initiatorname);
+		latency_hist_sum(nacl->lat_hist, sum);
+		spin_unlock_irqrestore(&ha->hardware_lock, flags);
+
+		off = latency_debugfs_show(buf, size, off, name, sum);
+	}
+
+	kfree(sum);
+	filp->private_data = buf;
+	return 0;
+}
+
+static int latency_debugfs_close(struct inode *inode, struct file *filp)
+{
+	vfree(filp->private_data);
+	return 0;
+}
+
+static ssize_t latency_debugfs_read(struct file *filp, char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	return simple_read_from_buffer(buf, count, ppos, filp->private_data,
+				       strnlen(filp->private_data, 32 * PAGE_SIZE));
+}
+
+static const struct file_operations latency_debugfs_fops = {
+	.owner		= THIS_MODULE,
+	.open		= latency_debugfs_open,
+	.release	= latency_debugfs_close,
+	.read		= latency_debugfs_read,
+	.llseek		= default_llseek,
+};
+
 static struct se_wwn *tcm_qla2xxx_make_lport(
 	struct target_fabric_configfs *tf,
 	struct config_group *group,
@@ -1842,8 +2217,17 @@ static struct se_wwn *tcm_qla2xxx_make_lport(
 							     &sessions_debugfs_fops);
 	kfree(sessions_name);
 
+	sessions_name = kasprintf(GFP_KERNEL, "qla2xxx-latency-%ld", lport->qla_vha->host_no);
+	if (sessions_name)
+		lport->latency_dentry = debugfs_create_file(sessions_name, S_IRUGO,
+							    target_debugfs_root, lport,
+							    &latency_debugfs_fops);
+	kfree(sessions_name);
+
 	return &lport->lport_wwn;
 out_lport:
+	vfree(lport->lun_lat);
+	free_percpu(lport->sess_cache);
 	vfree(lport->lport_loopid_map);
 out:
 	kfree(lport);
@@ -1873,6 +2257,8 @@ static void tcm_qla2xxx_drop_lport(struct se_wwn *wwn)
 
 	if (lport->sessions_dentry)
 		debugfs_remove(lport->sessions_dentry);
+	if (lport->latency_dentry)
+		debugfs_remove(lport->latency_dentry);
 
 	/*
 	 * Call into qla2x_target.c LLD logic to complete the
@@ -1883,7 +2269,11 @@ static void tcm_qla2xxx_drop_lport(struct se_wwn *wwn)
 		qla_tgt_stop_phase2(ha->qla_tgt);
 
 	qla_tgt_lport_deregister(vha);
+	/* Wait for lockless session lookups still using lport */
+	synchronize_rcu();
 
+	vfree(lport->lun_lat);
+	free_percpu(lport->sess_cache);
 	vfree(lport->lport_loopid_map);
 	radix_tree_destroy(&lport->_lport_fcport_map);
 	kfree(lport);
@@ -2015,8 +2405,8 @@ static struct target_core_fabric_ops tcm_qla2xxx_ops = {
 	.fabric_drop_wwn		= tcm_qla2xxx_drop_lport,
 	.fabric_make_tpg		= tcm_qla2xxx_make_tpg,
 	.fabric_drop_tpg		= tcm_qla2xxx_drop_tpg,
-	.fabric_post_link		= NULL,
-	.fabric_pre_unlink		= NULL,
+	.fabric_post_link		= tcm_qla2xxx_port_link,
+	.fabric_pre_unlink		= tcm_qla2xxx_port_unlink,
 	.fabric_make_np			= NULL,
 	.fabric_drop_np			= NULL,
 	.fabric_make_nodeacl		= tcm_qla2xxx_make_nodeacl,
@@ -9,6 +9,21 @@
 
 #include "qla_target.h"
 
+/* log2(usecs) buckets, see tcm_qla2xxx_lat_record() */
+#define TCM_QLA2XXX_LAT_BUCKETS	32
+
+enum {
+	TCM_QLA2XXX_LAT_ATIO_SUBMIT,	/* ATIO received -> target_submit_cmd() */
+	TCM_QLA2XXX_LAT_SUBMIT_DONE,	/* target_submit_cmd() -> backend done */
+	TCM_QLA2XXX_LAT_DONE_CTIO,	/* backend done -> status CTIO built */
+	TCM_QLA2XXX_LAT_CTIO_COMPL,	/* status CTIO built -> CTIO completion */
+	TCM_QLA2XXX_LAT_STAGES,
+};
+
+struct tcm_qla2xxx_lat_hist {
+	unsigned long buckets[TCM_QLA2XXX_LAT_STAGES][TCM_QLA2XXX_LAT_BUCKETS];
+};
+
 struct tcm_qla2xxx_nacl {
 	/* From libfc struct fc_rport->port_id */
 	u32 nport_id;
@@ -20,6 +35,8 @@ struct tcm_qla2xxx_nacl {
 	struct qla_tgt_sess *qla_tgt_sess;
 	/* Pointer to TCM FC nexus */
 	struct se_session *nport_nexus;
+	/* Per initiator command latency */
+	struct tcm_qla2xxx_lat_hist __percpu *lat_hist;
 	/* Returned by tcm_qla2xxx_make_nodeacl() */
 	struct se_node_acl se_node_acl;
 };
@@ -50,6 +67,13 @@ struct tcm_qla2xxx_fc_loopid {
 	struct se_node_acl *se_nacl;
 };
 
+/* Per-CPU copy of the last S_ID lookup, see tcm_qla2xxx_get_sess_by_s_id() */
+struct tcm_qla2xxx_sess_cache {
+	u32 key;
+	unsigned int gen;
+	struct qla_tgt_sess *sess;
+};
+
 struct tcm_qla2xxx_lport {
 	/* SCSI protocol the lport is providing */
 	u8 lport_proto_id;
@@ -69,6 +93,18 @@ struct tcm_qla2xxx_lport {
 	struct radix_tree_root _lport_fcport_map;
 	/* vmalloc-ed memory for fc_port pointers for 16-bit FC loop ID */
 	struct tcm_qla2xxx_fc_loopid *lport_loopid_map;
+	/*
+	 * Both maps above are modified under hardware_lock and may be read
+	 * under rcu_read_lock(). Bumped on every change to invalidate
+	 * sess_cache.
+	 */
+	unsigned int sess_map_gen;
+	struct tcm_qla2xxx_sess_cache __percpu *sess_cache;
+	/*
+	 * Per LUN command latency of TPG=1, indexed by unpacked_lun.
+	 * Set by fabric_post_link(), read under rcu_read_lock().
+	 */
+	struct tcm_qla2xxx_lat_hist __percpu **lun_lat;
 	/* Pointer to struct scsi_qla_host from qla2xxx LLD */
 	struct scsi_qla_host *qla_vha;
 	/* Pointer to struct scsi_qla_host for NPIV VP from qla2xxx LLD */
@@ -82,4 +118,5 @@ struct tcm_qla2xxx_lport {
 	/* Returned by tcm_qla2xxx_make_lport() */
 	struct se_wwn lport_wwn;
 	struct dentry *sessions_dentry;
+	struct dentry *latency_dentry;
 };
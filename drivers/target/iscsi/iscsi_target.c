@@ -499,11 +499,15 @@ static int __init iscsi_target_init_module(void)
 	if (ret < 0)
 		goto configfs_out;
 
-	if (iscsi_allocate_thread_sets(TARGET_THREAD_SET_COUNT) !=
+	if (iscsi_conn_engine_init() < 0)
+		goto ts_out1;
+
+	if (!iscsi_conn_engine_enabled() &&
+	    iscsi_allocate_thread_sets(TARGET_THREAD_SET_COUNT) !=
 			TARGET_THREAD_SET_COUNT) {
 		pr_err("iscsi_allocate_thread_sets() returned"
 			" unexpected value!\n");
-		goto ts_out1;
+		goto engine_out;
 	}
 
 	lio_cmd_cache = kmem_cache_create("lio_cmd_cache",
@@ -567,6 +571,8 @@ cmd_out:
 	kmem_cache_destroy(lio_cmd_cache);
 ts_out2:
 	iscsi_deallocate_thread_sets();
+engine_out:
+	iscsi_conn_engine_free();
 ts_out1:
 	iscsi_thread_set_free();
 configfs_out:
@@ -579,6 +585,7 @@ out:
 static void __exit iscsi_target_cleanup_module(void)
 {
 	iscsi_deallocate_thread_sets();
+	iscsi_conn_engine_free();
 	iscsi_thread_set_free();
 	iscsit_release_discovery_tpg();
 	kmem_cache_destroy(lio_cmd_cache);
@@ -621,7 +628,7 @@ int iscsit_add_reject(
 	}
 
 	spin_lock_bh(&conn->cmd_lock);
-	list_add_tail(&cmd->i_list, &conn->conn_cmd_list);
+	iscsit_add_cmd_to_conn_list(cmd, conn);
 	spin_unlock_bh(&conn->cmd_lock);
 
 	cmd->i_state = ISTATE_SEND_REJECT;
@@ -668,7 +675,7 @@ int iscsit_add_reject_from_cmd(
 
 	if (add_to_conn) {
 		spin_lock_bh(&conn->cmd_lock);
-		list_add_tail(&cmd->i_list, &conn->conn_cmd_list);
+		iscsit_add_cmd_to_conn_list(cmd, conn);
 		spin_unlock_bh(&conn->cmd_lock);
 	}
 
@@ -683,27 +690,15 @@ int iscsit_add_reject_from_cmd(
 }
 
 /*
- * Map some portion of the allocated scatterlist to an iovec, suitable for
- * kernel sockets to copy data in/out.
+ * Set cmd->first_data_sg and cmd->first_data_sg_off for data_offset,
+ * assuming every entry in the (possibly chained) sg list is page-sized.
  */
-static int iscsit_map_iovec(
+static void iscsit_seek_data_sg(
 	struct iscsi_cmd *cmd,
-	struct kvec *iov,
-	u32 data_offset,
-	u32 data_length)
+	u32 data_offset)
 {
-	u32 i = 0;
 	struct scatterlist *sg;
-	unsigned int page_off;
 
-	/*
-	 * Need to walk the sg list to get to data_offset, because
-	 * ps_bdrv might give us a set of chained lists, so we can't
-	 * just compute an index directly.
-	 *
-	 * We do assume for now that every actual entry in the sg list
-	 * is page-sized, since ps_bdrv goes to pains to make that true.
-	 */
 	sg = cmd->se_cmd.t_data_sg;
 	while (data_offset >= PAGE_SIZE) {
 		WARN_ONCE(sg->length != PAGE_SIZE, "SG entry with length %d\n", sg->length);
@@ -711,10 +706,28 @@ static int iscsit_map_iovec(
 		data_offset -= PAGE_SIZE;
 	}
 
-	page_off = data_offset;
-
 	cmd->first_data_sg = sg;
-	cmd->first_data_sg_off = page_off;
+	cmd->first_data_sg_off = data_offset;
+	cmd->kmapped_nents = 0;
+}
+
+/*
+ * Map some portion of the allocated scatterlist to an iovec, suitable for
+ * kernel sockets to copy data in/out.
+ */
+static int iscsit_map_iovec(
+	struct iscsi_cmd *cmd,
+	struct kvec *iov,
+	u32 data_offset,
+	u32 data_length)
+{
+	u32 i = 0;
+	struct scatterlist *sg;
+	unsigned int page_off;
+
+	iscsit_seek_data_sg(cmd, data_offset);
+	sg = cmd->first_data_sg;
+	page_off = cmd->first_data_sg_off;
 
 	while (data_length) {
 		u32 cur_len = min_t(u32, data_length, sg->length - page_off);
@@ -790,7 +803,7 @@ void iscsit_queue_deferred_cmd(struct iscsi_cmd *cmd)
 	list_add_tail(&cmd->deferred_list, &conn->deferred_cmd_list);
 	spin_unlock(&conn->deferred_cmd_lock);
 
-	wake_up_interruptible(&conn->deferred_wq);
+	iscsi_conn_wake_deferred(conn);
 }
 
 static void iscsit_handle_deferred_read(struct iscsi_cmd *cmd)
@@ -808,7 +821,7 @@ static void iscsit_handle_deferred_read(struct iscsi_cmd *cmd)
 			1, 0, cmd->deferred_hdr, cmd);
 
 		atomic_set(&cmd->conn->transport_failed, 1);
-		send_sig(SIGINT, cmd->conn->thread_set->rx_thread, 1);
+		iscsi_interrupt_rx_thread(cmd->conn);
 	}
 }
 
@@ -836,7 +849,7 @@ static void iscsit_handle_deferred_write(struct iscsi_cmd *cmd)
 			1, 0, cmd->deferred_hdr, cmd);
 
 		atomic_set(&cmd->conn->transport_failed, 1);
-		send_sig(SIGINT, cmd->conn->thread_set->rx_thread, 1);
+		iscsi_interrupt_rx_thread(cmd->conn);
 	} else {
 		iscsit_copy_deferred_mem(cmd, sgl, nents);
 	}
@@ -1062,7 +1075,7 @@ done:
 
 attach_cmd:
 	spin_lock_bh(&conn->cmd_lock);
-	list_add_tail(&cmd->i_list, &conn->conn_cmd_list);
+	iscsit_add_cmd_to_conn_list(cmd, conn);
 	spin_unlock_bh(&conn->cmd_lock);
 	/*
 	 * Check if we need to delay processing because of ALUA
@@ -1237,25 +1250,31 @@ static u32 iscsit_do_crypto_hash_sg(
 	u8 *pad_bytes)
 {
 	u32 data_crc;
-	u32 i;
-	struct scatterlist *sg;
+	struct scatterlist *sg, data_sg;
 	unsigned int page_off;
 
 	crypto_hash_init(hash);
 
 	sg = cmd->first_data_sg;
 	page_off = cmd->first_data_sg_off;
+	/*
+	 * Only a leading partial entry needs a scatterlist of its own, the
+	 * rest of the se_cmd scatterlist is handed to the crypto layer in a
+	 * single update that stops after data_length bytes.
+	 */
+	if (page_off && data_length) {
+		u32 cur_len = min_t(u32, data_length, (sg->length - page_off));
 
-	i = 0;
-	while (data_length) {
-		u32 cur_len = min_t(u32, data_length, (sg[i].length - page_off));
-
-		crypto_hash_update(hash, &sg[i], cur_len);
+		sg_init_table(&data_sg, 1);
+		sg_set_page(&data_sg, sg_page(sg), cur_len,
+			    sg->offset + page_off);
+		crypto_hash_update(hash, &data_sg, cur_len);
 
 		data_length -= cur_len;
-		page_off = 0;
-		i++;
+		sg = sg_next(sg);
 	}
+	if (data_length)
+		crypto_hash_update(hash, sg, data_length);
 
 	if (padding) {
 		struct scatterlist pad_sg;
@@ -1276,18 +1295,16 @@ static void iscsit_do_crypto_hash_buf(
 	u8 *pad_bytes,
 	u8 *data_crc)
 {
-	struct scatterlist sg;
-
-	crypto_hash_init(hash);
+	struct scatterlist sg[2];
 
-	sg_init_one(&sg, buf, payload_length);
-	crypto_hash_update(hash, &sg, payload_length);
+	sg_init_table(sg, ARRAY_SIZE(sg));
+	sg_set_buf(&sg[0], buf, payload_length);
+	if (padding)
+		sg_set_buf(&sg[1], pad_bytes, padding);
+	else
+		sg_mark_end(&sg[0]);
 
-	if (padding) {
-		sg_init_one(&sg, pad_bytes, padding);
-		crypto_hash_update(hash, &sg, padding);
-	}
-	crypto_hash_final(hash, data_crc);
+	crypto_hash_digest(hash, sg, payload_length + padding, data_crc);
 }
 
 static int iscsit_handle_data_out(struct iscsi_conn *conn, unsigned char *buf)
@@ -1681,7 +1698,7 @@ static int iscsit_handle_nop_out(
 		 * Initiator is expecting a NopIN ping reply,
 		 */
 		spin_lock_bh(&conn->cmd_lock);
-		list_add_tail(&cmd->i_list, &conn->conn_cmd_list);
+		iscsit_add_cmd_to_conn_list(cmd, conn);
 		spin_unlock_bh(&conn->cmd_lock);
 
 		iscsit_ack_from_expstatsn(conn, hdr->exp_statsn);
@@ -1868,7 +1885,7 @@ static int iscsit_handle_task_mgt_cmd(
 		se_tmr->call_transport = 1;
 attach:
 	spin_lock_bh(&conn->cmd_lock);
-	list_add_tail(&cmd->i_list, &conn->conn_cmd_list);
+	iscsit_add_cmd_to_conn_list(cmd, conn);
 	spin_unlock_bh(&conn->cmd_lock);
 
 	if (!(hdr->opcode & ISCSI_OP_IMMEDIATE)) {
@@ -2049,7 +2066,7 @@ static int iscsit_handle_text_cmd(
 	cmd->data_direction	= DMA_NONE;
 
 	spin_lock_bh(&conn->cmd_lock);
-	list_add_tail(&cmd->i_list, &conn->conn_cmd_list);
+	iscsit_add_cmd_to_conn_list(cmd, conn);
 	spin_unlock_bh(&conn->cmd_lock);
 
 	iscsit_ack_from_expstatsn(conn, hdr->exp_statsn);
@@ -2237,7 +2254,7 @@ static int iscsit_handle_logout_cmd(
 		logout_remove = 1;
 
 	spin_lock_bh(&conn->cmd_lock);
-	list_add_tail(&cmd->i_list, &conn->conn_cmd_list);
+	iscsit_add_cmd_to_conn_list(cmd, conn);
 	spin_unlock_bh(&conn->cmd_lock);
 
 	if (reason_code != ISCSI_LOGOUT_REASON_RECOVERY)
@@ -2322,6 +2339,9 @@ static int iscsit_handle_snack(
 
 static void iscsit_rx_thread_wait_for_tcp(struct iscsi_conn *conn)
 {
+	if (test_bit(ISCSI_ENGINE_FORCE, &conn->engine_flags))
+		return;
+
 	if ((conn->sock->sk->sk_shutdown & SEND_SHUTDOWN) ||
 	    (conn->sock->sk->sk_shutdown & RCV_SHUTDOWN)) {
 		wait_for_completion_interruptible_timeout(
@@ -2453,7 +2473,7 @@ static void iscsit_build_conn_drop_async_message(struct iscsi_conn *conn)
 	cmd->i_state = ISTATE_SEND_ASYNCMSG;
 
 	spin_lock_bh(&conn_p->cmd_lock);
-	list_add_tail(&cmd->i_list, &conn_p->conn_cmd_list);
+	iscsit_add_cmd_to_conn_list(cmd, conn_p);
 	spin_unlock_bh(&conn_p->cmd_lock);
 
 	iscsit_add_cmd_to_response_queue(cmd, conn_p, cmd->i_state);
@@ -2619,11 +2639,21 @@ static int iscsit_send_data_in(
 			" for DataIN PDU 0x%08x\n", *header_digest);
 	}
 
-	iov_ret = iscsit_map_iovec(cmd, &cmd->iov_data[1], datain.offset, datain.length);
-	if (iov_ret < 0)
-		return -1;
+	/*
+	 * Without IFMarker iscsit_fe_sendpage_sg() sends the payload
+	 * straight from the se_cmd pages, so only the header, padding and
+	 * DataDigest need to be described by cmd->iov_data[].
+	 */
+	if (!conn->conn_ops->IFMarker) {
+		iscsit_seek_data_sg(cmd, datain.offset);
+	} else {
+		iov_ret = iscsit_map_iovec(cmd, &cmd->iov_data[1],
+					   datain.offset, datain.length);
+		if (iov_ret < 0)
+			return -1;
 
-	iov_count += iov_ret;
+		iov_count += iov_ret;
+	}
 	tx_size += datain.length;
 
 	cmd->padding = ((-datain.length) & 3);
@@ -3491,6 +3521,9 @@ static int iscsit_send_reject(
 
 static void iscsit_tx_thread_wait_for_tcp(struct iscsi_conn *conn)
 {
+	if (test_bit(ISCSI_ENGINE_FORCE, &conn->engine_flags))
+		return;
+
 	if ((conn->sock->sk->sk_shutdown & SEND_SHUTDOWN) ||
 	    (conn->sock->sk->sk_shutdown & RCV_SHUTDOWN)) {
 		wait_for_completion_interruptible_timeout(
@@ -3501,17 +3534,64 @@ static void iscsit_tx_thread_wait_for_tcp(struct iscsi_conn *conn)
 
 #ifdef CONFIG_SMP
 
+/*
+ * NUMA node of the network device the connection is routed through, or -1
+ * when it cannot be determined.
+ */
+static int iscsit_conn_netdev_node(struct iscsi_conn *conn)
+{
+	struct dst_entry *dst;
+	int node = -1;
+
+	if (!conn->sock)
+		return -1;
+
+	dst = sk_dst_get(conn->sock->sk);
+	if (!dst)
+		return -1;
+
+	if (dst->dev && dst->dev->dev.parent)
+		node = dev_to_node(dst->dev->dev.parent);
+	dst_release(dst);
+
+	return node;
+}
+
+/*
+ * Build conn->conn_cpumask from the TPG cpu_affinity attribute:
+ *
+ * TA_CPU_AFFINITY_NONE: any online CPU, left to the scheduler.
+ * TA_CPU_AFFINITY_NODE: the CPUs of the NIC's NUMA node.
+ * TA_CPU_AFFINITY_CPU:  one CPU of the NIC's NUMA node, handed out
+ *                       round-robin per TPG, shared by RX, TX and
+ *                       deferred contexts of the connection.
+ */
 void iscsit_thread_get_cpumask(struct iscsi_conn *conn)
 {
-	/*
-	 * Let iscsi worker threads run on CPUs 3,5,9,11, which are
-	 * the CPUs where we put the ethernet interrupts.  The hope
-	 * is that the kernel will run the thread on the CPU where
-	 * the network data is coming in.
-	 */
-	static uint8_t cpus[] = {3, 5, 9, 11};
-	uint8_t cpu = cpus[conn->thread_set->thread_id & 0x3];
+	struct iscsi_portal_group *tpg = ISCSI_TPG_C(conn);
+	u32 policy = ISCSI_TPG_ATTRIB(tpg)->cpu_affinity;
+	int node, cpu, n;
+
+	cpumask_copy(conn->conn_cpumask, cpu_online_mask);
+	if (policy == TA_CPU_AFFINITY_NONE)
+		return;
+
+	node = iscsit_conn_netdev_node(conn);
+	if (node >= 0 && cpumask_intersects(cpumask_of_node(node),
+					    cpu_online_mask))
+		cpumask_and(conn->conn_cpumask, cpumask_of_node(node),
+			    cpu_online_mask);
+
+	if (policy == TA_CPU_AFFINITY_NODE)
+		return;
 
+	n = (atomic_inc_return(&tpg->tpg_next_cpu) & INT_MAX) %
+		cpumask_weight(conn->conn_cpumask);
+	cpu = cpumask_first(conn->conn_cpumask);
+	while (n--)
+		cpu = cpumask_next(cpu, conn->conn_cpumask);
+
+	cpumask_clear(conn->conn_cpumask);
 	cpumask_set_cpu(cpu, conn->conn_cpumask);
 }
 
@@ -3562,7 +3642,12 @@ void iscsit_thread_get_cpumask(struct iscsi_conn *conn)
 #define iscsit_thread_check_cpumask(X, Y, Z) ({})
 #endif /* CONFIG_SMP */
 
-int iscsi_target_tx_thread(void *arg)
+/*
+ * Send everything on the immediate and response queues.  Returns -1 on
+ * a transport failure, and 1 once a logout response has been sent and the
+ * connection is going away without this context.
+ */
+static int iscsit_tx_handle_queues(struct iscsi_conn *conn)
 {
 	u8 state;
 	int eodr = 0;
@@ -3571,8 +3656,294 @@ int iscsi_target_tx_thread(void *arg)
 	int use_misc = 0;
 	int map_sg = 0;
 	struct iscsi_cmd *cmd = NULL;
+
+	local_bh_disable();
+get_immediate:
+	cmd = iscsit_get_cmd_from_immediate_queue_bh(conn, &state);
+	if (cmd) {
+		atomic_set(&conn->check_immediate_queue, 0);
+
+		spin_lock(&cmd->istate_lock);
+		switch (state) {
+		case ISTATE_SEND_R2T:
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			ret = iscsit_send_r2t(cmd, conn);
+			break;
+		case ISTATE_REMOVE:
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+
+			if (cmd->data_direction == DMA_TO_DEVICE)
+				iscsit_stop_dataout_timer(cmd);
+
+			spin_lock_bh(&conn->cmd_lock);
+			iscsit_del_cmd_from_conn_list(cmd, conn);
+			spin_unlock_bh(&conn->cmd_lock);
+
+			iscsit_free_cmd(cmd);
+			local_bh_disable();
+			goto get_immediate;
+		case ISTATE_SEND_NOPIN_WANT_RESPONSE:
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			iscsit_mod_nopin_response_timer(conn);
+			ret = iscsit_send_unsolicited_nopin(cmd,
+					conn, 1);
+			break;
+		case ISTATE_SEND_NOPIN_NO_RESPONSE:
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			ret = iscsit_send_unsolicited_nopin(cmd,
+					conn, 0);
+			break;
+		default:
+			pr_err("Unknown Opcode: 0x%02x ITT:"
+			" 0x%08x, i_state: %d on CID: %hu\n",
+			cmd->iscsi_opcode, cmd->init_task_tag, state,
+			conn->cid);
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			return -1;
+		}
+		if (ret < 0) {
+			conn->tx_immediate_queue = 0;
+			return -1;
+		}
+
+		if (iscsit_send_tx_data(cmd, conn, 1) < 0) {
+			conn->tx_immediate_queue = 0;
+			iscsit_tx_thread_wait_for_tcp(conn);
+			return -1;
+		}
+
+		local_bh_disable();
+		spin_lock(&cmd->istate_lock);
+		switch (state) {
+		case ISTATE_SEND_R2T:
+			spin_unlock(&cmd->istate_lock);
+			spin_lock(&cmd->dataout_timeout_lock);
+			iscsit_start_dataout_timer(cmd, conn);
+			spin_unlock(&cmd->dataout_timeout_lock);
+			break;
+		case ISTATE_SEND_NOPIN_WANT_RESPONSE:
+			cmd->i_state = ISTATE_SENT_NOPIN_WANT_RESPONSE;
+			spin_unlock(&cmd->istate_lock);
+			break;
+		case ISTATE_SEND_NOPIN_NO_RESPONSE:
+			cmd->i_state = ISTATE_SENT_STATUS;
+			spin_unlock(&cmd->istate_lock);
+			break;
+		default:
+			pr_err("Unknown Opcode: 0x%02x ITT:"
+				" 0x%08x, i_state: %d on CID: %hu\n",
+				cmd->iscsi_opcode, cmd->init_task_tag,
+				state, conn->cid);
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			return -1;
+		}
+		goto get_immediate;
+	} else
+		conn->tx_immediate_queue = 0;
+
+	/* bottom halves are still disabled */
+get_response:
+	cmd = iscsit_get_cmd_from_response_queue_bh(conn, &state);
+	if (cmd) {
+
+		spin_lock(&cmd->istate_lock);
+check_rsp_state:
+		switch (state) {
+		case ISTATE_SEND_DATAIN:
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			/*
+			 * Batch back-to-back DataIN PDUs into full
+			 * TCP segments until the response queue
+			 * drains.
+			 */
+			if (!list_empty(&conn->response_queue_list))
+				iscsit_tx_cork(conn);
+			ret = iscsit_send_data_in(cmd, conn,
+						  &eodr);
+			map_sg = 1;
+			break;
+		case ISTATE_SEND_STATUS:
+		case ISTATE_SEND_STATUS_RECOVERY:
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			use_misc = 1;
+			ret = iscsit_send_status(cmd, conn);
+			break;
+		case ISTATE_SEND_LOGOUTRSP:
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			use_misc = 1;
+			ret = iscsit_send_logout_response(cmd, conn);
+			break;
+		case ISTATE_SEND_ASYNCMSG:
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			use_misc = 1;
+			ret = iscsit_send_conn_drop_async_message(
+					cmd, conn);
+			break;
+		case ISTATE_SEND_NOPIN:
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			use_misc = 1;
+			ret = iscsit_send_nopin_response(cmd, conn);
+			break;
+		case ISTATE_SEND_REJECT:
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			use_misc = 1;
+			ret = iscsit_send_reject(cmd, conn);
+			break;
+		case ISTATE_SEND_TASKMGTRSP:
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			use_misc = 1;
+			ret = iscsit_send_task_mgt_rsp(cmd, conn);
+			if (ret != 0)
+				break;
+			ret = iscsit_tmr_post_handler(cmd, conn);
+			if (ret != 0)
+				iscsit_fall_back_to_erl0(conn->sess);
+			break;
+		case ISTATE_SEND_TEXTRSP:
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			use_misc = 1;
+			ret = iscsit_send_text_rsp(cmd, conn);
+			break;
+		default:
+			pr_err("Unknown Opcode: 0x%02x ITT:"
+				" 0x%08x, i_state: %d on CID: %hu\n",
+				cmd->iscsi_opcode, cmd->init_task_tag,
+				state, conn->cid);
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			return -1;
+		}
+		if (ret < 0) {
+			conn->tx_response_queue = 0;
+			return -1;
+		}
+
+		if (map_sg && !conn->conn_ops->IFMarker) {
+			if (iscsit_fe_sendpage_sg(cmd, conn) < 0) {
+				conn->tx_response_queue = 0;
+				iscsit_tx_thread_wait_for_tcp(conn);
+				iscsit_unmap_iovec(cmd);
+				return -1;
+			}
+		} else {
+			if (iscsit_send_tx_data(cmd, conn, use_misc) < 0) {
+				conn->tx_response_queue = 0;
+				iscsit_tx_thread_wait_for_tcp(conn);
+				iscsit_unmap_iovec(cmd);
+				return -1;
+			}
+		}
+		map_sg = 0;
+		iscsit_unmap_iovec(cmd);
+
+		local_bh_disable();
+		spin_lock(&cmd->istate_lock);
+		switch (state) {
+		case ISTATE_SEND_DATAIN:
+			if (!eodr)
+				goto check_rsp_state;
+
+			if (eodr == 1) {
+				cmd->i_state = ISTATE_SENT_LAST_DATAIN;
+				sent_status = 1;
+				eodr = use_misc = 0;
+			} else if (eodr == 2) {
+				cmd->i_state = state =
+						ISTATE_SEND_STATUS;
+				sent_status = 0;
+				eodr = use_misc = 0;
+				goto check_rsp_state;
+			}
+			break;
+		case ISTATE_SEND_STATUS:
+			use_misc = 0;
+			sent_status = 1;
+			break;
+		case ISTATE_SEND_ASYNCMSG:
+		case ISTATE_SEND_NOPIN:
+		case ISTATE_SEND_STATUS_RECOVERY:
+		case ISTATE_SEND_TEXTRSP:
+			use_misc = 0;
+			sent_status = 1;
+			break;
+		case ISTATE_SEND_REJECT:
+			use_misc = 0;
+			if (cmd->cmd_flags & ICF_REJECT_FAIL_CONN) {
+				cmd->cmd_flags &= ~ICF_REJECT_FAIL_CONN;
+				spin_unlock(&cmd->istate_lock);
+				local_bh_enable();
+				complete(&cmd->reject_comp);
+				return -1;
+			}
+			complete(&cmd->reject_comp);
+			break;
+		case ISTATE_SEND_TASKMGTRSP:
+			use_misc = 0;
+			sent_status = 1;
+			break;
+		case ISTATE_SEND_LOGOUTRSP:
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			if (!iscsit_logout_post_handler(cmd, conn))
+				return 1;
+			local_bh_disable();
+			spin_lock(&cmd->istate_lock);
+			use_misc = 0;
+			sent_status = 1;
+			break;
+		default:
+			pr_err("Unknown Opcode: 0x%02x ITT:"
+				" 0x%08x, i_state: %d on CID: %hu\n",
+				cmd->iscsi_opcode, cmd->init_task_tag,
+				cmd->i_state, conn->cid);
+			spin_unlock(&cmd->istate_lock);
+			local_bh_enable();
+			return -1;
+		}
+
+		if (sent_status) {
+			cmd->i_state = ISTATE_SENT_STATUS;
+			sent_status = 0;
+		}
+		spin_unlock(&cmd->istate_lock);
+
+		if (atomic_read(&conn->check_immediate_queue)) {
+			if (conn->tx_corked) {
+				local_bh_enable();
+				iscsit_tx_uncork(conn);
+				local_bh_disable();
+			}
+			goto get_immediate;
+		}
+
+		goto get_response;
+	} else
+		conn->tx_response_queue = 0;
+
+	local_bh_enable();
+	iscsit_tx_uncork(conn);
+
+	return 0;
+}
+
+int iscsi_target_tx_thread(void *arg)
+{
+	int ret;
 	struct iscsi_conn *conn;
-	struct iscsi_queue_req *qr = NULL;
 	struct iscsi_thread_set *ts = arg;
 	/*
 	 * Allow ourselves to be interrupted by SIGINT so that a
@@ -3585,7 +3956,7 @@ restart:
 	if (!conn)
 		goto out;
 
-	eodr = map_sg = ret = sent_status = use_misc = 0;
+	conn->tx_corked = 0;
 
 	while (!kthread_should_stop()) {
 		/*
@@ -3602,302 +3973,201 @@ restart:
 		     signal_pending(current))
 			goto transport_err;
 
-		local_bh_disable();
-get_immediate:
-		qr = iscsit_get_cmd_from_immediate_queue_bh(conn);
-		if (qr) {
-			atomic_set(&conn->check_immediate_queue, 0);
-			cmd = qr->cmd;
-			state = qr->state;
-			kmem_cache_free(lio_qr_cache, qr);
+		ret = iscsit_tx_handle_queues(conn);
+		if (ret < 0)
+			goto transport_err;
+		if (ret > 0) {
+			pr_info("%s/%d: tx thread (thread set %d) "
+				"going back to restart after logout\n",
+				current->comm, task_pid_nr(current),
+				ts->thread_id);
+			goto restart;
+		}
+	}
 
-			spin_lock(&cmd->istate_lock);
-			switch (state) {
-			case ISTATE_SEND_R2T:
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				ret = iscsit_send_r2t(cmd, conn);
-				break;
-			case ISTATE_REMOVE:
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
+transport_err:
+	iscsit_take_action_for_connection_exit(conn);
 
-				if (cmd->data_direction == DMA_TO_DEVICE)
-					iscsit_stop_dataout_timer(cmd);
+	pr_info("%s/%d: tx thread (thread set %d) going back to restart\n",
+		current->comm, task_pid_nr(current), ts->thread_id);
+	goto restart;
+out:
+	return 0;
+}
 
-				spin_lock_bh(&conn->cmd_lock);
-				list_del(&cmd->i_list);
-				spin_unlock_bh(&conn->cmd_lock);
+/*
+ * TX context of a connection serviced by iscsi_conn_wq, queued by
+ * iscsi_conn_wake_tx() and by the socket write_space callback.
+ */
+void iscsi_target_tx_work(struct work_struct *work)
+{
+	struct iscsi_conn *conn = container_of(work, struct iscsi_conn,
+					       tx_work.work);
+	int ret;
 
-				iscsit_free_cmd(cmd);
-				local_bh_disable();
-				goto get_immediate;
-			case ISTATE_SEND_NOPIN_WANT_RESPONSE:
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				iscsit_mod_nopin_response_timer(conn);
-				ret = iscsit_send_unsolicited_nopin(cmd,
-						conn, 1);
-				break;
-			case ISTATE_SEND_NOPIN_NO_RESPONSE:
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				ret = iscsit_send_unsolicited_nopin(cmd,
-						conn, 0);
-				break;
-			default:
-				pr_err("Unknown Opcode: 0x%02x ITT:"
-				" 0x%08x, i_state: %d on CID: %hu\n",
-				cmd->iscsi_opcode, cmd->init_task_tag, state,
-				conn->cid);
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				goto transport_err;
-			}
-			if (ret < 0) {
-				conn->tx_immediate_queue = 0;
-				goto transport_err;
-			}
+	if (iscsi_conn_work_begin(conn, &conn->tx_work) < 0)
+		return;
 
-			if (iscsit_send_tx_data(cmd, conn, 1) < 0) {
-				conn->tx_immediate_queue = 0;
-				iscsit_tx_thread_wait_for_tcp(conn);
-				goto transport_err;
-			}
+	ret = iscsit_tx_handle_queues(conn);
+	/*
+	 * Logout: iscsit_logout_post_handler() detached this context, which
+	 * ended its run in iscsi_conn_engine_clear(), and the connection may
+	 * already be gone.
+	 */
+	if (ret > 0)
+		return;
+	/*
+	 * If the exit belongs to another context, that context waits for
+	 * this work in iscsi_conn_engine_stop(), so the run can still be
+	 * ended here.
+	 */
+	if (ret < 0 && !iscsit_take_action_for_connection_exit(conn))
+		return;
 
-			local_bh_disable();
-			spin_lock(&cmd->istate_lock);
-			switch (state) {
-			case ISTATE_SEND_R2T:
-				spin_unlock(&cmd->istate_lock);
-				spin_lock(&cmd->dataout_timeout_lock);
-				iscsit_start_dataout_timer(cmd, conn);
-				spin_unlock(&cmd->dataout_timeout_lock);
-				break;
-			case ISTATE_SEND_NOPIN_WANT_RESPONSE:
-				cmd->i_state = ISTATE_SENT_NOPIN_WANT_RESPONSE;
-				spin_unlock(&cmd->istate_lock);
-				break;
-			case ISTATE_SEND_NOPIN_NO_RESPONSE:
-				cmd->i_state = ISTATE_SENT_STATUS;
-				spin_unlock(&cmd->istate_lock);
-				break;
-			default:
-				pr_err("Unknown Opcode: 0x%02x ITT:"
-					" 0x%08x, i_state: %d on CID: %hu\n",
-					cmd->iscsi_opcode, cmd->init_task_tag,
-					state, conn->cid);
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				goto transport_err;
-			}
-			goto get_immediate;
-		} else
-			conn->tx_immediate_queue = 0;
+	iscsi_conn_work_end(conn, &conn->tx_work, 0);
+}
 
-		/* bottom halves are still disabled */
-get_response:
-		qr = iscsit_get_cmd_from_response_queue_bh(conn);
-		if (qr) {
-			cmd = qr->cmd;
-			state = qr->state;
-			kmem_cache_free(lio_qr_cache, qr);
+/*
+ * Receive and handle a single PDU, returns -1 on a transport failure.
+ */
+static int iscsit_rx_handle_pdu(struct iscsi_conn *conn)
+{
+	int ret, iov_count = 1, rx_size = ISCSI_HDR_LEN;
+	u8 buffer[ISCSI_HDR_LEN], opcode;
+	u32 checksum = 0, digest = 0;
+	struct kvec iov[2];
 
-			spin_lock(&cmd->istate_lock);
-check_rsp_state:
-			switch (state) {
-			case ISTATE_SEND_DATAIN:
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				ret = iscsit_send_data_in(cmd, conn,
-							  &eodr);
-				map_sg = 1;
-				break;
-			case ISTATE_SEND_STATUS:
-			case ISTATE_SEND_STATUS_RECOVERY:
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				use_misc = 1;
-				ret = iscsit_send_status(cmd, conn);
-				break;
-			case ISTATE_SEND_LOGOUTRSP:
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				use_misc = 1;
-				ret = iscsit_send_logout_response(cmd, conn);
-				break;
-			case ISTATE_SEND_ASYNCMSG:
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				use_misc = 1;
-				ret = iscsit_send_conn_drop_async_message(
-						cmd, conn);
-				break;
-			case ISTATE_SEND_NOPIN:
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				use_misc = 1;
-				ret = iscsit_send_nopin_response(cmd, conn);
-				break;
-			case ISTATE_SEND_REJECT:
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				use_misc = 1;
-				ret = iscsit_send_reject(cmd, conn);
-				break;
-			case ISTATE_SEND_TASKMGTRSP:
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				use_misc = 1;
-				ret = iscsit_send_task_mgt_rsp(cmd, conn);
-				if (ret != 0)
-					break;
-				ret = iscsit_tmr_post_handler(cmd, conn);
-				if (ret != 0)
-					iscsit_fall_back_to_erl0(conn->sess);
-				break;
-			case ISTATE_SEND_TEXTRSP:
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				use_misc = 1;
-				ret = iscsit_send_text_rsp(cmd, conn);
-				break;
-			default:
-				pr_err("Unknown Opcode: 0x%02x ITT:"
-					" 0x%08x, i_state: %d on CID: %hu\n",
-					cmd->iscsi_opcode, cmd->init_task_tag,
-					state, conn->cid);
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				goto transport_err;
-			}
-			if (ret < 0) {
-				conn->tx_response_queue = 0;
-				goto transport_err;
-			}
+	memset(buffer, 0, ISCSI_HDR_LEN);
+	memset(iov, 0, sizeof(iov));
 
-			if (map_sg && !conn->conn_ops->IFMarker) {
-				if (iscsit_fe_sendpage_sg(cmd, conn) < 0) {
-					conn->tx_response_queue = 0;
-					iscsit_tx_thread_wait_for_tcp(conn);
-					iscsit_unmap_iovec(cmd);
-					goto transport_err;
-				}
-			} else {
-				if (iscsit_send_tx_data(cmd, conn, use_misc) < 0) {
-					conn->tx_response_queue = 0;
-					iscsit_tx_thread_wait_for_tcp(conn);
-					iscsit_unmap_iovec(cmd);
-					goto transport_err;
-				}
-			}
-			map_sg = 0;
-			iscsit_unmap_iovec(cmd);
+	iov[0].iov_base	= buffer;
+	iov[0].iov_len	= ISCSI_HDR_LEN;
 
-			local_bh_disable();
-			spin_lock(&cmd->istate_lock);
-			switch (state) {
-			case ISTATE_SEND_DATAIN:
-				if (!eodr)
-					goto check_rsp_state;
-
-				if (eodr == 1) {
-					cmd->i_state = ISTATE_SENT_LAST_DATAIN;
-					sent_status = 1;
-					eodr = use_misc = 0;
-				} else if (eodr == 2) {
-					cmd->i_state = state =
-							ISTATE_SEND_STATUS;
-					sent_status = 0;
-					eodr = use_misc = 0;
-					goto check_rsp_state;
-				}
-				break;
-			case ISTATE_SEND_STATUS:
-				use_misc = 0;
-				sent_status = 1;
-				break;
-			case ISTATE_SEND_ASYNCMSG:
-			case ISTATE_SEND_NOPIN:
-			case ISTATE_SEND_STATUS_RECOVERY:
-			case ISTATE_SEND_TEXTRSP:
-				use_misc = 0;
-				sent_status = 1;
-				break;
-			case ISTATE_SEND_REJECT:
-				use_misc = 0;
-				if (cmd->cmd_flags & ICF_REJECT_FAIL_CONN) {
-					cmd->cmd_flags &= ~ICF_REJECT_FAIL_CONN;
-					spin_unlock(&cmd->istate_lock);
-					local_bh_enable();
-					complete(&cmd->reject_comp);
-					goto transport_err;
-				}
-				complete(&cmd->reject_comp);
-				break;
-			case ISTATE_SEND_TASKMGTRSP:
-				use_misc = 0;
-				sent_status = 1;
-				break;
-			case ISTATE_SEND_LOGOUTRSP:
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				if (!iscsit_logout_post_handler(cmd, conn)) {
-					pr_info("%s/%d: tx thread (thread set %d) "
-						"going back to restart after logout\n",
-						current->comm, task_pid_nr(current),
-						ts->thread_id);
-					goto restart;
-				}
-				local_bh_disable();
-				spin_lock(&cmd->istate_lock);
-				use_misc = 0;
-				sent_status = 1;
-				break;
-			default:
-				pr_err("Unknown Opcode: 0x%02x ITT:"
-					" 0x%08x, i_state: %d on CID: %hu\n",
-					cmd->iscsi_opcode, cmd->init_task_tag,
-					cmd->i_state, conn->cid);
-				spin_unlock(&cmd->istate_lock);
-				local_bh_enable();
-				goto transport_err;
-			}
+	/*
+	 * Receive the HeaderDigest together with the BHS, so the CRC32C
+	 * below runs over a header that is still cache hot from the copy
+	 * out of the socket.
+	 */
+	if (conn->conn_ops->HeaderDigest) {
+		iov[1].iov_base	= &digest;
+		iov[1].iov_len	= ISCSI_CRC_LEN;
+		iov_count++;
+		rx_size += ISCSI_CRC_LEN;
+	}
 
-			if (sent_status) {
-				cmd->i_state = ISTATE_SENT_STATUS;
-				sent_status = 0;
-			}
-			spin_unlock(&cmd->istate_lock);
+	ret = rx_data(conn, &iov[0], iov_count, rx_size);
+	if (ret != rx_size) {
+		iscsit_rx_thread_wait_for_tcp(conn);
+		return -1;
+	}
 
-			if (atomic_read(&conn->check_immediate_queue))
-				goto get_immediate;
+	/*
+	 * Set conn->bad_hdr for use with REJECT PDUs.
+	 */
+	memcpy(&conn->bad_hdr, &buffer, ISCSI_HDR_LEN);
 
-			goto get_response;
-		} else
-			conn->tx_response_queue = 0;
+	if (conn->conn_ops->HeaderDigest) {
+		iscsit_do_crypto_hash_buf(&conn->conn_rx_hash,
+				buffer, ISCSI_HDR_LEN,
+				0, NULL, (u8 *)&checksum);
+
+		if (digest != checksum) {
+			pr_err("HeaderDigest CRC32C failed,"
+				" received 0x%08x, computed 0x%08x\n",
+				digest, checksum);
+			/*
+			 * Set the PDU to 0xff so it will intentionally
+			 * hit default in the switch below.
+			 */
+			memset(buffer, 0xff, ISCSI_HDR_LEN);
+			spin_lock_bh(&conn->sess->session_stats_lock);
+			conn->sess->conn_digest_errors++;
+			spin_unlock_bh(&conn->sess->session_stats_lock);
+		} else {
+			pr_debug("Got HeaderDigest CRC32C"
+					" 0x%08x\n", checksum);
+		}
+	}
 
-		local_bh_enable();
+	if (conn->conn_state == TARG_CONN_STATE_IN_LOGOUT)
+		return -1;
+
+	opcode = buffer[0] & ISCSI_OPCODE_MASK;
+
+	if (conn->sess->sess_ops->SessionType &&
+	   ((!(opcode & ISCSI_OP_TEXT)) ||
+	    (!(opcode & ISCSI_OP_LOGOUT)))) {
+		pr_err("Received illegal iSCSI Opcode: 0x%02x"
+		" while in Discovery Session, rejecting.\n", opcode);
+		iscsit_add_reject(ISCSI_REASON_PROTOCOL_ERROR, 1,
+				buffer, conn);
+		return -1;
 	}
 
-transport_err:
-	iscsit_take_action_for_connection_exit(conn);
+	switch (opcode) {
+	case ISCSI_OP_SCSI_CMD:
+		if (iscsit_handle_scsi_cmd(conn, buffer) < 0)
+			return -1;
+		break;
+	case ISCSI_OP_SCSI_DATA_OUT:
+		if (iscsit_handle_data_out(conn, buffer) < 0)
+			return -1;
+		break;
+	case ISCSI_OP_NOOP_OUT:
+		if (iscsit_handle_nop_out(conn, buffer) < 0)
+			return -1;
+		break;
+	case ISCSI_OP_SCSI_TMFUNC:
+		if (iscsit_handle_task_mgt_cmd(conn, buffer) < 0)
+			return -1;
+		break;
+	case ISCSI_OP_TEXT:
+		if (iscsit_handle_text_cmd(conn, buffer) < 0)
+			return -1;
+		break;
+	case ISCSI_OP_LOGOUT:
+		ret = iscsit_handle_logout_cmd(conn, buffer);
+		if (ret > 0) {
+			wait_for_completion_timeout(&conn->conn_logout_comp,
+					SECONDS_FOR_LOGOUT_COMP * HZ);
+			return -1;
+		} else if (ret < 0)
+			return -1;
+		break;
+	case ISCSI_OP_SNACK:
+		if (iscsit_handle_snack(conn, buffer) < 0)
+			return -1;
+		break;
+	default:
+		pr_err("Got unknown iSCSI OpCode: 0x%02x\n",
+				opcode);
+		if (!conn->sess->sess_ops->ErrorRecoveryLevel) {
+			pr_err("Cannot recover from unknown"
+			" opcode while ERL=0, closing iSCSI connection"
+			".\n");
+			return -1;
+		}
+		if (!conn->conn_ops->OFMarker) {
+			pr_err("Unable to recover from unknown"
+			" opcode while OFMarker=No, closing iSCSI"
+				" connection.\n");
+			return -1;
+		}
+		if (iscsit_recover_from_unknown_opcode(conn) < 0) {
+			pr_err("Unable to recover from unknown"
+				" opcode, closing iSCSI connection.\n");
+			return -1;
+		}
+		break;
+	}
 
-	pr_info("%s/%d: tx thread (thread set %d) going back to restart\n",
-		current->comm, task_pid_nr(current), ts->thread_id);
-	goto restart;
-out:
 	return 0;
 }
 
 int iscsi_target_rx_thread(void *arg)
 {
-	int ret;
-	u8 buffer[ISCSI_HDR_LEN], opcode;
-	u32 checksum = 0, digest = 0;
 	struct iscsi_conn *conn = NULL;
 	struct iscsi_thread_set *ts = arg;
-	struct kvec iov;
 	/*
 	 * Allow ourselves to be interrupted by SIGINT so that a
 	 * connection recovery / failure event can be triggered externally.
@@ -3916,138 +4186,90 @@ restart:
 		 */
 		iscsit_thread_check_cpumask(conn, current, 0);
 
-		memset(buffer, 0, ISCSI_HDR_LEN);
-		memset(&iov, 0, sizeof(struct kvec));
-
-		iov.iov_base	= buffer;
-		iov.iov_len	= ISCSI_HDR_LEN;
-
-		ret = rx_data(conn, &iov, 1, ISCSI_HDR_LEN);
-		if (ret != ISCSI_HDR_LEN) {
-			iscsit_rx_thread_wait_for_tcp(conn);
+		if (iscsit_rx_handle_pdu(conn) < 0)
 			goto transport_err;
-		}
+	}
 
-		/*
-		 * Set conn->bad_hdr for use with REJECT PDUs.
-		 */
-		memcpy(&conn->bad_hdr, &buffer, ISCSI_HDR_LEN);
+transport_err:
+	if (!signal_pending(current))
+		atomic_set(&conn->transport_failed, 1);
+	iscsit_take_action_for_connection_exit(conn);
 
-		if (conn->conn_ops->HeaderDigest) {
-			iov.iov_base	= &digest;
-			iov.iov_len	= ISCSI_CRC_LEN;
+	pr_info("%s/%d: rx thread (thread set %d) going back to restart\n",
+		current->comm, task_pid_nr(current), ts->thread_id);
+	goto restart;
+out:
+	return 0;
+}
 
-			ret = rx_data(conn, &iov, 1, ISCSI_CRC_LEN);
-			if (ret != ISCSI_CRC_LEN) {
-				iscsit_rx_thread_wait_for_tcp(conn);
-				goto transport_err;
-			}
+/*
+ * rx_data() still blocks for the rest of a PDU, but a worker only starts
+ * on a PDU once its first bytes are queued on the socket.
+ */
+static int iscsit_rx_ready(struct iscsi_conn *conn)
+{
+	struct sock *sk = conn->sock->sk;
 
-			iscsit_do_crypto_hash_buf(&conn->conn_rx_hash,
-					buffer, ISCSI_HDR_LEN,
-					0, NULL, (u8 *)&checksum);
-
-			if (digest != checksum) {
-				pr_err("HeaderDigest CRC32C failed,"
-					" received 0x%08x, computed 0x%08x\n",
-					digest, checksum);
-				/*
-				 * Set the PDU to 0xff so it will intentionally
-				 * hit default in the switch below.
-				 */
-				memset(buffer, 0xff, ISCSI_HDR_LEN);
-				spin_lock_bh(&conn->sess->session_stats_lock);
-				conn->sess->conn_digest_errors++;
-				spin_unlock_bh(&conn->sess->session_stats_lock);
-			} else {
-				pr_debug("Got HeaderDigest CRC32C"
-						" 0x%08x\n", checksum);
-			}
-		}
+	return !skb_queue_empty(&sk->sk_receive_queue) ||
+		(sk->sk_shutdown & RCV_SHUTDOWN) || sk->sk_err ||
+		test_bit(ISCSI_ENGINE_FORCE, &conn->engine_flags);
+}
 
-		if (conn->conn_state == TARG_CONN_STATE_IN_LOGOUT)
-			goto transport_err;
+/*
+ * RX context of a connection serviced by iscsi_conn_wq, queued by the
+ * socket data_ready and state_change callbacks.
+ */
+void iscsi_target_rx_work(struct work_struct *work)
+{
+	struct iscsi_conn *conn = container_of(work, struct iscsi_conn,
+					       rx_work.work);
+	int budget = ISCSI_CONN_RX_BUDGET;
 
-		opcode = buffer[0] & ISCSI_OPCODE_MASK;
+	if (iscsi_conn_work_begin(conn, &conn->rx_work) < 0)
+		return;
 
-		if (conn->sess->sess_ops->SessionType &&
-		   ((!(opcode & ISCSI_OP_TEXT)) ||
-		    (!(opcode & ISCSI_OP_LOGOUT)))) {
-			pr_err("Received illegal iSCSI Opcode: 0x%02x"
-			" while in Discovery Session, rejecting.\n", opcode);
-			iscsit_add_reject(ISCSI_REASON_PROTOCOL_ERROR, 1,
-					buffer, conn);
+	while (budget && iscsit_rx_ready(conn)) {
+		if (iscsit_rx_handle_pdu(conn) < 0)
 			goto transport_err;
-		}
-
-		switch (opcode) {
-		case ISCSI_OP_SCSI_CMD:
-			if (iscsit_handle_scsi_cmd(conn, buffer) < 0)
-				goto transport_err;
-			break;
-		case ISCSI_OP_SCSI_DATA_OUT:
-			if (iscsit_handle_data_out(conn, buffer) < 0)
-				goto transport_err;
-			break;
-		case ISCSI_OP_NOOP_OUT:
-			if (iscsit_handle_nop_out(conn, buffer) < 0)
-				goto transport_err;
-			break;
-		case ISCSI_OP_SCSI_TMFUNC:
-			if (iscsit_handle_task_mgt_cmd(conn, buffer) < 0)
-				goto transport_err;
-			break;
-		case ISCSI_OP_TEXT:
-			if (iscsit_handle_text_cmd(conn, buffer) < 0)
-				goto transport_err;
-			break;
-		case ISCSI_OP_LOGOUT:
-			ret = iscsit_handle_logout_cmd(conn, buffer);
-			if (ret > 0) {
-				wait_for_completion_timeout(&conn->conn_logout_comp,
-						SECONDS_FOR_LOGOUT_COMP * HZ);
-				goto transport_err;
-			} else if (ret < 0)
-				goto transport_err;
-			break;
-		case ISCSI_OP_SNACK:
-			if (iscsit_handle_snack(conn, buffer) < 0)
-				goto transport_err;
-			break;
-		default:
-			pr_err("Got unknown iSCSI OpCode: 0x%02x\n",
-					opcode);
-			if (!conn->sess->sess_ops->ErrorRecoveryLevel) {
-				pr_err("Cannot recover from unknown"
-				" opcode while ERL=0, closing iSCSI connection"
-				".\n");
-				goto transport_err;
-			}
-			if (!conn->conn_ops->OFMarker) {
-				pr_err("Unable to recover from unknown"
-				" opcode while OFMarker=No, closing iSCSI"
-					" connection.\n");
-				goto transport_err;
-			}
-			if (iscsit_recover_from_unknown_opcode(conn) < 0) {
-				pr_err("Unable to recover from unknown"
-					" opcode, closing iSCSI connection.\n");
-				goto transport_err;
-			}
-			break;
-		}
+		budget--;
 	}
 
+	iscsi_conn_work_end(conn, &conn->rx_work, !budget);
+	return;
+
 transport_err:
-	if (!signal_pending(current))
+	if (!test_bit(ISCSI_ENGINE_FORCE, &conn->engine_flags))
 		atomic_set(&conn->transport_failed, 1);
-	iscsit_take_action_for_connection_exit(conn);
+	/* See iscsi_target_tx_work() */
+	if (iscsit_take_action_for_connection_exit(conn))
+		iscsi_conn_work_end(conn, &conn->rx_work, 0);
+}
 
-	pr_info("%s/%d: rx thread (thread set %d) going back to restart\n",
-		current->comm, task_pid_nr(current), ts->thread_id);
-	goto restart;
-out:
-	return 0;
+/*
+ * Drain the remaining requests. Call iscsit_add_reject_from_cmd() to
+ * set ISCSI_OP_REJECT so that iscsit_free_cmd() doesn't call
+ * transport_generic_free_cmd().
+ */
+int iscsit_drain_deferred_cmds(struct iscsi_conn *conn)
+{
+	struct iscsi_cmd *cmd;
+	int draincmds = 0;
+
+	spin_lock(&conn->deferred_cmd_lock);
+	list_for_each_entry(cmd, &conn->deferred_cmd_list, deferred_list) {
+		pr_info("draining deferred command %p on CID %hu on SID %u\n",
+			cmd, conn->cid, conn->sess->sid);
+
+		++draincmds;
+		/* We can't call iscsit_add_reject_from_cmd() because the TX
+		 * thread has already been stopped so it would hang. Instead
+		 * just ensure that iscsit_free_cmd() frees up this command */
+		cmd->iscsi_opcode = ISCSI_OP_REJECT;
+	}
+	INIT_LIST_HEAD(&conn->deferred_cmd_list);
+	spin_unlock(&conn->deferred_cmd_lock);
+
+	return draincmds;
 }
 
 int iscsi_target_deferred_thread(void *arg)
@@ -4102,24 +4324,7 @@ restart:
 			iscsit_handle_deferred_write(cmd);
 	}
 
-	/*
-	 * Drain the remaining requests. Call iscsit_add_reject_from_cmd() to
-	 * set ISCSI_OP_REJECT so that iscsit_free_cmd() doesn't call
-	 * transport_generic_free_cmd().
-	 */
-	spin_lock(&conn->deferred_cmd_lock);
-	list_for_each_entry(cmd, &conn->deferred_cmd_list, deferred_list) {
-		pr_info("draining deferred command %p on CID %hu on SID %u\n",
-			cmd, conn->cid, conn->sess->sid);
-
-		++draincmds;
-		/* We can't call iscsit_add_reject_from_cmd() because the TX
-		 * thread has already been stopped so it would hang. Instead
-		 * just ensure that iscsit_free_cmd() frees up this command */
-		cmd->iscsi_opcode = ISCSI_OP_REJECT;
-	}
-	INIT_LIST_HEAD(&conn->deferred_cmd_list);
-	spin_unlock(&conn->deferred_cmd_lock);
+	draincmds = iscsit_drain_deferred_cmds(conn);
 
 	pr_info("%s/%d: deferred thread (thread set %d) going back to restart (%d cmds, %d drained)\n",
 		current->comm, task_pid_nr(current), ts->thread_id,
@@ -4127,6 +4332,35 @@ restart:
 	goto restart;
 }
 
+void iscsi_target_deferred_work(struct work_struct *work)
+{
+	struct iscsi_conn *conn = container_of(work, struct iscsi_conn,
+					       deferred_work.work);
+	struct iscsi_cmd *cmd;
+
+	if (iscsi_conn_work_begin(conn, &conn->deferred_work) < 0)
+		return;
+
+	for (;;) {
+		spin_lock(&conn->deferred_cmd_lock);
+		if (list_empty(&conn->deferred_cmd_list)) {
+			spin_unlock(&conn->deferred_cmd_lock);
+			break;
+		}
+		cmd = list_first_entry(&conn->deferred_cmd_list,
+				       struct iscsi_cmd, deferred_list);
+		list_del(&cmd->deferred_list);
+		spin_unlock(&conn->deferred_cmd_lock);
+
+		if (cmd->data_direction == DMA_FROM_DEVICE)
+			iscsit_handle_deferred_read(cmd);
+		else if (cmd->data_direction == DMA_TO_DEVICE)
+			iscsit_handle_deferred_write(cmd);
+	}
+
+	iscsi_conn_work_end(conn, &conn->deferred_work, 0);
+}
+
 static void iscsit_release_commands_from_conn(struct iscsi_conn *conn)
 {
 	struct iscsi_cmd *cmd;
@@ -4139,7 +4373,7 @@ static void iscsit_release_commands_from_conn(struct iscsi_conn *conn)
 	spin_lock_bh(&conn->cmd_lock);
 	while (!list_empty(&conn->conn_cmd_list)) {
 		cmd = list_first_entry(&conn->conn_cmd_list, struct iscsi_cmd, i_list);
-		list_del(&cmd->i_list);
+		iscsit_del_cmd_from_conn_list(cmd, conn);
 		spin_unlock_bh(&conn->cmd_lock);
 
 		iscsit_increment_maxcmdsn(cmd, sess);
@@ -4278,6 +4512,8 @@ int iscsit_close_connection(
 	if (conn->conn_cpumask)
 		free_cpumask_var(conn->conn_cpumask);
 
+	iscsit_free_cmd_hash(conn);
+
 	kfree(conn->conn_ops);
 	conn->conn_ops = NULL;
 
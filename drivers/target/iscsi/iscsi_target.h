@@ -24,6 +24,10 @@ extern void iscsit_thread_get_cpumask(struct iscsi_conn *);
 extern int iscsi_target_tx_thread(void *);
 extern int iscsi_target_rx_thread(void *);
 extern int iscsi_target_deferred_thread(void *);
+extern void iscsi_target_tx_work(struct work_struct *);
+extern void iscsi_target_rx_work(struct work_struct *);
+extern void iscsi_target_deferred_work(struct work_struct *);
+extern int iscsit_drain_deferred_cmds(struct iscsi_conn *);
 extern int iscsit_close_connection(struct iscsi_conn *);
 extern int iscsit_close_session(struct iscsi_session *);
 extern void iscsit_fail_session(struct iscsi_session *);
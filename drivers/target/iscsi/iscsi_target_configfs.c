@@ -696,6 +696,10 @@ static ssize_t lio_target_nacl_show_info(
 			((u32) atomic_read(&sess->max_cmd_sn) - sess->exp_cmd_sn) + 1,
 			sess->exp_cmd_sn, (u32) atomic_read(&sess->max_cmd_sn),
 			sess->init_task_tag, sess->targ_xfer_tag);
+		rb += sprintf(page+rb, "  Out of order CmdSN depth: %u  max"
+				" depth: %u  total: %u\n",
+			sess->ooo_cmdsn_depth, sess->ooo_cmdsn_max_depth,
+			sess->ooo_cmdsn_count);
 		rb += sprintf(page+rb, "----------------------[iSCSI"
 				" Connections]-------------------------\n");
 
@@ -1028,6 +1032,11 @@ TPG_ATTR(demo_mode_write_protect, S_IRUGO | S_IWUSR);
  */
 DEF_TPG_ATTRIB(prod_mode_write_protect);
 TPG_ATTR(prod_mode_write_protect, S_IRUGO | S_IWUSR);
+/*
+ * Define iscsi_tpg_attrib_s_cpu_affinity
+ */
+DEF_TPG_ATTRIB(cpu_affinity);
+TPG_ATTR(cpu_affinity, S_IRUGO | S_IWUSR);
 
 static struct configfs_attribute *lio_target_tpg_attrib_attrs[] = {
 	&iscsi_tpg_attrib_authentication.attr,
@@ -1038,6 +1047,7 @@ static struct configfs_attribute *lio_target_tpg_attrib_attrs[] = {
 	&iscsi_tpg_attrib_cache_dynamic_acls.attr,
 	&iscsi_tpg_attrib_demo_mode_write_protect.attr,
 	&iscsi_tpg_attrib_prod_mode_write_protect.attr,
+	&iscsi_tpg_attrib_cpu_affinity.attr,
 	NULL,
 };
 
@@ -50,16 +50,27 @@
 #define TA_DEFAULT_CMDSN_DEPTH		16
 #define TA_DEFAULT_CMDSN_DEPTH_MAX	512
 #define TA_DEFAULT_CMDSN_DEPTH_MIN	1
+/* CmdSN window slots for out of order commands, must be a power of two */
+#define ISCSI_OOO_CMDSN_SLOTS		TA_DEFAULT_CMDSN_DEPTH_MAX
 #define TA_CACHE_DYNAMIC_ACLS		0
 /* Enabled by default in demo mode (generic_node_acls=1) */
 #define TA_DEMO_MODE_WRITE_PROTECT	1
 /* Disabled by default in production mode w/ explict ACLs */
 #define TA_PROD_MODE_WRITE_PROTECT	0
 #define TA_CACHE_CORE_NPS		0
+/* struct iscsi_tpg_attrib->cpu_affinity */
+#define TA_CPU_AFFINITY_NONE		0
+#define TA_CPU_AFFINITY_NODE		1
+#define TA_CPU_AFFINITY_CPU		2
+#define TA_CPU_AFFINITY			TA_CPU_AFFINITY_NONE
 
 
 #define ISCSI_IOV_DATA_BUFFER		5
 
+/* Buckets in each of iscsi_conn->conn_itt_hash and conn_ttt_hash */
+#define ISCSI_CMD_HASH_BITS		8
+#define ISCSI_CMD_HASH_SIZE		(1 << ISCSI_CMD_HASH_BITS)
+
 enum tpg_np_network_transport_table {
 	ISCSI_TCP				= 0,
 	ISCSI_SCTP_TCP				= 1,
@@ -269,6 +280,8 @@ struct iscsi_sess_ops {
 
 struct iscsi_queue_req {
 	int			state;
+	/* Embedded in struct iscsi_cmd, not from lio_qr_cache */
+	bool			embedded;
 	struct iscsi_cmd	*cmd;
 	struct list_head	qr_list;
 };
@@ -280,6 +293,8 @@ struct iscsi_data_count {
 	u32			iov_count;
 	u32			ss_iov_count;
 	u32			ss_marker_count;
+	/* MSG_* flags passed to kernel_sendmsg() */
+	int			msg_flags;
 	struct kvec		*iov;
 };
 
@@ -306,9 +321,7 @@ struct iscsi_datain_req {
 
 struct iscsi_ooo_cmdsn {
 	u16			cid;
-	u32			batch_count;
 	u32			cmdsn;
-	u32			exp_cmdsn;
 	struct iscsi_cmd	*cmd;
 	struct list_head	ooo_list;
 } ____cacheline_aligned;
@@ -427,6 +440,9 @@ struct iscsi_cmd {
 	/* Number of times struct iscsi_cmd is present in immediate queue */
 	atomic_t		immed_queue_count;
 	atomic_t		response_queue_count;
+	/* First entry on the immediate and response queues */
+	struct iscsi_queue_req	i_immed_qr;
+	struct iscsi_queue_req	i_rsp_qr;
 	spinlock_t		datain_lock;
 	spinlock_t		dataout_timeout_lock;
 	/* spinlock for protecting struct iscsi_cmd->i_state */
@@ -465,6 +481,9 @@ struct iscsi_cmd {
 	struct iscsi_session	*sess;
 	/* list_head for connection list */
 	struct list_head	i_list;
+	/* Entries in iscsi_conn->conn_itt_hash and conn_ttt_hash */
+	struct list_head	i_itt_node;
+	struct list_head	i_ttt_node;
 	/* Deferred command support */
 	struct list_head	deferred_list;
 	void *			deferred_hdr;
@@ -492,6 +511,32 @@ struct iscsi_tmr_req {
 	struct se_tmr_req	*se_tmr_req;
 };
 
+/* struct iscsi_conn_work->state */
+#define ISCSI_WORK_IDLE				0
+#define ISCSI_WORK_QUEUED			1
+#define ISCSI_WORK_RUNNING			2
+#define ISCSI_WORK_RESCHED			3
+
+/* struct iscsi_conn->engine_flags */
+#define ISCSI_ENGINE_ACTIVE			0
+#define ISCSI_ENGINE_STOPPING			1
+#define ISCSI_ENGINE_FORCE			2
+#define ISCSI_ENGINE_CPU_SET			3
+
+/*
+ * RX, TX or deferred context of a connection serviced from the
+ * iscsi_conn_wq per-CPU workers instead of a struct iscsi_thread_set.
+ */
+struct iscsi_conn_work {
+	struct work_struct	work;
+	/* ISCSI_WORK_*, protected by iscsi_conn->engine_lock */
+	int			state;
+	/* Set once the context has left the connection for good */
+	int			detached;
+	/* Worker currently running this context */
+	struct task_struct	*task;
+};
+
 struct iscsi_conn {
 	wait_queue_head_t	wq;
 	wait_queue_head_t	deferred_wq;
@@ -505,6 +550,8 @@ struct iscsi_conn {
 	enum iscsi_timer_flags_table nopin_response_timer_flags;
 	u8			tx_immediate_queue;
 	u8			tx_response_queue;
+	/* TCP_CORK is set while draining a batch of the response queue */
+	u8			tx_corked;
 	/* Used to know what thread encountered a transport failure */
 	u8			which_thread;
 	/* connection id assigned by the Initiator */
@@ -575,6 +622,12 @@ struct iscsi_conn {
 	struct list_head	immed_queue_list;
 	struct list_head	response_queue_list;
 	struct list_head	deferred_cmd_list;
+	/*
+	 * conn_cmd_list entries hashed by ITT and TTT, protected by
+	 * cmd_lock.  Reserved 0xFFFFFFFF tags are not hashed.
+	 */
+	struct list_head	*conn_itt_hash;
+	struct list_head	*conn_ttt_hash;
 	struct iscsi_conn_ops	*conn_ops;
 	struct iscsi_param_list	*param_list;
 	/* Used for per connection auth state machine */
@@ -585,6 +638,18 @@ struct iscsi_conn {
 	struct iscsi_session	*sess;
 	/* Pointer to thread_set in use for this conn's threads */
 	struct iscsi_thread_set	*thread_set;
+	/* Used when the connection is serviced by iscsi_conn_wq */
+	spinlock_t		engine_lock;
+	unsigned long		engine_flags;
+	/* CPU receiving this connection's packets */
+	int			engine_cpu;
+	struct iscsi_conn_work	rx_work;
+	struct iscsi_conn_work	tx_work;
+	struct iscsi_conn_work	deferred_work;
+	struct work_struct	kill_work;
+	void			(*orig_data_ready)(struct sock *, int);
+	void			(*orig_write_space)(struct sock *);
+	void			(*orig_state_change)(struct sock *);
 	/* list_head for session connection list */
 	struct list_head	conn_list;
 } ____cacheline_aligned;
@@ -624,6 +689,11 @@ struct iscsi_session {
 	/* session wide counter: maximum allowed command sequence number */
 	atomic_t		max_cmd_sn;
 	struct list_head	sess_ooo_cmdsn_list;
+	/* Out of order CmdSNs indexed by CmdSN, protected by cmdsn_mutex */
+	struct iscsi_ooo_cmdsn	*sess_ooo_cmdsn_slot[ISCSI_OOO_CMDSN_SLOTS];
+	u32			ooo_cmdsn_depth;
+	u32			ooo_cmdsn_max_depth;
+	u32			ooo_cmdsn_count;
 
 	/* LIO specific session ID */
 	u32			sid;
@@ -748,6 +818,7 @@ struct iscsi_tpg_attrib {
 	u32			default_cmdsn_depth;
 	u32			demo_mode_write_protect;
 	u32			prod_mode_write_protect;
+	u32			cpu_affinity;
 	struct iscsi_portal_group *tpg;
 };
 
@@ -796,6 +867,8 @@ struct iscsi_portal_group {
 	u32			num_tpg_nps;
 	/* Per TPG LIO specific session ID. */
 	u32			sid;
+	/* Next CPU index for TA_CPU_AFFINITY_CPU */
+	atomic_t		tpg_next_cpu;
 	/* Spinlock for adding/removing Network Portals */
 	spinlock_t		tpg_np_lock;
 	spinlock_t		tpg_state_lock;
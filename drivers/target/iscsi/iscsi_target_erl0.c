@@ -923,24 +923,29 @@ static void iscsit_handle_connection_cleanup(struct iscsi_conn *conn)
 	}
 }
 
-extern void iscsit_take_action_for_connection_exit(struct iscsi_conn *conn)
+/*
+ * Returns 1 if another context already owns the connection exit, in which
+ * case the connection has been left alone and the caller may still touch
+ * it.
+ */
+extern int iscsit_take_action_for_connection_exit(struct iscsi_conn *conn)
 {
 	spin_lock_bh(&conn->state_lock);
 	if (atomic_read(&conn->connection_exit)) {
 		spin_unlock_bh(&conn->state_lock);
-		return;
+		return 1;
 	}
 	atomic_set(&conn->connection_exit, 1);
 
 	if (conn->conn_state == TARG_CONN_STATE_IN_LOGOUT) {
 		spin_unlock_bh(&conn->state_lock);
 		iscsit_close_connection(conn);
-		return;
+		return 0;
 	}
 
 	if (conn->conn_state == TARG_CONN_STATE_CLEANUP_WAIT) {
 		spin_unlock_bh(&conn->state_lock);
-		return;
+		return 1;
 	}
 
 	pr_debug("Moving to TARG_CONN_STATE_CLEANUP_WAIT.\n");
@@ -948,6 +953,7 @@ extern void iscsit_take_action_for_connection_exit(struct iscsi_conn *conn)
 	spin_unlock_bh(&conn->state_lock);
 
 	iscsit_handle_connection_cleanup(conn);
+	return 0;
 }
 
 /*
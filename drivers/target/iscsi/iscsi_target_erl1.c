@@ -801,6 +801,13 @@ static struct iscsi_ooo_cmdsn *iscsit_allocate_ooo_cmdsn(void)
 	return ooo_cmdsn;
 }
 
+static inline struct iscsi_ooo_cmdsn **iscsit_ooo_cmdsn_slot(
+	struct iscsi_session *sess,
+	u32 cmdsn)
+{
+	return &sess->sess_ooo_cmdsn_slot[cmdsn & (ISCSI_OOO_CMDSN_SLOTS - 1)];
+}
+
 /*
  *	Called with sess->cmdsn_mutex held.
  */
@@ -808,41 +815,25 @@ static int iscsit_attach_ooo_cmdsn(
 	struct iscsi_session *sess,
 	struct iscsi_ooo_cmdsn *ooo_cmdsn)
 {
-	struct iscsi_ooo_cmdsn *ooo_tail, *ooo_tmp;
+	struct iscsi_ooo_cmdsn **slot;
 	/*
-	 * We attach the struct iscsi_ooo_cmdsn entry to the out of order
-	 * list in increasing CmdSN order.
-	 * This allows iscsi_execute_ooo_cmdsns() to detect any
-	 * additional CmdSN holes while performing delayed execution.
+	 * We attach the struct iscsi_ooo_cmdsn entry to the CmdSN window
+	 * slot for its CmdSN, so iscsi_execute_ooo_cmdsns() can release the
+	 * contiguous run starting at ExpCmdSN without walking anything, and
+	 * any remaining CmdSN holes are simply empty slots.
+	 * sess_ooo_cmdsn_list is unordered and only used for per connection
+	 * cleanup.
 	 */
-	if (list_empty(&sess->sess_ooo_cmdsn_list))
-		list_add_tail(&ooo_cmdsn->ooo_list,
-				&sess->sess_ooo_cmdsn_list);
-	else {
-		ooo_tail = list_entry(sess->sess_ooo_cmdsn_list.prev,
-				typeof(*ooo_tail), ooo_list);
-		/*
-		 * CmdSN is greater than the tail of the list.
-		 */
-		if (ooo_tail->cmdsn < ooo_cmdsn->cmdsn)
-			list_add_tail(&ooo_cmdsn->ooo_list,
-					&sess->sess_ooo_cmdsn_list);
-		else {
-			/*
-			 * CmdSN is either lower than the head,  or somewhere
-			 * in the middle.
-			 */
-			list_for_each_entry(ooo_tmp, &sess->sess_ooo_cmdsn_list,
-						ooo_list) {
-				if (ooo_tmp->cmdsn < ooo_cmdsn->cmdsn)
-					continue;
+	slot = iscsit_ooo_cmdsn_slot(sess, ooo_cmdsn->cmdsn);
+	if (*slot)
+		return -1;
 
-				list_add(&ooo_cmdsn->ooo_list,
-					&ooo_tmp->ooo_list);
-				break;
-			}
-		}
-	}
+	*slot = ooo_cmdsn;
+	list_add_tail(&ooo_cmdsn->ooo_list, &sess->sess_ooo_cmdsn_list);
+
+	sess->ooo_cmdsn_count++;
+	if (++sess->ooo_cmdsn_depth > sess->ooo_cmdsn_max_depth)
+		sess->ooo_cmdsn_max_depth = sess->ooo_cmdsn_depth;
 
 	return 0;
 }
@@ -855,6 +846,13 @@ void iscsit_remove_ooo_cmdsn(
 	struct iscsi_session *sess,
 	struct iscsi_ooo_cmdsn *ooo_cmdsn)
 {
+	struct iscsi_ooo_cmdsn **slot;
+
+	slot = iscsit_ooo_cmdsn_slot(sess, ooo_cmdsn->cmdsn);
+	if (*slot == ooo_cmdsn)
+		*slot = NULL;
+	sess->ooo_cmdsn_depth--;
+
 	list_del(&ooo_cmdsn->ooo_list);
 	kmem_cache_free(lio_ooo_cache, ooo_cmdsn);
 }
@@ -881,12 +879,11 @@ int iscsit_execute_ooo_cmdsns(struct iscsi_session *sess)
 {
 	int ooo_count = 0;
 	struct iscsi_cmd *cmd = NULL;
-	struct iscsi_ooo_cmdsn *ooo_cmdsn, *ooo_cmdsn_tmp;
+	struct iscsi_ooo_cmdsn *ooo_cmdsn;
 
-	list_for_each_entry_safe(ooo_cmdsn, ooo_cmdsn_tmp,
-				&sess->sess_ooo_cmdsn_list, ooo_list) {
+	while ((ooo_cmdsn = *iscsit_ooo_cmdsn_slot(sess, sess->exp_cmd_sn))) {
 		if (ooo_cmdsn->cmdsn != sess->exp_cmd_sn)
-			continue;
+			break;
 
 		if (!ooo_cmdsn->cmd) {
 			sess->exp_cmd_sn++;
@@ -906,8 +903,6 @@ int iscsit_execute_ooo_cmdsns(struct iscsi_session *sess)
 
 		if (iscsit_execute_cmd(cmd, 1) < 0)
 			return -1;
-
-		continue;
 	}
 
 	return ooo_count;
@@ -1072,11 +1067,8 @@ void iscsit_free_all_ooo_cmdsns(struct iscsi_session *sess)
 
 	mutex_lock(&sess->cmdsn_mutex);
 	list_for_each_entry_safe(ooo_cmdsn, ooo_cmdsn_tmp,
-			&sess->sess_ooo_cmdsn_list, ooo_list) {
-
-		list_del(&ooo_cmdsn->ooo_list);
-		kmem_cache_free(lio_ooo_cache, ooo_cmdsn);
-	}
+			&sess->sess_ooo_cmdsn_list, ooo_list)
+		iscsit_remove_ooo_cmdsn(sess, ooo_cmdsn);
 	mutex_unlock(&sess->cmdsn_mutex);
 }
 
@@ -1085,31 +1077,39 @@ int iscsit_handle_ooo_cmdsn(
 	struct iscsi_cmd *cmd,
 	u32 cmdsn)
 {
-	int batch = 0;
-	struct iscsi_ooo_cmdsn *ooo_cmdsn = NULL, *ooo_tail = NULL;
+	struct iscsi_ooo_cmdsn *ooo_cmdsn, **slot;
+
+	if ((cmdsn - sess->exp_cmd_sn) >= ISCSI_OOO_CMDSN_SLOTS) {
+		pr_err("Received CmdSN: 0x%08x is outside of the out of order"
+			" window at ExpCmdSN: 0x%08x, protocol error.\n",
+			cmdsn, sess->exp_cmd_sn);
+		return CMDSN_ERROR_CANNOT_RECOVER;
+	}
+
+	slot = iscsit_ooo_cmdsn_slot(sess, cmdsn);
+	if (*slot) {
+		if ((*slot)->cmdsn == cmdsn) {
+			pr_err("Received CmdSN: 0x%08x is already waiting for"
+				" execution, ignoring.\n", cmdsn);
+			return CMDSN_LOWER_THAN_EXP;
+		}
+		/*
+		 * Left behind by a CmdSN that was executed in order while a
+		 * duplicate was still waiting here.
+		 */
+		iscsit_remove_ooo_cmdsn(sess, *slot);
+	}
 
 	cmd->deferred_i_state		= cmd->i_state;
 	cmd->i_state			= ISTATE_DEFERRED_CMD;
 	cmd->cmd_flags			|= ICF_OOO_CMDSN;
 
-	if (list_empty(&sess->sess_ooo_cmdsn_list))
-		batch = 1;
-	else {
-		ooo_tail = list_entry(sess->sess_ooo_cmdsn_list.prev,
-				typeof(*ooo_tail), ooo_list);
-		if (ooo_tail->cmdsn != (cmdsn - 1))
-			batch = 1;
-	}
-
 	ooo_cmdsn = iscsit_allocate_ooo_cmdsn();
 	if (!ooo_cmdsn)
 		return CMDSN_ERROR_CANNOT_RECOVER;
 
 	ooo_cmdsn->cmd			= cmd;
-	ooo_cmdsn->batch_count		= (batch) ?
-					  (cmdsn - sess->exp_cmd_sn) : 1;
 	ooo_cmdsn->cid			= cmd->conn->cid;
-	ooo_cmdsn->exp_cmdsn		= sess->exp_cmd_sn;
 	ooo_cmdsn->cmdsn		= cmdsn;
 
 	if (iscsit_attach_ooo_cmdsn(sess, ooo_cmdsn) < 0) {
@@ -21,6 +21,9 @@
 #include <linux/string.h>
 #include <linux/kthread.h>
 #include <linux/crypto.h>
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h>
+#endif
 #include <scsi/iscsi_proto.h>
 #include <target/target_core_base.h>
 #include <target/target_core_fabric.h>
@@ -65,15 +68,40 @@ static int iscsi_login_init_conn(struct iscsi_conn *conn)
 	spin_lock_init(&conn->response_queue_lock);
 	spin_lock_init(&conn->deferred_cmd_lock);
 	spin_lock_init(&conn->state_lock);
+	spin_lock_init(&conn->engine_lock);
 
 	if (!zalloc_cpumask_var(&conn->conn_cpumask, GFP_KERNEL)) {
 		pr_err("Unable to allocate conn->conn_cpumask\n");
 		return -ENOMEM;
 	}
 
+	if (iscsit_alloc_cmd_hash(conn) < 0) {
+		pr_err("Unable to allocate conn->conn_itt_hash\n");
+		return -ENOMEM;
+	}
+
 	return 0;
 }
 
+/*
+ * Allocate a crc32c libcrypto context, asking for the SSE4.2 crc32
+ * instruction based crc32c-intel.ko by driver name first so that it is
+ * loaded on demand even when the generic crc32c.ko is already present.
+ */
+static struct crypto_hash *iscsi_login_alloc_crc32c(void)
+{
+#ifdef CONFIG_X86
+	struct crypto_hash *tfm;
+
+	if (cpu_has_xmm4_2) {
+		tfm = crypto_alloc_hash("crc32c-intel", 0, CRYPTO_ALG_ASYNC);
+		if (!IS_ERR(tfm))
+			return tfm;
+	}
+#endif
+	return crypto_alloc_hash("crc32c", 0, CRYPTO_ALG_ASYNC);
+}
+
 /*
  * Used by iscsi_target_nego.c:iscsi_target_locate_portal() to setup
  * per struct iscsi_conn libcrypto contexts for crc32c and crc32-intel
@@ -82,26 +110,27 @@ int iscsi_login_setup_crypto(struct iscsi_conn *conn)
 {
 	/*
 	 * Setup slicing by CRC32C algorithm for RX and TX libcrypto contexts
-	 * which will default to crc32c_intel.ko for cpu_has_xmm4_2, or fallback
+	 * which will use crc32c_intel.ko for cpu_has_xmm4_2, or fallback
 	 * to software 1x8 byte slicing from crc32c.ko
 	 */
 	conn->conn_rx_hash.flags = 0;
-	conn->conn_rx_hash.tfm = crypto_alloc_hash("crc32c", 0,
-						CRYPTO_ALG_ASYNC);
+	conn->conn_rx_hash.tfm = iscsi_login_alloc_crc32c();
 	if (IS_ERR(conn->conn_rx_hash.tfm)) {
 		pr_err("crypto_alloc_hash() failed for conn_rx_tfm\n");
 		return -ENOMEM;
 	}
 
 	conn->conn_tx_hash.flags = 0;
-	conn->conn_tx_hash.tfm = crypto_alloc_hash("crc32c", 0,
-						CRYPTO_ALG_ASYNC);
+	conn->conn_tx_hash.tfm = iscsi_login_alloc_crc32c();
 	if (IS_ERR(conn->conn_tx_hash.tfm)) {
 		pr_err("crypto_alloc_hash() failed for conn_tx_tfm\n");
 		crypto_free_hash(conn->conn_rx_hash.tfm);
 		return -ENOMEM;
 	}
 
+	pr_debug("Using %s for CRC32C digests\n", crypto_tfm_alg_driver_name(
+			crypto_hash_tfm(conn->conn_rx_hash.tfm)));
+
 	return 0;
 }
 
@@ -589,7 +618,7 @@ static int iscsi_post_login_handler(
 	struct se_session *se_sess = sess->se_sess;
 	struct iscsi_portal_group *tpg = ISCSI_TPG_S(sess);
 	struct se_portal_group *se_tpg = &tpg->tpg_se_tpg;
-	struct iscsi_thread_set *ts;
+	struct iscsi_thread_set *ts = NULL;
 
 	iscsit_inc_conn_usage_count(conn);
 
@@ -604,7 +633,8 @@ static int iscsi_post_login_handler(
 	/*
 	 * SCSI Initiator -> SCSI Target Port Mapping
 	 */
-	ts = iscsi_get_thread_set();
+	if (!iscsi_conn_engine_enabled())
+		ts = iscsi_get_thread_set();
 	if (!zero_tsih) {
 		iscsi_set_session_parameters(sess->sess_ops,
 				conn->param_list, 0);
@@ -634,15 +664,18 @@ static int iscsi_post_login_handler(
 		spin_unlock_bh(&sess->conn_lock);
 
 		iscsi_post_login_start_timers(conn);
-		iscsi_activate_thread_set(conn, ts);
-		/*
-		 * Determine CPU mask to ensure connection's RX and TX kthreads
-		 * are scheduled on the same CPU.
-		 */
-		iscsit_thread_get_cpumask(conn);
-		conn->conn_rx_reset_cpumask = 1;
-		conn->conn_tx_reset_cpumask = 1;
-		conn->conn_deferred_reset_cpumask = 1;
+		if (ts) {
+			iscsi_activate_thread_set(conn, ts);
+			/*
+			 * Determine CPU mask to ensure connection's RX and TX
+			 * kthreads are scheduled on the same CPU.
+			 */
+			iscsit_thread_get_cpumask(conn);
+			conn->conn_rx_reset_cpumask = 1;
+			conn->conn_tx_reset_cpumask = 1;
+			conn->conn_deferred_reset_cpumask = 1;
+		} else
+			iscsi_conn_engine_start(conn);
 
 		iscsit_dec_conn_usage_count(conn);
 		if (stop_timer) {
@@ -695,14 +728,17 @@ static int iscsi_post_login_handler(
 	spin_unlock_bh(&se_tpg->session_lock);
 
 	iscsi_post_login_start_timers(conn);
-	iscsi_activate_thread_set(conn, ts);
-	/*
-	 * Determine CPU mask to ensure connection's RX and TX kthreads
-	 * are scheduled on the same CPU.
-	 */
-	iscsit_thread_get_cpumask(conn);
-	conn->conn_rx_reset_cpumask = 1;
-	conn->conn_tx_reset_cpumask = 1;
+	if (ts) {
+		iscsi_activate_thread_set(conn, ts);
+		/*
+		 * Determine CPU mask to ensure connection's RX and TX kthreads
+		 * are scheduled on the same CPU.
+		 */
+		iscsit_thread_get_cpumask(conn);
+		conn->conn_rx_reset_cpumask = 1;
+		conn->conn_tx_reset_cpumask = 1;
+	} else
+		iscsi_conn_engine_start(conn);
 
 	iscsit_dec_conn_usage_count(conn);
 
@@ -1216,6 +1252,8 @@ old_sess_out:
 	if (conn->conn_cpumask)
 		free_cpumask_var(conn->conn_cpumask);
 
+	iscsit_free_cmd_hash(conn);
+
 	kfree(conn->conn_ops);
 
 	if (conn->param_list) {
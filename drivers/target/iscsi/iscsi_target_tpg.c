@@ -218,6 +218,7 @@ static void iscsit_set_default_tpg_attribs(struct iscsi_portal_group *tpg)
 	a->cache_dynamic_acls = TA_CACHE_DYNAMIC_ACLS;
 	a->demo_mode_write_protect = TA_DEMO_MODE_WRITE_PROTECT;
 	a->prod_mode_write_protect = TA_PROD_MODE_WRITE_PROTECT;
+	a->cpu_affinity = TA_CPU_AFFINITY;
 }
 
 int iscsit_tpg_add_portal_group(struct iscsi_tiqn *tiqn, struct iscsi_portal_group *tpg)
@@ -755,3 +756,22 @@ int iscsit_ta_prod_mode_write_protect(
 
 	return 0;
 }
+
+int iscsit_ta_cpu_affinity(
+	struct iscsi_portal_group *tpg,
+	u32 policy)
+{
+	struct iscsi_tpg_attrib *a = &tpg->tpg_attrib;
+
+	if (policy > TA_CPU_AFFINITY_CPU) {
+		pr_err("Illegal value %d\n", policy);
+		return -EINVAL;
+	}
+
+	a->cpu_affinity = policy;
+	pr_debug("iSCSI_TPG[%hu] - CPU affinity for new connections: %s\n",
+		tpg->tpgt, (policy == TA_CPU_AFFINITY_CPU) ? "NIC node CPU" :
+		(policy == TA_CPU_AFFINITY_NODE) ? "NIC node" : "none");
+
+	return 0;
+}
@@ -21,9 +21,12 @@
 #include <linux/kthread.h>
 #include <linux/list.h>
 #include <linux/bitmap.h>
+#include <linux/module.h>
+#include <linux/workqueue.h>
 
 #include "iscsi_target_core.h"
 #include "iscsi_target_tq.h"
+#include "iscsi_target_util.h"
 #include "iscsi_target.h"
 
 static LIST_HEAD(active_ts_list);
@@ -32,6 +35,10 @@ static DEFINE_SPINLOCK(active_ts_lock);
 static DEFINE_SPINLOCK(inactive_ts_lock);
 static DEFINE_SPINLOCK(ts_bitmap_lock);
 
+static void iscsi_conn_engine_clear(struct iscsi_conn *, u8);
+static int iscsi_conn_engine_force(struct iscsi_conn *);
+static int iscsi_conn_engine_stop(struct iscsi_conn *);
+
 static void iscsi_add_ts_to_active_list(struct iscsi_thread_set *ts)
 {
 	spin_lock(&active_ts_lock);
@@ -299,6 +306,10 @@ void iscsi_set_thread_clear(struct iscsi_conn *conn, u8 thread_clear)
 {
 	struct iscsi_thread_set *ts = NULL;
 
+	if (test_bit(ISCSI_ENGINE_ACTIVE, &conn->engine_flags)) {
+		iscsi_conn_engine_clear(conn, thread_clear);
+		return;
+	}
 	if (!conn->thread_set) {
 		pr_err("struct iscsi_conn->thread_set is NULL\n");
 		return;
@@ -324,6 +335,8 @@ void iscsi_set_thread_set_signal(struct iscsi_conn *conn, u8 signal_sent)
 {
 	struct iscsi_thread_set *ts = NULL;
 
+	if (test_bit(ISCSI_ENGINE_ACTIVE, &conn->engine_flags))
+		return;
 	if (!conn->thread_set) {
 		pr_err("struct iscsi_conn->thread_set is NULL\n");
 		return;
@@ -340,6 +353,8 @@ int iscsi_release_thread_set(struct iscsi_conn *conn)
 	int thread_called = 0;
 	struct iscsi_thread_set *ts = NULL;
 
+	if (conn && test_bit(ISCSI_ENGINE_ACTIVE, &conn->engine_flags))
+		return iscsi_conn_engine_stop(conn);
 	if (!conn || !conn->thread_set) {
 		pr_err("connection or thread set pointer is NULL\n");
 		BUG();
@@ -415,6 +430,8 @@ int iscsi_thread_set_force_reinstatement(struct iscsi_conn *conn)
 {
 	struct iscsi_thread_set *ts;
 
+	if (test_bit(ISCSI_ENGINE_ACTIVE, &conn->engine_flags))
+		return iscsi_conn_engine_force(conn);
 	if (!conn->thread_set)
 		return -1;
 	ts = conn->thread_set;
@@ -669,3 +686,366 @@ void iscsi_thread_set_free(void)
 {
 	kfree(iscsit_global->ts_bitmap);
 }
+
+void iscsi_interrupt_rx_thread(struct iscsi_conn *conn)
+{
+	struct iscsi_thread_set *ts = conn->thread_set;
+
+	if (ts) {
+		send_sig(SIGINT, ts->rx_thread, 1);
+		return;
+	}
+	iscsi_thread_set_force_reinstatement(conn);
+}
+
+/*
+ * Instead of a struct iscsi_thread_set per connection, conn_workers=1
+ * services every connection from the bound iscsi_conn_wq.  The socket
+ * data_ready, write_space and state_change callbacks queue the RX and TX
+ * contexts of a connection as work on the CPU that runs the softirq for
+ * its packets, so with RSS each connection stays on the CPU of its
+ * receive queue and a handful of per-CPU kworkers replace three kthreads
+ * per connection.
+ */
+static bool iscsi_conn_workers;
+module_param_named(conn_workers, iscsi_conn_workers, bool, S_IRUGO);
+MODULE_PARM_DESC(conn_workers, "Service connections from per-CPU workers"
+		 " instead of per-connection thread sets");
+
+static struct workqueue_struct *iscsi_conn_wq;
+
+int iscsi_conn_engine_enabled(void)
+{
+	return iscsi_conn_wq != NULL;
+}
+
+static int iscsi_conn_engine_cpu(struct iscsi_conn *conn)
+{
+	int cpu = ACCESS_ONCE(conn->engine_cpu);
+
+	return cpu_online(cpu) ? cpu : raw_smp_processor_id();
+}
+
+/*
+ * Called with conn->engine_lock held.
+ */
+static void __iscsi_conn_queue_work(
+	struct iscsi_conn *conn,
+	struct iscsi_conn_work *cw)
+{
+	if (test_bit(ISCSI_ENGINE_STOPPING, &conn->engine_flags) ||
+	    cw->detached)
+		return;
+
+	switch (cw->state) {
+	case ISCSI_WORK_IDLE:
+		cw->state = ISCSI_WORK_QUEUED;
+		queue_work_on(iscsi_conn_engine_cpu(conn), iscsi_conn_wq,
+			      &cw->work);
+		break;
+	case ISCSI_WORK_RUNNING:
+		cw->state = ISCSI_WORK_RESCHED;
+		break;
+	default:
+		break;
+	}
+}
+
+static void iscsi_conn_queue_work(
+	struct iscsi_conn *conn,
+	struct iscsi_conn_work *cw)
+{
+	spin_lock_bh(&conn->engine_lock);
+	__iscsi_conn_queue_work(conn, cw);
+	spin_unlock_bh(&conn->engine_lock);
+}
+
+/*
+ * Returns -1 when the connection is being stopped and the context must
+ * not touch it.
+ */
+int iscsi_conn_work_begin(struct iscsi_conn *conn, struct iscsi_conn_work *cw)
+{
+	spin_lock_bh(&conn->engine_lock);
+	if (test_bit(ISCSI_ENGINE_STOPPING, &conn->engine_flags)) {
+		cw->state = ISCSI_WORK_IDLE;
+		spin_unlock_bh(&conn->engine_lock);
+		return -1;
+	}
+	cw->state = ISCSI_WORK_RUNNING;
+	cw->task = current;
+	spin_unlock_bh(&conn->engine_lock);
+
+	return 0;
+}
+
+/*
+ * A context only ever requeues itself from here, so its work_struct is
+ * never pending while it runs and iscsi_conn_engine_stop() can rely on
+ * cancel_work_sync().
+ */
+void iscsi_conn_work_end(
+	struct iscsi_conn *conn,
+	struct iscsi_conn_work *cw,
+	int resched)
+{
+	spin_lock_bh(&conn->engine_lock);
+	cw->task = NULL;
+	if (resched || cw->state == ISCSI_WORK_RESCHED) {
+		cw->state = ISCSI_WORK_IDLE;
+		__iscsi_conn_queue_work(conn, cw);
+	} else
+		cw->state = ISCSI_WORK_IDLE;
+	spin_unlock_bh(&conn->engine_lock);
+}
+
+void iscsi_conn_wake_tx(struct iscsi_conn *conn)
+{
+	if (test_bit(ISCSI_ENGINE_ACTIVE, &conn->engine_flags)) {
+		iscsi_conn_queue_work(conn, &conn->tx_work);
+		return;
+	}
+	wake_up_interruptible(&conn->wq);
+}
+
+void iscsi_conn_wake_deferred(struct iscsi_conn *conn)
+{
+	if (test_bit(ISCSI_ENGINE_ACTIVE, &conn->engine_flags)) {
+		iscsi_conn_queue_work(conn, &conn->deferred_work);
+		return;
+	}
+	wake_up_interruptible(&conn->deferred_wq);
+}
+
+/*
+ * The first softirq that delivers data for the connection decides which
+ * CPU services it from then on, unless the TPG cpu_affinity policy put
+ * conn->conn_cpumask elsewhere.
+ */
+static void iscsi_conn_pin_cpu(struct iscsi_conn *conn)
+{
+	int cpu = smp_processor_id();
+
+	if (test_and_set_bit(ISCSI_ENGINE_CPU_SET, &conn->engine_flags))
+		return;
+
+	if (!cpumask_test_cpu(cpu, conn->conn_cpumask)) {
+		int alt = cpumask_any_and(conn->conn_cpumask, cpu_online_mask);
+
+		if (alt < nr_cpu_ids)
+			cpu = alt;
+	}
+	/* Read without engine_lock by iscsi_conn_engine_cpu() */
+	ACCESS_ONCE(conn->engine_cpu) = cpu;
+}
+
+static void iscsi_conn_data_ready(struct sock *sk, int bytes)
+{
+	struct iscsi_conn *conn;
+
+	read_lock(&sk->sk_callback_lock);
+	conn = sk->sk_user_data;
+	if (conn) {
+		iscsi_conn_pin_cpu(conn);
+		iscsi_conn_queue_work(conn, &conn->rx_work);
+		conn->orig_data_ready(sk, bytes);
+	}
+	read_unlock(&sk->sk_callback_lock);
+}
+
+static void iscsi_conn_write_space(struct sock *sk)
+{
+	struct iscsi_conn *conn;
+
+	read_lock(&sk->sk_callback_lock);
+	conn = sk->sk_user_data;
+	if (conn) {
+		if (!iscsit_conn_all_queues_empty(conn))
+			iscsi_conn_queue_work(conn, &conn->tx_work);
+		conn->orig_write_space(sk);
+	}
+	read_unlock(&sk->sk_callback_lock);
+}
+
+static void iscsi_conn_state_change(struct sock *sk)
+{
+	struct iscsi_conn *conn;
+
+	read_lock(&sk->sk_callback_lock);
+	conn = sk->sk_user_data;
+	if (conn) {
+		iscsi_conn_queue_work(conn, &conn->rx_work);
+		conn->orig_state_change(sk);
+	}
+	read_unlock(&sk->sk_callback_lock);
+}
+
+/*
+ * Replaces the SIGINT a thread set would get: shutting the socket down
+ * fails any RX or TX context blocked in rx_data() or tx_data().
+ */
+static void iscsi_conn_kill_work(struct work_struct *work)
+{
+	struct iscsi_conn *conn = container_of(work, struct iscsi_conn,
+					       kill_work);
+
+	kernel_sock_shutdown(conn->sock, SHUT_RDWR);
+	iscsi_conn_queue_work(conn, &conn->rx_work);
+}
+
+static int iscsi_conn_engine_force(struct iscsi_conn *conn)
+{
+	spin_lock_bh(&conn->engine_lock);
+	if (test_bit(ISCSI_ENGINE_STOPPING, &conn->engine_flags)) {
+		spin_unlock_bh(&conn->engine_lock);
+		return -1;
+	}
+	set_bit(ISCSI_ENGINE_FORCE, &conn->engine_flags);
+	queue_work_on(iscsi_conn_engine_cpu(conn), iscsi_conn_wq,
+		      &conn->kill_work);
+	spin_unlock_bh(&conn->engine_lock);
+
+	return 0;
+}
+
+/*
+ * Called with conn->engine_lock held.  A context detaching itself may not
+ * touch the connection again once it has been closed, so this is also
+ * where its iscsi_conn_work_end() happens.
+ */
+static void __iscsi_conn_detach_work(struct iscsi_conn_work *cw)
+{
+	cw->detached = 1;
+	if (cw->task == current) {
+		cw->task = NULL;
+		cw->state = ISCSI_WORK_IDLE;
+	}
+}
+
+/*
+ * Same as clearing a thread from struct iscsi_thread_set->thread_clear:
+ * the context is about to wait for the connection to be closed, so
+ * iscsi_conn_engine_stop() must not wait for it in turn.
+ */
+static void iscsi_conn_engine_clear(struct iscsi_conn *conn, u8 thread_clear)
+{
+	spin_lock_bh(&conn->engine_lock);
+	if (thread_clear & ISCSI_CLEAR_RX_THREAD)
+		__iscsi_conn_detach_work(&conn->rx_work);
+	if (thread_clear & ISCSI_CLEAR_TX_THREAD)
+		__iscsi_conn_detach_work(&conn->tx_work);
+	if (thread_clear & ISCSI_CLEAR_DEFERRED_THREAD)
+		__iscsi_conn_detach_work(&conn->deferred_work);
+	spin_unlock_bh(&conn->engine_lock);
+}
+
+static void iscsi_conn_init_work(
+	struct iscsi_conn_work *cw,
+	work_func_t func)
+{
+	INIT_WORK(&cw->work, func);
+	cw->state = ISCSI_WORK_IDLE;
+	cw->detached = 0;
+	cw->task = NULL;
+}
+
+void iscsi_conn_engine_start(struct iscsi_conn *conn)
+{
+	struct sock *sk = conn->sock->sk;
+
+	conn->engine_cpu = raw_smp_processor_id();
+	iscsit_thread_get_cpumask(conn);
+	iscsi_conn_init_work(&conn->rx_work, iscsi_target_rx_work);
+	iscsi_conn_init_work(&conn->tx_work, iscsi_target_tx_work);
+	iscsi_conn_init_work(&conn->deferred_work, iscsi_target_deferred_work);
+	INIT_WORK(&conn->kill_work, iscsi_conn_kill_work);
+	set_bit(ISCSI_ENGINE_ACTIVE, &conn->engine_flags);
+
+	write_lock_bh(&sk->sk_callback_lock);
+	sk->sk_user_data = conn;
+	conn->orig_data_ready = sk->sk_data_ready;
+	conn->orig_write_space = sk->sk_write_space;
+	conn->orig_state_change = sk->sk_state_change;
+	sk->sk_data_ready = iscsi_conn_data_ready;
+	sk->sk_write_space = iscsi_conn_write_space;
+	sk->sk_state_change = iscsi_conn_state_change;
+	write_unlock_bh(&sk->sk_callback_lock);
+
+	pr_debug("%s/%d: CID %hu serviced by %s workers\n", current->comm,
+		task_pid_nr(current), conn->cid, ISCSI_CONN_WQ_NAME);
+	/*
+	 * PDUs may already be sitting in the receive queue, and the login
+	 * may have queued a response.
+	 */
+	iscsi_conn_queue_work(conn, &conn->rx_work);
+	iscsi_conn_wake_tx(conn);
+}
+
+static void iscsi_conn_cancel_work(
+	struct iscsi_conn *conn,
+	struct iscsi_conn_work *cw)
+{
+	bool skip;
+
+	spin_lock_bh(&conn->engine_lock);
+	skip = (cw->task == current || cw->detached);
+	spin_unlock_bh(&conn->engine_lock);
+
+	if (!skip)
+		cancel_work_sync(&cw->work);
+}
+
+/*
+ * Counterpart of iscsi_release_thread_set(), called from
+ * iscsit_close_connection() in the context of whichever work failed.
+ */
+static int iscsi_conn_engine_stop(struct iscsi_conn *conn)
+{
+	struct sock *sk = conn->sock->sk;
+
+	spin_lock_bh(&conn->engine_lock);
+	set_bit(ISCSI_ENGINE_STOPPING, &conn->engine_flags);
+	spin_unlock_bh(&conn->engine_lock);
+
+	write_lock_bh(&sk->sk_callback_lock);
+	sk->sk_user_data = NULL;
+	sk->sk_data_ready = conn->orig_data_ready;
+	sk->sk_write_space = conn->orig_write_space;
+	sk->sk_state_change = conn->orig_state_change;
+	write_unlock_bh(&sk->sk_callback_lock);
+
+	cancel_work_sync(&conn->kill_work);
+	kernel_sock_shutdown(conn->sock, SHUT_RDWR);
+
+	iscsi_conn_cancel_work(conn, &conn->rx_work);
+	iscsi_conn_cancel_work(conn, &conn->tx_work);
+	iscsi_conn_cancel_work(conn, &conn->deferred_work);
+	iscsit_drain_deferred_cmds(conn);
+
+	pr_info("%s/%d: CID %hu released from %s workers\n", current->comm,
+		task_pid_nr(current), conn->cid, ISCSI_CONN_WQ_NAME);
+	return 0;
+}
+
+int iscsi_conn_engine_init(void)
+{
+	if (!iscsi_conn_workers)
+		return 0;
+
+	iscsi_conn_wq = alloc_workqueue(ISCSI_CONN_WQ_NAME,
+					WQ_HIGHPRI | WQ_MEM_RECLAIM, 0);
+	if (!iscsi_conn_wq) {
+		pr_err("Unable to allocate %s workqueue\n",
+			ISCSI_CONN_WQ_NAME);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+void iscsi_conn_engine_free(void)
+{
+	if (iscsi_conn_wq)
+		destroy_workqueue(iscsi_conn_wq);
+	iscsi_conn_wq = NULL;
+}
@@ -18,6 +18,19 @@ extern struct iscsi_conn *iscsi_tx_thread_pre_handler(struct iscsi_thread_set *)
 extern struct iscsi_conn *iscsi_deferred_thread_pre_handler(struct iscsi_thread_set *);
 extern int iscsi_thread_set_init(void);
 extern void iscsi_thread_set_free(void);
+extern void iscsi_interrupt_rx_thread(struct iscsi_conn *);
+
+/*
+ * Defines for the per-CPU connection workers.
+ */
+extern int iscsi_conn_engine_init(void);
+extern void iscsi_conn_engine_free(void);
+extern int iscsi_conn_engine_enabled(void);
+extern void iscsi_conn_engine_start(struct iscsi_conn *);
+extern int iscsi_conn_work_begin(struct iscsi_conn *, struct iscsi_conn_work *);
+extern void iscsi_conn_work_end(struct iscsi_conn *, struct iscsi_conn_work *, int);
+extern void iscsi_conn_wake_tx(struct iscsi_conn *);
+extern void iscsi_conn_wake_deferred(struct iscsi_conn *);
 
 extern int iscsi_target_tx_thread(void *);
 extern int iscsi_target_rx_thread(void *);
@@ -46,6 +59,10 @@ extern int iscsi_target_rx_thread(void *);
 #define ISCSI_THREAD_SET_RESET			4
 #define ISCSI_THREAD_SET_DEALLOCATE_THREADS	5
 
+#define ISCSI_CONN_WQ_NAME			"iscsi_conn"
+/* PDUs received by one rx_work run before yielding the worker */
+#define ISCSI_CONN_RX_BUDGET			16
+
 /* By default allow a maximum of 32K iSCSI connections */
 #define ISCSI_TS_BITMAP_BITS			32768
 
@@ -19,6 +19,7 @@
  ******************************************************************************/
 
 #include <linux/list.h>
+#include <linux/hash.h>
 #include <scsi/scsi_tcq.h>
 #include <scsi/iscsi_proto.h>
 #include <target/target_core_base.h>
@@ -164,8 +165,16 @@ struct iscsi_cmd *iscsit_allocate_cmd(struct iscsi_conn *conn, gfp_t gfp_mask)
 
 	cmd->conn	= conn;
 	INIT_LIST_HEAD(&cmd->i_list);
+	INIT_LIST_HEAD(&cmd->i_itt_node);
+	INIT_LIST_HEAD(&cmd->i_ttt_node);
 	INIT_LIST_HEAD(&cmd->datain_list);
 	INIT_LIST_HEAD(&cmd->cmd_r2t_list);
+	INIT_LIST_HEAD(&cmd->i_immed_qr.qr_list);
+	cmd->i_immed_qr.cmd = cmd;
+	cmd->i_immed_qr.embedded = true;
+	INIT_LIST_HEAD(&cmd->i_rsp_qr.qr_list);
+	cmd->i_rsp_qr.cmd = cmd;
+	cmd->i_rsp_qr.embedded = true;
 	init_completion(&cmd->reject_comp);
 	spin_lock_init(&cmd->datain_lock);
 	spin_lock_init(&cmd->dataout_timeout_lock);
@@ -461,11 +470,13 @@ int iscsit_sequence_cmd(
 		break;
 	case CMDSN_HIGHER_THAN_EXP:
 		ret = iscsit_handle_ooo_cmdsn(conn->sess, cmd, cmdsn);
-		break;
+		if (ret != CMDSN_LOWER_THAN_EXP)
+			break;
+		/* Duplicate of a CmdSN already in the out of order window */
 	case CMDSN_LOWER_THAN_EXP:
 		cmd->i_state = ISTATE_REMOVE;
 		iscsit_add_cmd_to_immediate_queue(cmd, conn, cmd->i_state);
-		ret = cmdsn_ret;
+		ret = CMDSN_LOWER_THAN_EXP;
 		break;
 	default:
 		ret = cmdsn_ret;
@@ -520,6 +531,79 @@ int iscsit_check_unsolicited_dataout(struct iscsi_cmd *cmd, unsigned char *buf)
 	return 0;
 }
 
+int iscsit_alloc_cmd_hash(struct iscsi_conn *conn)
+{
+	int i;
+
+	conn->conn_itt_hash = kmalloc(2 * ISCSI_CMD_HASH_SIZE *
+				sizeof(struct list_head), GFP_KERNEL);
+	if (!conn->conn_itt_hash)
+		return -ENOMEM;
+
+	conn->conn_ttt_hash = conn->conn_itt_hash + ISCSI_CMD_HASH_SIZE;
+	for (i = 0; i < 2 * ISCSI_CMD_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&conn->conn_itt_hash[i]);
+
+	return 0;
+}
+
+void iscsit_free_cmd_hash(struct iscsi_conn *conn)
+{
+	kfree(conn->conn_itt_hash);
+	conn->conn_itt_hash = conn->conn_ttt_hash = NULL;
+}
+
+/*
+ * Called with conn->cmd_lock held.  Commands are added at the tail of
+ * their bucket, so a lookup still finds the oldest command carrying a
+ * tag, as the walk of conn_cmd_list did.
+ */
+void iscsit_add_cmd_to_conn_list(struct iscsi_cmd *cmd, struct iscsi_conn *conn)
+{
+	list_add_tail(&cmd->i_list, &conn->conn_cmd_list);
+
+	if (cmd->init_task_tag != 0xFFFFFFFF)
+		list_add_tail(&cmd->i_itt_node, &conn->conn_itt_hash[
+				hash_32(cmd->init_task_tag, ISCSI_CMD_HASH_BITS)]);
+	if (cmd->targ_xfer_tag != 0xFFFFFFFF)
+		list_add_tail(&cmd->i_ttt_node, &conn->conn_ttt_hash[
+				hash_32(cmd->targ_xfer_tag, ISCSI_CMD_HASH_BITS)]);
+}
+
+/*
+ * Called with conn->cmd_lock held.
+ */
+void iscsit_del_cmd_from_conn_list(struct iscsi_cmd *cmd, struct iscsi_conn *conn)
+{
+	list_del(&cmd->i_list);
+	list_del_init(&cmd->i_itt_node);
+	list_del_init(&cmd->i_ttt_node);
+}
+
+/*
+ * Called with conn->cmd_lock held.
+ */
+static struct iscsi_cmd *__iscsit_find_cmd_from_itt(
+	struct iscsi_conn *conn,
+	u32 init_task_tag)
+{
+	struct iscsi_cmd *cmd;
+
+	if (init_task_tag == 0xFFFFFFFF) {
+		list_for_each_entry(cmd, &conn->conn_cmd_list, i_list)
+			if (cmd->init_task_tag == init_task_tag)
+				return cmd;
+		return NULL;
+	}
+
+	list_for_each_entry(cmd, &conn->conn_itt_hash[
+			hash_32(init_task_tag, ISCSI_CMD_HASH_BITS)], i_itt_node)
+		if (cmd->init_task_tag == init_task_tag)
+			return cmd;
+
+	return NULL;
+}
+
 struct iscsi_cmd *iscsit_find_cmd_from_itt(
 	struct iscsi_conn *conn,
 	u32 init_task_tag)
@@ -527,13 +611,10 @@ struct iscsi_cmd *iscsit_find_cmd_from_itt(
 	struct iscsi_cmd *cmd;
 
 	spin_lock_bh(&conn->cmd_lock);
-	list_for_each_entry(cmd, &conn->conn_cmd_list, i_list) {
-		if (cmd->init_task_tag == init_task_tag) {
-			spin_unlock_bh(&conn->cmd_lock);
-			return cmd;
-		}
-	}
+	cmd = __iscsit_find_cmd_from_itt(conn, init_task_tag);
 	spin_unlock_bh(&conn->cmd_lock);
+	if (cmd)
+		return cmd;
 
 	pr_err("Unable to locate ITT: 0x%08x on CID: %hu",
 			init_task_tag, conn->cid);
@@ -548,13 +629,10 @@ struct iscsi_cmd *iscsit_find_cmd_from_itt_or_dump(
 	struct iscsi_cmd *cmd;
 
 	spin_lock_bh(&conn->cmd_lock);
-	list_for_each_entry(cmd, &conn->conn_cmd_list, i_list) {
-		if (cmd->init_task_tag == init_task_tag) {
-			spin_unlock_bh(&conn->cmd_lock);
-			return cmd;
-		}
-	}
+	cmd = __iscsit_find_cmd_from_itt(conn, init_task_tag);
 	spin_unlock_bh(&conn->cmd_lock);
+	if (cmd)
+		return cmd;
 
 	pr_err("Unable to locate ITT: 0x%08x on CID: %hu,"
 			" dumping payload\n", init_task_tag, conn->cid);
@@ -564,20 +642,41 @@ struct iscsi_cmd *iscsit_find_cmd_from_itt_or_dump(
 	return NULL;
 }
 
+/*
+ * Called with conn->cmd_lock held.
+ */
+static struct iscsi_cmd *__iscsit_find_cmd_from_ttt(
+	struct iscsi_conn *conn,
+	u32 targ_xfer_tag)
+{
+	struct iscsi_cmd *cmd;
+
+	if (targ_xfer_tag == 0xFFFFFFFF) {
+		list_for_each_entry(cmd, &conn->conn_cmd_list, i_list)
+			if (cmd->targ_xfer_tag == targ_xfer_tag)
+				return cmd;
+		return NULL;
+	}
+
+	list_for_each_entry(cmd, &conn->conn_ttt_hash[
+			hash_32(targ_xfer_tag, ISCSI_CMD_HASH_BITS)], i_ttt_node)
+		if (cmd->targ_xfer_tag == targ_xfer_tag)
+			return cmd;
+
+	return NULL;
+}
+
 struct iscsi_cmd *iscsit_find_cmd_from_ttt(
 	struct iscsi_conn *conn,
 	u32 targ_xfer_tag)
 {
-	struct iscsi_cmd *cmd = NULL;
+	struct iscsi_cmd *cmd;
 
 	spin_lock_bh(&conn->cmd_lock);
-	list_for_each_entry(cmd, &conn->conn_cmd_list, i_list) {
-		if (cmd->targ_xfer_tag == targ_xfer_tag) {
-			spin_unlock_bh(&conn->cmd_lock);
-			return cmd;
-		}
-	}
+	cmd = __iscsit_find_cmd_from_ttt(conn, targ_xfer_tag);
 	spin_unlock_bh(&conn->cmd_lock);
+	if (cmd)
+		return cmd;
 
 	pr_err("Unable to locate TTT: 0x%08x on CID: %hu\n",
 			targ_xfer_tag, conn->cid);
@@ -636,50 +735,95 @@ int iscsit_find_cmd_for_recovery(
 	return -1;
 }
 
-void iscsit_add_cmd_to_immediate_queue(
+/*
+ *	Called with the immediate or response queue lock held.
+ */
+static struct iscsi_queue_req *iscsit_get_queue_req(
 	struct iscsi_cmd *cmd,
-	struct iscsi_conn *conn,
-	u8 state)
+	struct iscsi_queue_req *qr)
 {
-	struct iscsi_queue_req *qr;
+	/*
+	 * The struct iscsi_queue_req embedded in struct iscsi_cmd covers a
+	 * command sitting on a queue once, only additional entries for the
+	 * same command (eg: multiple outstanding R2Ts) need an allocation.
+	 */
+	if (list_empty(&qr->qr_list))
+		return qr;
 
 	qr = kmem_cache_zalloc(lio_qr_cache, GFP_ATOMIC);
 	if (!qr) {
 		pr_err("Unable to allocate memory for"
 				" struct iscsi_queue_req\n");
-		return;
+		return NULL;
 	}
 	INIT_LIST_HEAD(&qr->qr_list);
 	qr->cmd = cmd;
-	qr->state = state;
+
+	return qr;
+}
+
+/*
+ *	Called with the immediate or response queue lock held.
+ */
+static void iscsit_put_queue_req(struct iscsi_queue_req *qr)
+{
+	list_del_init(&qr->qr_list);
+	if (!qr->embedded)
+		kmem_cache_free(lio_qr_cache, qr);
+}
+
+void iscsit_add_cmd_to_immediate_queue(
+	struct iscsi_cmd *cmd,
+	struct iscsi_conn *conn,
+	u8 state)
+{
+	struct iscsi_queue_req *qr;
+	bool wake;
 
 	spin_lock_bh(&conn->immed_queue_lock);
+	qr = iscsit_get_queue_req(cmd, &cmd->i_immed_qr);
+	if (!qr) {
+		spin_unlock_bh(&conn->immed_queue_lock);
+		return;
+	}
+	qr->state = state;
+
+	wake = list_empty(&conn->immed_queue_list);
 	list_add_tail(&qr->qr_list, &conn->immed_queue_list);
 	atomic_inc(&cmd->immed_queue_count);
 	atomic_set(&conn->check_immediate_queue, 1);
 	spin_unlock_bh(&conn->immed_queue_lock);
-
-	wake_up_interruptible(&conn->wq);
+	/*
+	 * iscsit_tx_handle_queues() drains everything queued behind the
+	 * first entry, so only the empty -> non-empty transition needs to
+	 * kick the TX side.
+	 */
+	if (wake)
+		iscsi_conn_wake_tx(conn);
 }
 
-struct iscsi_queue_req *iscsit_get_cmd_from_immediate_queue_bh(struct iscsi_conn *conn)
+struct iscsi_cmd *iscsit_get_cmd_from_immediate_queue_bh(
+	struct iscsi_conn *conn,
+	u8 *state)
 {
 	struct iscsi_queue_req *qr;
+	struct iscsi_cmd *cmd;
 
 	spin_lock(&conn->immed_queue_lock);
 	if (list_empty(&conn->immed_queue_list)) {
 		spin_unlock(&conn->immed_queue_lock);
 		return NULL;
 	}
-	list_for_each_entry(qr, &conn->immed_queue_list, qr_list)
-		break;
+	qr = list_first_entry(&conn->immed_queue_list,
+			struct iscsi_queue_req, qr_list);
 
-	list_del(&qr->qr_list);
-	if (qr->cmd)
-		atomic_dec(&qr->cmd->immed_queue_count);
+	cmd = qr->cmd;
+	*state = qr->state;
+	atomic_dec(&cmd->immed_queue_count);
+	iscsit_put_queue_req(qr);
 	spin_unlock(&conn->immed_queue_lock);
 
-	return qr;
+	return cmd;
 }
 
 static void iscsit_remove_cmd_from_immediate_queue(
@@ -699,8 +843,7 @@ static void iscsit_remove_cmd_from_immediate_queue(
 			continue;
 
 		atomic_dec(&qr->cmd->immed_queue_count);
-		list_del(&qr->qr_list);
-		kmem_cache_free(lio_qr_cache, qr);
+		iscsit_put_queue_req(qr);
 	}
 	spin_unlock_bh(&conn->immed_queue_lock);
 
@@ -717,44 +860,47 @@ void iscsit_add_cmd_to_response_queue(
 	u8 state)
 {
 	struct iscsi_queue_req *qr;
+	bool wake;
 
-	qr = kmem_cache_zalloc(lio_qr_cache, GFP_ATOMIC);
+	spin_lock_bh(&conn->response_queue_lock);
+	qr = iscsit_get_queue_req(cmd, &cmd->i_rsp_qr);
 	if (!qr) {
-		pr_err("Unable to allocate memory for"
-			" struct iscsi_queue_req\n");
+		spin_unlock_bh(&conn->response_queue_lock);
 		return;
 	}
-	INIT_LIST_HEAD(&qr->qr_list);
-	qr->cmd = cmd;
 	qr->state = state;
 
-	spin_lock_bh(&conn->response_queue_lock);
+	wake = list_empty(&conn->response_queue_list);
 	list_add_tail(&qr->qr_list, &conn->response_queue_list);
 	atomic_inc(&cmd->response_queue_count);
 	spin_unlock_bh(&conn->response_queue_lock);
 
-	wake_up_interruptible(&conn->wq);
+	if (wake)
+		iscsi_conn_wake_tx(conn);
 }
 
-struct iscsi_queue_req *iscsit_get_cmd_from_response_queue_bh(struct iscsi_conn *conn)
+struct iscsi_cmd *iscsit_get_cmd_from_response_queue_bh(
+	struct iscsi_conn *conn,
+	u8 *state)
 {
 	struct iscsi_queue_req *qr;
+	struct iscsi_cmd *cmd;
 
 	spin_lock(&conn->response_queue_lock);
 	if (list_empty(&conn->response_queue_list)) {
 		spin_unlock(&conn->response_queue_lock);
 		return NULL;
 	}
+	qr = list_first_entry(&conn->response_queue_list,
+			struct iscsi_queue_req, qr_list);
 
-	list_for_each_entry(qr, &conn->response_queue_list, qr_list)
-		break;
-
-	list_del(&qr->qr_list);
-	if (qr->cmd)
-		atomic_dec(&qr->cmd->response_queue_count);
+	cmd = qr->cmd;
+	*state = qr->state;
+	atomic_dec(&cmd->response_queue_count);
+	iscsit_put_queue_req(qr);
 	spin_unlock(&conn->response_queue_lock);
 
-	return qr;
+	return cmd;
 }
 
 static void iscsit_remove_cmd_from_response_queue(
@@ -775,8 +921,7 @@ static void iscsit_remove_cmd_from_response_queue(
 			continue;
 
 		atomic_dec(&qr->cmd->response_queue_count);
-		list_del(&qr->qr_list);
-		kmem_cache_free(lio_qr_cache, qr);
+		iscsit_put_queue_req(qr);
 	}
 	spin_unlock_bh(&conn->response_queue_lock);
 
@@ -811,22 +956,16 @@ void iscsit_free_queue_reqs_for_conn(struct iscsi_conn *conn)
 
 	spin_lock_bh(&conn->immed_queue_lock);
 	list_for_each_entry_safe(qr, qr_tmp, &conn->immed_queue_list, qr_list) {
-		list_del(&qr->qr_list);
-		if (qr->cmd)
-			atomic_dec(&qr->cmd->immed_queue_count);
-
-		kmem_cache_free(lio_qr_cache, qr);
+		atomic_dec(&qr->cmd->immed_queue_count);
+		iscsit_put_queue_req(qr);
 	}
 	spin_unlock_bh(&conn->immed_queue_lock);
 
 	spin_lock_bh(&conn->response_queue_lock);
 	list_for_each_entry_safe(qr, qr_tmp, &conn->response_queue_list,
 			qr_list) {
-		list_del(&qr->qr_list);
-		if (qr->cmd)
-			atomic_dec(&qr->cmd->response_queue_count);
-
-		kmem_cache_free(lio_qr_cache, qr);
+		atomic_dec(&qr->cmd->response_queue_count);
+		iscsit_put_queue_req(qr);
 	}
 	spin_unlock_bh(&conn->response_queue_lock);
 }
@@ -1056,7 +1195,7 @@ static int iscsit_add_nopin(struct iscsi_conn *conn, int want_response)
 	spin_unlock_bh(&conn->sess->ttt_lock);
 
 	spin_lock_bh(&conn->cmd_lock);
-	list_add_tail(&cmd->i_list, &conn->conn_cmd_list);
+	iscsit_add_cmd_to_conn_list(cmd, conn);
 	spin_unlock_bh(&conn->cmd_lock);
 
 	if (want_response)
@@ -1292,25 +1431,37 @@ send_data:
 	return 0;
 }
 
+static int __tx_data(struct iscsi_conn *, struct kvec *, int, int, int);
+
+/*
+ *	Send a DataIN PDU built by iscsit_send_data_in() without IFMarker.
+ *	cmd->iov_data[] holds the header followed by optional padding and
+ *	DataDigest, the payload is sent directly from the se_cmd pages.
+ *	Every piece but the last one is sent with MSG_MORE so that the
+ *	PDU leaves in as few TCP segments as possible.
+ */
 int iscsit_fe_sendpage_sg(
 	struct iscsi_cmd *cmd,
 	struct iscsi_conn *conn)
 {
 	struct scatterlist *sg = cmd->first_data_sg;
-	struct kvec iov;
-	u32 tx_hdr_size, data_len;
+	struct kvec *iov = &cmd->iov_data[0];
+	u32 tx_hdr_size, data_len, trail_len = 0;
 	u32 offset = cmd->first_data_sg_off;
-	int tx_sent, iov_off;
+	int tx_sent, i, flags;
 
-send_hdr:
 	tx_hdr_size = ISCSI_HDR_LEN;
 	if (conn->conn_ops->HeaderDigest)
 		tx_hdr_size += ISCSI_CRC_LEN;
 
-	iov.iov_base = cmd->pdu;
-	iov.iov_len = tx_hdr_size;
+	for (i = 1; i < cmd->iov_data_count; i++)
+		trail_len += iov[i].iov_len;
+
+	data_len = cmd->tx_size - tx_hdr_size - trail_len;
 
-	tx_sent = tx_data(conn, &iov, 1, tx_hdr_size);
+send_hdr:
+	tx_sent = __tx_data(conn, iov, 1, tx_hdr_size,
+			    (data_len || trail_len) ? MSG_MORE : 0);
 	if (tx_hdr_size != tx_sent) {
 		if (tx_sent == -EAGAIN) {
 			pr_err("tx_data() returned -EAGAIN\n");
@@ -1318,30 +1469,18 @@ send_hdr:
 		}
 		return -1;
 	}
-
-	data_len = cmd->tx_size - tx_hdr_size - cmd->padding;
-	/*
-	 * Set iov_off used by padding and data digest tx_data() calls below
-	 * in order to determine proper offset into cmd->iov_data[]
-	 */
-	if (conn->conn_ops->DataDigest) {
-		data_len -= ISCSI_CRC_LEN;
-		if (cmd->padding)
-			iov_off = (cmd->iov_data_count - 2);
-		else
-			iov_off = (cmd->iov_data_count - 1);
-	} else {
-		iov_off = (cmd->iov_data_count - 1);
-	}
 	/*
 	 * Perform sendpage() for each page in the scatterlist
 	 */
 	while (data_len) {
 		u32 space = (sg->length - offset);
 		u32 sub_len = min_t(u32, data_len, space);
+
+		flags = (data_len != sub_len || trail_len) ? MSG_MORE : 0;
 send_pg:
 		tx_sent = conn->sock->ops->sendpage(conn->sock,
-					sg_page(sg), sg->offset + offset, sub_len, 0);
+					sg_page(sg), sg->offset + offset, sub_len,
+					flags);
 		if (tx_sent != sub_len) {
 			if (tx_sent == -EAGAIN) {
 				pr_err("tcp_sendpage() returned"
@@ -1358,36 +1497,53 @@ send_pg:
 		offset = 0;
 		sg = sg_next(sg);
 	}
-
-send_padding:
-	if (cmd->padding) {
-		struct kvec *iov_p = &cmd->iov_data[iov_off++];
-
-		tx_sent = tx_data(conn, iov_p, 1, cmd->padding);
-		if (cmd->padding != tx_sent) {
+	/*
+	 * Padding and DataDigest go out together in a single sendmsg()
+	 */
+send_trailer:
+	if (trail_len) {
+		tx_sent = tx_data(conn, &iov[1], cmd->iov_data_count - 1,
+				  trail_len);
+		if (trail_len != tx_sent) {
 			if (tx_sent == -EAGAIN) {
 				pr_err("tx_data() returned -EAGAIN\n");
-				goto send_padding;
+				goto send_trailer;
 			}
 			return -1;
 		}
 	}
 
-send_datacrc:
-	if (conn->conn_ops->DataDigest) {
-		struct kvec *iov_d = &cmd->iov_data[iov_off];
+	return 0;
+}
 
-		tx_sent = tx_data(conn, iov_d, 1, ISCSI_CRC_LEN);
-		if (ISCSI_CRC_LEN != tx_sent) {
-			if (tx_sent == -EAGAIN) {
-				pr_err("tx_data() returned -EAGAIN\n");
-				goto send_datacrc;
-			}
-			return -1;
-		}
-	}
+/*
+ *	Hold back partial frames while more than one PDU is pending on the
+ *	response queue, iscsit_tx_uncork() pushes them out in one go.
+ */
+void iscsit_tx_cork(struct iscsi_conn *conn)
+{
+	int opt = 1;
 
-	return 0;
+	if (conn->tx_corked || conn->network_transport != ISCSI_TCP)
+		return;
+
+	if (kernel_setsockopt(conn->sock, IPPROTO_TCP, TCP_CORK,
+			(char *)&opt, sizeof(opt)) < 0)
+		return;
+
+	conn->tx_corked = 1;
+}
+
+void iscsit_tx_uncork(struct iscsi_conn *conn)
+{
+	int opt = 0;
+
+	if (!conn->tx_corked)
+		return;
+
+	conn->tx_corked = 0;
+	kernel_setsockopt(conn->sock, IPPROTO_TCP, TCP_CORK,
+			(char *)&opt, sizeof(opt));
 }
 
 /*
@@ -1493,6 +1649,7 @@ static int iscsit_do_tx_data(
 	}
 
 	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_flags = count->msg_flags;
 
 	iov_p = count->iov;
 	iov_len = count->iov_count;
@@ -1533,11 +1690,12 @@ int rx_data(
 	return iscsit_do_rx_data(conn, &c);
 }
 
-int tx_data(
+static int __tx_data(
 	struct iscsi_conn *conn,
 	struct kvec *iov,
 	int iov_count,
-	int data)
+	int data,
+	int msg_flags)
 {
 	struct iscsi_data_count c;
 
@@ -1549,10 +1707,20 @@ int tx_data(
 	c.iov_count = iov_count;
 	c.data_length = data;
 	c.type = ISCSI_TX_DATA;
+	c.msg_flags = msg_flags;
 
 	return iscsit_do_tx_data(conn, &c);
 }
 
+int tx_data(
+	struct iscsi_conn *conn,
+	struct kvec *iov,
+	int iov_count,
+	int data)
+{
+	return __tx_data(conn, iov, iov_count, data, 0);
+}
+
 void iscsit_collect_login_stats(
 	struct iscsi_conn *conn,
 	u8 status_class,
@@ -17,6 +17,10 @@ extern struct iscsi_seq *iscsit_get_seq_holder_for_r2t(struct iscsi_cmd *);
 extern struct iscsi_r2t *iscsit_get_holder_for_r2tsn(struct iscsi_cmd *, u32);
 int iscsit_sequence_cmd(struct iscsi_conn *conn, struct iscsi_cmd *cmd, u32 cmdsn);
 extern int iscsit_check_unsolicited_dataout(struct iscsi_cmd *, unsigned char *);
+extern int iscsit_alloc_cmd_hash(struct iscsi_conn *);
+extern void iscsit_free_cmd_hash(struct iscsi_conn *);
+extern void iscsit_add_cmd_to_conn_list(struct iscsi_cmd *, struct iscsi_conn *);
+extern void iscsit_del_cmd_from_conn_list(struct iscsi_cmd *, struct iscsi_conn *);
 extern struct iscsi_cmd *iscsit_find_cmd_from_itt(struct iscsi_conn *, u32);
 extern struct iscsi_cmd *iscsit_find_cmd_from_itt_or_dump(struct iscsi_conn *,
 			u32, u32);
@@ -24,9 +28,9 @@ extern struct iscsi_cmd *iscsit_find_cmd_from_ttt(struct iscsi_conn *, u32);
 extern int iscsit_find_cmd_for_recovery(struct iscsi_session *, struct iscsi_cmd **,
 			struct iscsi_conn_recovery **, u32);
 extern void iscsit_add_cmd_to_immediate_queue(struct iscsi_cmd *, struct iscsi_conn *, u8);
-extern struct iscsi_queue_req *iscsit_get_cmd_from_immediate_queue_bh(struct iscsi_conn *);
+extern struct iscsi_cmd *iscsit_get_cmd_from_immediate_queue_bh(struct iscsi_conn *, u8 *);
 extern void iscsit_add_cmd_to_response_queue(struct iscsi_cmd *, struct iscsi_conn *, u8);
-extern struct iscsi_queue_req *iscsit_get_cmd_from_response_queue_bh(struct iscsi_conn *);
+extern struct iscsi_cmd *iscsit_get_cmd_from_response_queue_bh(struct iscsi_conn *, u8 *);
 extern void iscsit_remove_cmd_from_tx_queues(struct iscsi_cmd *, struct iscsi_conn *);
 extern bool iscsit_conn_all_queues_empty(struct iscsi_conn *);
 extern void iscsit_free_queue_reqs_for_conn(struct iscsi_conn *);
@@ -49,6 +53,8 @@ extern void iscsit_start_nopin_timer(struct iscsi_conn *);
 extern void iscsit_stop_nopin_timer(struct iscsi_conn *);
 extern int iscsit_send_tx_data(struct iscsi_cmd *, struct iscsi_conn *, int);
 extern int iscsit_fe_sendpage_sg(struct iscsi_cmd *, struct iscsi_conn *);
+extern void iscsit_tx_cork(struct iscsi_conn *);
+extern void iscsit_tx_uncork(struct iscsi_conn *);
 extern int iscsit_tx_login_rsp(struct iscsi_conn *, u8, u8);
 extern void iscsit_print_session_params(struct iscsi_session *);
 extern int iscsit_print_dev_to_proc(char *, char **, off_t, int);
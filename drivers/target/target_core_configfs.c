@@ -78,10 +78,34 @@ item_to_hba(struct config_item *item)
 /*
  * Attributes for /sys/kernel/config/target/
  */
+static struct configfs_attribute target_core_item_attr_version = {
+	.ca_owner	= THIS_MODULE,
+	.ca_name	= "version",
+	.ca_mode	= S_IRUGO,
+};
+
+static struct configfs_attribute target_core_item_attr_mem_pool = {
+	.ca_owner	= THIS_MODULE,
+	.ca_name	= "mem_pool",
+	.ca_mode	= S_IRUGO,
+};
+
 static ssize_t target_core_attr_show(struct config_item *item,
 				      struct configfs_attribute *attr,
 				      char *page)
 {
+	struct se_mem_pool_stats stats;
+
+	if (attr == &target_core_item_attr_mem_pool) {
+		transport_mem_pool_stats(&stats);
+		return sprintf(page, "Page hits: %llu  Page allocs: %llu"
+			"  High order allocs: %llu\nSGL hits: %llu"
+			"  SGL allocs: %llu  Pages cached: %llu\n",
+			stats.page_hits, stats.page_allocs,
+			stats.high_order_allocs, stats.sgl_hits,
+			stats.sgl_allocs, stats.pages_cached);
+	}
+
 	return sprintf(page, "Target Engine Core ConfigFS Infrastructure %s"
 		" on %s/%s on "UTS_RELEASE"\n", TARGET_CORE_CONFIGFS_VERSION,
 		utsname()->sysname, utsname()->machine);
@@ -91,12 +115,6 @@ static struct configfs_item_operations target_core_fabric_item_ops = {
 	.show_attribute = target_core_attr_show,
 };
 
-static struct configfs_attribute target_core_item_attr_version = {
-	.ca_owner	= THIS_MODULE,
-	.ca_name	= "version",
-	.ca_mode	= S_IRUGO,
-};
-
 static struct target_fabric_configfs *target_core_get_fabric(
 	const char *name)
 {
@@ -251,6 +269,7 @@ static struct configfs_group_operations target_core_fabric_group_ops = {
  */
 static struct configfs_attribute *target_core_fabric_item_attrs[] = {
 	&target_core_item_attr_version,
+	&target_core_item_attr_mem_pool,
 	NULL,
 };
 
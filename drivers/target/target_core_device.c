@@ -34,6 +34,8 @@
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/kthread.h>
+#include <linux/topology.h>
+#include <linux/radix-tree.h>
 #include <linux/in.h>
 #include <linux/export.h>
 #include <net/sock.h>
@@ -58,12 +60,81 @@ static struct se_subsystem_dev *lun0_su_dev;
 /* not static, needed by tpg.c */
 struct se_device *g_lun0_dev;
 
+static inline void core_io_stats_inc(struct se_io_stats __percpu *stats,
+				     struct se_cmd *se_cmd)
+{
+	this_cpu_inc(stats->num_cmds);
+	if (se_cmd->data_direction == DMA_TO_DEVICE)
+		this_cpu_add(stats->write_bytes, se_cmd->data_length);
+	else if (se_cmd->data_direction == DMA_FROM_DEVICE)
+		this_cpu_add(stats->read_bytes, se_cmd->data_length);
+}
+
+void core_io_stats_sum(struct se_io_stats __percpu *stats,
+		       struct se_io_stats *sum)
+{
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		struct se_io_stats *s = per_cpu_ptr(stats, cpu);
+
+		sum->num_cmds += s->num_cmds;
+		sum->read_bytes += s->read_bytes;
+		sum->write_bytes += s->write_bytes;
+	}
+}
+
+void core_port_stats_sum(struct se_port *port, struct scsi_port_stats *sum)
+{
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		struct scsi_port_stats *s = per_cpu_ptr(port->sep_stats, cpu);
+
+		sum->cmd_pdus += s->cmd_pdus;
+		sum->tx_data_octets += s->tx_data_octets;
+		sum->rx_data_octets += s->rx_data_octets;
+	}
+}
+
+/*
+ * Per second rates of the scsiLu counters, averaged over the interval
+ * between two refreshes.  A refresh happens on read once the last sample
+ * is at least one second old, so the I/O path never touches this.
+ */
+void core_dev_io_rates(struct se_device *dev, struct se_io_stats *rate)
+{
+	struct se_io_stats now;
+	u64 jiffies_now = get_jiffies_64();
+	u64 elapsed;
+
+	spin_lock_irq(&dev->stats_lock);
+	elapsed = jiffies_now - dev->rate_jiffies;
+	if (elapsed >= HZ) {
+		core_io_stats_sum(dev->io_stats, &now);
+		dev->rate.num_cmds = div64_u64((now.num_cmds -
+				dev->rate_snap.num_cmds) * HZ, elapsed);
+		dev->rate.read_bytes = div64_u64((now.read_bytes -
+				dev->rate_snap.read_bytes) * HZ, elapsed);
+		dev->rate.write_bytes = div64_u64((now.write_bytes -
+				dev->rate_snap.write_bytes) * HZ, elapsed);
+		dev->rate_snap = now;
+		dev->rate_jiffies = jiffies_now;
+	}
+	*rate = dev->rate;
+	spin_unlock_irq(&dev->stats_lock);
+}
+
 int transport_lookup_cmd_lun_cdb(struct se_cmd *se_cmd, u32 unpacked_lun, unsigned char *cdb)
 {
 	struct se_lun *se_lun = NULL;
 	struct se_session *se_sess = se_cmd->se_sess;
-	struct se_device *dev;
+	struct se_dev_entry *deve;
+	struct se_lun_cmd_list *cmd_list;
 	unsigned long flags;
+	u32 lun_flags = 0;
 
 	if (unpacked_lun >= TRANSPORT_MAX_LUNS_PER_TPG) {
 		se_cmd->scsi_sense_reason = TCM_NON_EXISTENT_LUN;
@@ -71,39 +142,44 @@ int transport_lookup_cmd_lun_cdb(struct se_cmd *se_cmd, u32 unpacked_lun, unsign
 		return -ENODEV;
 	}
 
-	spin_lock_irqsave(&se_sess->se_node_acl->device_list_lock, flags);
-	se_cmd->se_deve = se_sess->se_node_acl->device_list[unpacked_lun];
-	if (se_cmd->se_deve->lun_flags & TRANSPORT_LUNFLAGS_INITIATOR_ACCESS) {
-		struct se_dev_entry *deve = se_cmd->se_deve;
-
-		deve->total_cmds++;
-		deve->total_bytes += se_cmd->data_length;
+	/*
+	 * device_tree entries are only freed with the se_node_acl, and
+	 * deve->se_lun is published by core_update_device_list_for_node().
+	 * The RCU read side also covers adding se_cmd to the LUN, so
+	 * core_tpg_shutdown_lun() sees every command of a disabled LUN.
+	 */
+	rcu_read_lock();
+	deve = radix_tree_lookup(&se_sess->se_node_acl->device_tree,
+				 unpacked_lun);
+	se_cmd->se_deve = deve;
+	if (deve) {
+		se_lun = rcu_dereference(deve->se_lun);
+		smp_rmb();
+		lun_flags = ACCESS_ONCE(deve->lun_flags);
+	}
+	if (se_lun && (lun_flags & TRANSPORT_LUNFLAGS_INITIATOR_ACCESS)) {
+		core_io_stats_inc(deve->io_stats, se_cmd);
 
 		if ((se_cmd->data_direction == DMA_TO_DEVICE) &&
-		    (deve->lun_flags & TRANSPORT_LUNFLAGS_READ_ONLY)) {
+		    (lun_flags & TRANSPORT_LUNFLAGS_READ_ONLY)) {
 			se_cmd->scsi_sense_reason = TCM_WRITE_PROTECTED;
 			se_cmd->se_cmd_flags |= SCF_SCSI_CDB_EXCEPTION;
 			pr_err_ratelimited("TARGET_CORE[%s]: Detected WRITE_PROTECTED LUN"
 					   " Access for 0x%08x\n",
 					   se_cmd->se_tfo->get_fabric_name(),
 					   unpacked_lun);
-			spin_unlock_irqrestore(&se_sess->se_node_acl->device_list_lock, flags);
+			rcu_read_unlock();
 			return -EACCES;
 		}
 
-		if (se_cmd->data_direction == DMA_TO_DEVICE)
-			deve->write_bytes += se_cmd->data_length;
-		else if (se_cmd->data_direction == DMA_FROM_DEVICE)
-			deve->read_bytes += se_cmd->data_length;
-
-		deve->deve_cmds++;
+		atomic_inc(&deve->deve_cmds);
 
-		se_lun = deve->se_lun;
-		se_cmd->se_lun = deve->se_lun;
+		se_cmd->se_lun = se_lun;
 		se_cmd->pr_res_key = deve->pr_res_key;
 		se_cmd->orig_fe_lun = unpacked_lun;
 		se_cmd->se_cmd_flags |= SCF_SE_LUN_CMD;
-	}
+	} else
+		se_lun = NULL;
 
 	if (!se_lun) {
 		/*
@@ -118,7 +194,7 @@ int transport_lookup_cmd_lun_cdb(struct se_cmd *se_cmd, u32 unpacked_lun, unsign
 			pr_err_ratelimited("No LUN 0x%08x for initiator %s / SCSI op %02xh\n",
 					   unpacked_lun, se_sess->se_node_acl->initiatorname,
 					   cdb[0]);
-			spin_unlock_irqrestore(&se_sess->se_node_acl->device_list_lock, flags);
+			rcu_read_unlock();
 			return -ENODEV;
 		}
 		/*
@@ -128,7 +204,7 @@ int transport_lookup_cmd_lun_cdb(struct se_cmd *se_cmd, u32 unpacked_lun, unsign
 		    (se_cmd->data_direction != DMA_NONE)) {
 			se_cmd->scsi_sense_reason = TCM_WRITE_PROTECTED;
 			se_cmd->se_cmd_flags |= SCF_SCSI_CDB_EXCEPTION;
-			spin_unlock_irqrestore(&se_sess->se_node_acl->device_list_lock, flags);
+			rcu_read_unlock();
 			return -EACCES;
 		}
 
@@ -138,15 +214,18 @@ int transport_lookup_cmd_lun_cdb(struct se_cmd *se_cmd, u32 unpacked_lun, unsign
 		se_cmd->se_cmd_flags |= SCF_SE_LUN_CMD;
 		
 		// Make sure we increment the command count for this lun.
-		se_sess->se_node_acl->device_list[0]->deve_cmds++;
+		// The MappedLUN=0 entry always exists, see
+		// core_create_device_list_for_node().
+		deve = radix_tree_lookup(&se_sess->se_node_acl->device_tree, 0);
+		atomic_inc(&deve->deve_cmds);
 	}
-	spin_unlock_irqrestore(&se_sess->se_node_acl->device_list_lock, flags);
 
 	/*
 	 * Determine if the struct se_lun is online.
 	 * FIXME: Check for LUN_RESET + UNIT Attention
 	 */
 	if (se_dev_check_online(se_lun->lun_se_dev) != 0) {
+		rcu_read_unlock();
 		se_cmd->scsi_sense_reason = TCM_NON_EXISTENT_LUN;
 		se_cmd->se_cmd_flags |= SCF_SCSI_CDB_EXCEPTION;
 		return -ENODEV;
@@ -155,19 +234,14 @@ int transport_lookup_cmd_lun_cdb(struct se_cmd *se_cmd, u32 unpacked_lun, unsign
 	/* Directly associate cmd with se_dev */
 	se_cmd->se_dev = se_lun->lun_se_dev;
 
-	/* TODO: get rid of this and use atomics for stats */
-	dev = se_lun->lun_se_dev;
-	spin_lock_irqsave(&dev->stats_lock, flags);
-	dev->num_cmds++;
-	if (se_cmd->data_direction == DMA_TO_DEVICE)
-		dev->write_bytes += se_cmd->data_length;
-	else if (se_cmd->data_direction == DMA_FROM_DEVICE)
-		dev->read_bytes += se_cmd->data_length;
-	spin_unlock_irqrestore(&dev->stats_lock, flags);
+	core_io_stats_inc(se_lun->lun_se_dev->io_stats, se_cmd);
 
-	spin_lock_irqsave(&se_lun->lun_cmd_lock, flags);
-	list_add_tail(&se_cmd->se_lun_node, &se_lun->lun_cmd_list);
-	spin_unlock_irqrestore(&se_lun->lun_cmd_lock, flags);
+	cmd_list = per_cpu_ptr(se_lun->lun_cmd_lists, raw_smp_processor_id());
+	spin_lock_irqsave(&cmd_list->lock, flags);
+	se_cmd->se_lun_list = cmd_list;
+	list_add_tail(&se_cmd->se_lun_node, &cmd_list->list);
+	spin_unlock_irqrestore(&cmd_list->lock, flags);
+	rcu_read_unlock();
 
 	return 0;
 }
@@ -194,10 +268,10 @@ int transport_lookup_tmr_lun(struct se_cmd *se_cmd, u32 unpacked_lun)
 	}
 
 	spin_lock_irqsave(&se_sess->se_node_acl->device_list_lock, flags);
-	se_cmd->se_deve = se_sess->se_node_acl->device_list[unpacked_lun];
+	se_cmd->se_deve = core_get_se_deve(se_sess->se_node_acl, unpacked_lun);
 	deve = se_cmd->se_deve;
 
-	if (deve->lun_flags & TRANSPORT_LUNFLAGS_INITIATOR_ACCESS) {
+	if (deve && (deve->lun_flags & TRANSPORT_LUNFLAGS_INITIATOR_ACCESS)) {
 		se_tmr->tmr_lun = deve->se_lun;
 		se_cmd->se_lun = deve->se_lun;
 		se_lun = deve->se_lun;
@@ -231,21 +305,31 @@ int transport_lookup_tmr_lun(struct se_cmd *se_cmd, u32 unpacked_lun)
 }
 EXPORT_SYMBOL(transport_lookup_tmr_lun);
 
+/*
+ * Pick the CPU that completion work for a command received on this CPU is
+ * queued to: the next online core in the same package, skipping SMT
+ * siblings, so it shares the last level cache with the receiving CPU
+ * without competing with it for the same core.  Falls back to the current
+ * CPU when the package has no other core.
+ */
 unsigned int transport_buddy_cpu(void)
 {
-	unsigned int cpu = smp_processor_id();
+	unsigned int cpu = smp_processor_id(), buddy = cpu;
+	const struct cpumask *pkg = topology_core_cpumask(cpu);
 
-	if (nr_cpu_ids != 24 && nr_cpu_ids != 32)
+	if (!cpumask_test_cpu(cpu, pkg))
 		return cpu;
-	switch (cpu) {
-		case  3: return  5;
-		case  5: return  3;
-		case  4: return  6;
-		case  6: return  4;
-		case  9: return 11;
-		case 11: return  9;
-	}
-	return cpu; /* shouldn't ever happen */
+
+	for (;;) {
+		buddy = cpumask_next(buddy, pkg);
+		if (buddy >= nr_cpu_ids)
+			buddy = cpumask_first(pkg);
+		if (buddy == cpu || buddy >= nr_cpu_ids)
+			return cpu;
+		if (cpu_online(buddy) &&
+		    !cpumask_test_cpu(buddy, topology_thread_cpumask(cpu)))
+			return buddy;
+	}
 }
 EXPORT_SYMBOL(transport_buddy_cpu);
 
@@ -265,11 +349,8 @@ struct se_dev_entry *core_get_se_deve_from_rtpi(
 	u32 i;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	for (i = 0; i < TRANSPORT_MAX_LUNS_PER_TPG; i++) {
-		deve = nacl->device_list[i];
-
-		if (!(deve->lun_flags & TRANSPORT_LUNFLAGS_INITIATOR_ACCESS))
-			continue;
+	for_each_set_bit(i, nacl->device_map, TRANSPORT_MAX_LUNS_PER_TPG) {
+		deve = core_get_se_deve(nacl, i);
 
 		lun = deve->se_lun;
 		if (!lun) {
@@ -299,26 +380,80 @@ struct se_dev_entry *core_get_se_deve_from_rtpi(
 	return NULL;
 }
 
-int core_free_device_list_for_node(
+/*
+ * struct se_dev_entry's are allocated by core_alloc_se_deve() the first time
+ * a mapped_lun is used and stay in nacl->device_tree until the se_node_acl
+ * is released, so the returned pointer remains valid without holding any
+ * lock.  nacl->device_map tracks which of them currently have
+ * TRANSPORT_LUNFLAGS_INITIATOR_ACCESS.
+ */
+struct se_dev_entry *core_get_se_deve(
 	struct se_node_acl *nacl,
-	struct se_portal_group *tpg)
+	u32 mapped_lun)
 {
 	struct se_dev_entry *deve;
-	struct se_lun *lun;
-	u32 i;
 
-	if (!nacl->device_list)
-		return 0;
+	rcu_read_lock();
+	deve = radix_tree_lookup(&nacl->device_tree, mapped_lun);
+	rcu_read_unlock();
+
+	return deve;
+}
+
+struct se_dev_entry *core_alloc_se_deve(
+	struct se_node_acl *nacl,
+	u32 mapped_lun)
+{
+	struct se_dev_entry *deve, *deve_tmp;
+	int ret = 0;
+
+	deve = core_get_se_deve(nacl, mapped_lun);
+	if (deve)
+		return deve;
+
+	deve = kzalloc(sizeof(struct se_dev_entry), GFP_KERNEL);
+	if (!deve) {
+		pr_err("Unable to allocate memory for struct se_dev_entry\n");
+		return NULL;
+	}
+	deve->mapped_lun = mapped_lun;
+	atomic_set(&deve->ua_count, 0);
+	atomic_set(&deve->pr_ref_count, 0);
+	spin_lock_init(&deve->ua_lock);
+	INIT_LIST_HEAD(&deve->alua_port_list);
+	INIT_LIST_HEAD(&deve->ua_list);
 
+	if (radix_tree_preload(GFP_KERNEL) < 0) {
+		kfree(deve);
+		return NULL;
+	}
 	spin_lock_irq(&nacl->device_list_lock);
-	for (i = 0; i < TRANSPORT_MAX_LUNS_PER_TPG; i++) {
-		deve = nacl->device_list[i];
+	deve_tmp = radix_tree_lookup(&nacl->device_tree, mapped_lun);
+	if (!deve_tmp)
+		ret = radix_tree_insert(&nacl->device_tree, mapped_lun, deve);
+	spin_unlock_irq(&nacl->device_list_lock);
+	radix_tree_preload_end();
 
-		/* A command is still in flight! */
-		WARN(deve->deve_cmds, "device_list[%u] free while %u cmds still in flight\n", i, deve->deve_cmds);
+	if (deve_tmp || ret < 0) {
+		kfree(deve);
+		return deve_tmp;
+	}
 
-		if (!(deve->lun_flags & TRANSPORT_LUNFLAGS_INITIATOR_ACCESS))
-			continue;
+	return deve;
+}
+
+int core_free_device_list_for_node(
+	struct se_node_acl *nacl,
+	struct se_portal_group *tpg)
+{
+	struct se_dev_entry *deve, *deves[16];
+	struct se_lun *lun;
+	unsigned int i, nr;
+	u32 mapped_lun = 0;
+
+	spin_lock_irq(&nacl->device_list_lock);
+	for_each_set_bit(i, nacl->device_map, TRANSPORT_MAX_LUNS_PER_TPG) {
+		deve = core_get_se_deve(nacl, i);
 
 		if (!deve->se_lun) {
 			pr_err("%s device entries device pointer is"
@@ -335,8 +470,22 @@ int core_free_device_list_for_node(
 	}
 	spin_unlock_irq(&nacl->device_list_lock);
 
-	array_free(nacl->device_list, TRANSPORT_MAX_LUNS_PER_TPG);
-	nacl->device_list = NULL;
+	while ((nr = radix_tree_gang_lookup(&nacl->device_tree,
+			(void **)deves, mapped_lun, ARRAY_SIZE(deves)))) {
+		for (i = 0; i < nr; i++) {
+			deve = deves[i];
+
+			/* A command is still in flight! */
+			WARN(atomic_read(&deve->deve_cmds),
+			     "device_tree[%u] free while %u cmds still in flight\n",
+			     deve->mapped_lun, atomic_read(&deve->deve_cmds));
+
+			mapped_lun = deve->mapped_lun + 1;
+			radix_tree_delete(&nacl->device_tree, deve->mapped_lun);
+			free_percpu(deve->io_stats);
+			kfree(deve);
+		}
+	}
 
 	return 0;
 }
@@ -344,12 +493,9 @@ int core_free_device_list_for_node(
 void core_dec_lacl_count(struct se_node_acl *se_nacl, struct se_cmd *se_cmd)
 {
 	struct se_dev_entry *deve;
-	unsigned long flags;
 
-	spin_lock_irqsave(&se_nacl->device_list_lock, flags);
-	deve = se_nacl->device_list[se_cmd->orig_fe_lun];
-	deve->deve_cmds--;
-	spin_unlock_irqrestore(&se_nacl->device_list_lock, flags);
+	deve = core_get_se_deve(se_nacl, se_cmd->orig_fe_lun);
+	atomic_dec(&deve->deve_cmds);
 }
 
 void core_update_device_list_access(
@@ -358,16 +504,22 @@ void core_update_device_list_access(
 	struct se_node_acl *nacl)
 {
 	struct se_dev_entry *deve;
+	u32 lun_flags;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[mapped_lun];
-	if (lun_access & TRANSPORT_LUNFLAGS_READ_WRITE) {
-		deve->lun_flags &= ~TRANSPORT_LUNFLAGS_READ_ONLY;
-		deve->lun_flags |= TRANSPORT_LUNFLAGS_READ_WRITE;
-	} else {
-		deve->lun_flags &= ~TRANSPORT_LUNFLAGS_READ_WRITE;
-		deve->lun_flags |= TRANSPORT_LUNFLAGS_READ_ONLY;
+	deve = core_get_se_deve(nacl, mapped_lun);
+	if (!deve) {
+		spin_unlock_irq(&nacl->device_list_lock);
+		return;
 	}
+	lun_flags = deve->lun_flags & ~(TRANSPORT_LUNFLAGS_READ_ONLY |
+					TRANSPORT_LUNFLAGS_READ_WRITE);
+	if (lun_access & TRANSPORT_LUNFLAGS_READ_WRITE)
+		lun_flags |= TRANSPORT_LUNFLAGS_READ_WRITE;
+	else
+		lun_flags |= TRANSPORT_LUNFLAGS_READ_ONLY;
+	/* Single store for lockless transport_lookup_cmd_lun_cdb() */
+	deve->lun_flags = lun_flags;
 	spin_unlock_irq(&nacl->device_list_lock);
 }
 
@@ -385,8 +537,16 @@ int core_update_device_list_for_node(
 	int enable)
 {
 	struct se_port *port = lun->lun_sep;
-	struct se_dev_entry *deve = nacl->device_list[mapped_lun];
+	struct se_dev_entry *deve;
+	u32 lun_flags;
 	int trans = 0;
+
+	if (enable)
+		deve = core_alloc_se_deve(nacl, mapped_lun);
+	else
+		deve = core_get_se_deve(nacl, mapped_lun);
+	if (!deve)
+		return (enable) ? -ENOMEM : 0;
 	/*
 	 * If the MappedLUN entry is being disabled, the entry in
 	 * port->sep_alua_list must be removed now before clearing the
@@ -405,6 +565,13 @@ int core_update_device_list_for_node(
 		spin_lock_bh(&port->sep_alua_lock);
 		list_del(&deve->alua_port_list);
 		spin_unlock_bh(&port->sep_alua_lock);
+	} else if (!deve->io_stats) {
+		deve->io_stats = alloc_percpu(struct se_io_stats);
+		if (!deve->io_stats) {
+			pr_err("Unable to allocate struct se_dev_entry"
+				"->io_stats\n");
+			return -ENOMEM;
+		}
 	}
 
 	spin_lock_irq(&nacl->device_list_lock);
@@ -432,26 +599,31 @@ int core_update_device_list_for_node(
 			deve->se_lun_acl = lun_acl;
 			trans = 1;
 		} else {
-			deve->se_lun = lun;
 			deve->se_lun_acl = lun_acl;
 			deve->mapped_lun = mapped_lun;
-			deve->lun_flags |= TRANSPORT_LUNFLAGS_INITIATOR_ACCESS;
 		}
 
-		if (lun_access & TRANSPORT_LUNFLAGS_READ_WRITE) {
-			deve->lun_flags &= ~TRANSPORT_LUNFLAGS_READ_ONLY;
-			deve->lun_flags |= TRANSPORT_LUNFLAGS_READ_WRITE;
-		} else {
-			deve->lun_flags &= ~TRANSPORT_LUNFLAGS_READ_WRITE;
-			deve->lun_flags |= TRANSPORT_LUNFLAGS_READ_ONLY;
-		}
+		lun_flags = deve->lun_flags & ~(TRANSPORT_LUNFLAGS_READ_ONLY |
+						TRANSPORT_LUNFLAGS_READ_WRITE);
+		if (lun_access & TRANSPORT_LUNFLAGS_READ_WRITE)
+			lun_flags |= TRANSPORT_LUNFLAGS_READ_WRITE;
+		else
+			lun_flags |= TRANSPORT_LUNFLAGS_READ_ONLY;
 
 		if (trans) {
+			deve->lun_flags = lun_flags;
 			spin_unlock_irq(&nacl->device_list_lock);
 			return 0;
 		}
 		deve->creation_time = get_jiffies_64();
 		deve->attach_count++;
+		/*
+		 * Flags first, transport_lookup_cmd_lun_cdb() only looks at
+		 * them once it has seen deve->se_lun.
+		 */
+		deve->lun_flags = lun_flags | TRANSPORT_LUNFLAGS_INITIATOR_ACCESS;
+		rcu_assign_pointer(deve->se_lun, lun);
+		set_bit(mapped_lun, nacl->device_map);
 		spin_unlock_irq(&nacl->device_list_lock);
 
 		spin_lock_bh(&port->sep_alua_lock);
@@ -472,7 +644,8 @@ int core_update_device_list_for_node(
 	 * Disable struct se_dev_entry LUN ACL mapping
 	 */
 	core_scsi3_ua_release_all(deve);
-	deve->se_lun = NULL;
+	clear_bit(mapped_lun, nacl->device_map);
+	rcu_assign_pointer(deve->se_lun, NULL);
 	deve->se_lun_acl = NULL;
 	deve->lun_flags = 0;
 	deve->creation_time = 0;
@@ -498,8 +671,9 @@ void core_clear_lun_from_tpg(struct se_lun *lun, struct se_portal_group *tpg)
 		spin_unlock_irq(&tpg->acl_node_lock);
 
 		spin_lock_irq(&nacl->device_list_lock);
-		for (i = 0; i < TRANSPORT_MAX_LUNS_PER_TPG; i++) {
-			deve = nacl->device_list[i];
+		for_each_set_bit(i, nacl->device_map,
+				TRANSPORT_MAX_LUNS_PER_TPG) {
+			deve = core_get_se_deve(nacl, i);
 			if (lun != deve->se_lun)
 				continue;
 			spin_unlock_irq(&nacl->device_list_lock);
@@ -528,6 +702,12 @@ static struct se_port *core_alloc_port(struct se_device *dev,
 		pr_err("Unable to allocate struct se_port\n");
 		return ERR_PTR(-ENOMEM);
 	}
+	port->sep_stats = alloc_percpu(struct scsi_port_stats);
+	if (!port->sep_stats) {
+		pr_err("Unable to allocate struct se_port->sep_stats\n");
+		kfree(port);
+		return ERR_PTR(-ENOMEM);
+	}
 	INIT_LIST_HEAD(&port->sep_alua_list);
 	INIT_LIST_HEAD(&port->sep_list);
 	atomic_set(&port->sep_tg_pt_secondary_offline, 0);
@@ -539,6 +719,8 @@ static struct se_port *core_alloc_port(struct se_device *dev,
 		pr_warn("Reached dev->dev_port_count =="
 				" 0x0000ffff\n");
 		spin_unlock(&dev->se_port_lock);
+		free_percpu(port->sep_stats);
+		kfree(port);
 		return ERR_PTR(-ENOSPC);
 	}
 again:
@@ -635,6 +817,7 @@ static void core_release_port(struct se_device *dev, struct se_port *port)
 
 	list_del(&port->sep_list);
 	dev->dev_port_count--;
+	free_percpu(port->sep_stats);
 	kfree(port);
 }
 
@@ -704,10 +887,9 @@ int target_report_luns(struct se_task *se_task)
 	}
 
 	spin_lock_irq(&se_sess->se_node_acl->device_list_lock);
-	for (i = 0; i < TRANSPORT_MAX_LUNS_PER_TPG; i++) {
-		deve = se_sess->se_node_acl->device_list[i];
-		if (!(deve->lun_flags & TRANSPORT_LUNFLAGS_INITIATOR_ACCESS))
-			continue;
+	for_each_set_bit(i, se_sess->se_node_acl->device_map,
+			TRANSPORT_MAX_LUNS_PER_TPG) {
+		deve = core_get_se_deve(se_sess->se_node_acl, i);
 		/*
 		 * We determine the correct LUN LIST LENGTH even once we
 		 * have reached the initial allocation length.
@@ -776,6 +958,8 @@ void se_release_device_for_hba(struct se_device *dev)
 	core_scsi3_free_all_registrations(dev);
 	se_release_vpd_for_dev(dev);
 
+	transport_free_exec_queues(dev);
+	free_percpu(dev->io_stats);
 	kfree(dev);
 }
 
@@ -108,8 +108,8 @@ static int target_fabric_mappedlun_link(
 	 * tpg_1/attrib/demo_mode_write_protect=1
 	 */
 	spin_lock_irq(&lacl->se_lun_nacl->device_list_lock);
-	deve = lacl->se_lun_nacl->device_list[lacl->mapped_lun];
-	if (deve->lun_flags & TRANSPORT_LUNFLAGS_INITIATOR_ACCESS)
+	deve = core_get_se_deve(lacl->se_lun_nacl, lacl->mapped_lun);
+	if (deve && (deve->lun_flags & TRANSPORT_LUNFLAGS_INITIATOR_ACCESS))
 		lun_access = deve->lun_flags;
 	else
 		lun_access =
@@ -137,12 +137,12 @@ static int target_fabric_mappedlun_unlink(
 	struct se_lun_acl *lacl = container_of(to_config_group(lun_acl_ci),
 			struct se_lun_acl, se_lun_group);
 	struct se_node_acl *nacl = lacl->se_lun_nacl;
-	struct se_dev_entry *deve = nacl->device_list[lacl->mapped_lun];
+	struct se_dev_entry *deve = core_get_se_deve(nacl, lacl->mapped_lun);
 	struct se_portal_group *se_tpg;
 	/*
 	 * Determine if the underlying MappedLUN has already been released..
 	 */
-	if (!deve->se_lun)
+	if (!deve || !deve->se_lun)
 		return 0;
 
 	lun = container_of(to_config_group(lun_ci), struct se_lun, lun_group);
@@ -168,9 +168,9 @@ static ssize_t target_fabric_mappedlun_show_write_protect(
 	ssize_t len;
 
 	spin_lock_irq(&se_nacl->device_list_lock);
-	deve = se_nacl->device_list[lacl->mapped_lun];
+	deve = core_get_se_deve(se_nacl, lacl->mapped_lun);
 	len = sprintf(page, "%d\n",
-			(deve->lun_flags & TRANSPORT_LUNFLAGS_READ_ONLY) ?
+			(deve && (deve->lun_flags & TRANSPORT_LUNFLAGS_READ_ONLY)) ?
 			1 : 0);
 	spin_unlock_irq(&se_nacl->device_list_lock);
 
@@ -33,6 +33,8 @@
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/workqueue.h>
 #include <scsi/scsi.h>
 #include <scsi/scsi_host.h>
 
@@ -94,6 +96,10 @@ static void *fd_allocate_virtdevice(struct se_hba *hba, const char *name)
 	}
 
 	fd_dev->fd_host = fd_host;
+	spin_lock_init(&fd_dev->fd_ra_lock);
+	mutex_init(&fd_dev->fd_sync_mutex);
+	spin_lock_init(&fd_dev->fd_sync_lock);
+	fd_dev->fd_sync_start = LLONG_MAX;
 
 	pr_debug("FILEIO: Allocated fd_dev for %p\n", name);
 
@@ -206,6 +212,27 @@ static struct se_device *fd_create_virtdevice(
 		fd_dev->fd_block_size = FD_BLOCKSIZE;
 	}
 
+	if (fd_dev->fbd_flags & FDBD_USE_ASYNC_IO) {
+		if (S_ISBLK(inode->i_mode)) {
+			/*
+			 * READs and WRITEs are submitted as bios straight from
+			 * the se_task pages, so write back and drop anything
+			 * that is still sitting in the page cache.
+			 */
+			filemap_write_and_wait(file->f_mapping);
+			invalidate_inode_pages2(file->f_mapping);
+			fd_dev->fd_bd = inode->i_bdev;
+		} else {
+			fd_dev->fd_wq = alloc_workqueue("fd_aio", WQ_MEM_RECLAIM,
+						FD_MAX_DEVICE_QUEUE_DEPTH);
+			if (!fd_dev->fd_wq) {
+				pr_err("FILEIO: Unable to allocate fd_wq\n");
+				ret = -ENOMEM;
+				goto fail;
+			}
+		}
+	}
+
 	dev_limits.hw_queue_depth = FD_MAX_DEVICE_QUEUE_DEPTH;
 	dev_limits.queue_depth = FD_DEVICE_QUEUE_DEPTH;
 
@@ -225,6 +252,11 @@ static struct se_device *fd_create_virtdevice(
 	putname(dev_p);
 	return dev;
 fail:
+	if (fd_dev->fd_wq) {
+		destroy_workqueue(fd_dev->fd_wq);
+		fd_dev->fd_wq = NULL;
+	}
+	fd_dev->fd_bd = NULL;
 	if (fd_dev->fd_file) {
 		filp_close(fd_dev->fd_file, NULL);
 		fd_dev->fd_file = NULL;
@@ -241,6 +273,9 @@ static void fd_free_device(void *p)
 {
 	struct fd_dev *fd_dev = p;
 
+	if (fd_dev->fd_wq)
+		destroy_workqueue(fd_dev->fd_wq);
+
 	if (fd_dev->fd_file) {
 		filp_close(fd_dev->fd_file, NULL);
 		fd_dev->fd_file = NULL;
@@ -269,36 +304,128 @@ fd_alloc_task(unsigned char *cdb)
 	return &fd_req->fd_task;
 }
 
+/*
+ * Map the se_task scatterlist into the iovec embedded in struct fd_request,
+ * only falling back to an allocation for larger task_sg_nents.
+ */
+static struct iovec *fd_get_iovec(struct fd_request *req)
+{
+	struct se_task *task = &req->fd_task;
+	struct scatterlist *sg;
+	struct iovec *iov = req->fd_iov;
+	int i;
+
+	if (task->task_sg_nents > FD_INLINE_IOVECS) {
+		iov = kmalloc(sizeof(struct iovec) * task->task_sg_nents,
+				GFP_KERNEL);
+		if (!iov) {
+			pr_err("Unable to allocate fd_request iov[]\n");
+			return NULL;
+		}
+	}
+
+	for_each_sg(task->task_sg, sg, task->task_sg_nents, i) {
+		iov[i].iov_len = sg->length;
+		iov[i].iov_base = sg_virt(sg);
+	}
+
+	return iov;
+}
+
+static void fd_put_iovec(struct fd_request *req, struct iovec *iov)
+{
+	if (iov != req->fd_iov)
+		kfree(iov);
+}
+
+/*
+ * Called before a READ at pos, issues read-ahead past the end of the READ
+ * when it continues a stream from the same initiator.  Each stream keeps a
+ * private struct file_ra_state, so the window keeps growing even when
+ * several initiators are reading through the shared struct file.
+ */
+static void fd_readahead(struct fd_dev *fd_dev, struct se_task *task,
+			 loff_t pos)
+{
+	struct se_session *sess = task->task_se_cmd->se_sess;
+	struct file *file = fd_dev->fd_file;
+	struct fd_ra_stream *s, *lru = NULL;
+	struct file_ra_state ra;
+	loff_t end = pos + task->task_size;
+	pgoff_t index = pos >> PAGE_CACHE_SHIFT;
+	pgoff_t end_index = (end - 1) >> PAGE_CACHE_SHIFT;
+	unsigned long nr_pages = end_index - index + 1;
+	int i;
+
+	spin_lock(&fd_dev->fd_ra_lock);
+	for (i = 0; i < FD_RA_STREAMS; i++) {
+		s = &fd_dev->fd_ra_streams[i];
+		if (s->ra_sess == sess && s->ra_next_pos == pos)
+			break;
+		if (!lru || time_before(s->ra_last_used, lru->ra_last_used))
+			lru = s;
+	}
+	if (i == FD_RA_STREAMS) {
+		/*
+		 * Not a continuation, start tracking a new stream in place
+		 * of the least recently used one.
+		 */
+		lru->ra_sess = sess;
+		lru->ra_next_pos = end;
+		lru->ra_last_used = jiffies;
+		file_ra_state_init(&lru->ra_state, file->f_mapping);
+		spin_unlock(&fd_dev->fd_ra_lock);
+		return;
+	}
+	s->ra_next_pos = end;
+	s->ra_last_used = jiffies;
+	ra = s->ra_state;
+	spin_unlock(&fd_dev->fd_ra_lock);
+	/*
+	 * Open the window at the second READ of a stream, then push it
+	 * forward each time a READ reaches its asynchronous part.
+	 */
+	if (!ra.size) {
+		ra.prev_pos = pos - 1;
+		page_cache_sync_readahead(file->f_mapping, &ra, file,
+					  index, nr_pages);
+	} else if (end_index >= ra.start + ra.size - ra.async_size) {
+		page_cache_sync_readahead(file->f_mapping, &ra, file,
+				ra.start + ra.size - ra.async_size, nr_pages);
+	} else
+		return;
+
+	spin_lock(&fd_dev->fd_ra_lock);
+	fd_dev->fd_ra_count++;
+	if (s->ra_sess == sess && s->ra_next_pos == end)
+		s->ra_state = ra;
+	spin_unlock(&fd_dev->fd_ra_lock);
+}
+
 static int fd_do_readv(struct se_task *task)
 {
 	struct fd_request *req = FILE_REQ(task);
 	struct se_device *se_dev = req->fd_task.task_se_cmd->se_dev;
 	struct fd_dev *dev = se_dev->dev_ptr;
 	struct file *fd = dev->fd_file;
-	struct scatterlist *sg = task->task_sg;
 	struct iovec *iov;
 	mm_segment_t old_fs;
 	loff_t pos = (task->task_lba *
 		      se_dev->se_sub_dev->se_dev_attrib.block_size);
-	int ret = 0, i;
+	int ret = 0;
 
-	iov = kzalloc(sizeof(struct iovec) * task->task_sg_nents, GFP_KERNEL);
-	if (!iov) {
-		pr_err("Unable to allocate fd_do_readv iov[]\n");
+	iov = fd_get_iovec(req);
+	if (!iov)
 		return -ENOMEM;
-	}
 
-	for_each_sg(task->task_sg, sg, task->task_sg_nents, i) {
-		iov[i].iov_len = sg->length;
-		iov[i].iov_base = sg_virt(sg);
-	}
+	fd_readahead(dev, task, pos);
 
 	old_fs = get_fs();
 	set_fs(get_ds());
 	ret = vfs_readv(fd, &iov[0], task->task_sg_nents, &pos);
 	set_fs(old_fs);
 
-	kfree(iov);
+	fd_put_iovec(req, iov);
 	/*
 	 * Return zeros and GOOD status even if the READ did not return
 	 * the expected virt_size for struct file w/o a backing struct
@@ -328,30 +455,22 @@ static int fd_do_writev(struct se_task *task)
 	struct se_device *se_dev = req->fd_task.task_se_cmd->se_dev;
 	struct fd_dev *dev = se_dev->dev_ptr;
 	struct file *fd = dev->fd_file;
-	struct scatterlist *sg = task->task_sg;
 	struct iovec *iov;
 	mm_segment_t old_fs;
 	loff_t pos = (task->task_lba *
 		      se_dev->se_sub_dev->se_dev_attrib.block_size);
-	int ret, i = 0;
+	int ret;
 
-	iov = kzalloc(sizeof(struct iovec) * task->task_sg_nents, GFP_KERNEL);
-	if (!iov) {
-		pr_err("Unable to allocate fd_do_writev iov[]\n");
+	iov = fd_get_iovec(req);
+	if (!iov)
 		return -ENOMEM;
-	}
-
-	for_each_sg(task->task_sg, sg, task->task_sg_nents, i) {
-		iov[i].iov_len = sg->length;
-		iov[i].iov_base = sg_virt(sg);
-	}
 
 	old_fs = get_fs();
 	set_fs(get_ds());
 	ret = vfs_writev(fd, &iov[0], task->task_sg_nents, &pos);
 	set_fs(old_fs);
 
-	kfree(iov);
+	fd_put_iovec(req, iov);
 
 	if (ret < 0 || ret != task->task_size) {
 		pr_err("vfs_writev() returned %d\n", ret);
@@ -361,6 +480,54 @@ static int fd_do_writev(struct se_task *task)
 	return 1;
 }
 
+/*
+ * Flush [start, end] of the backing file.  Callers that arrive while a
+ * flush is running merge their ranges and wait on fd_sync_mutex, and the
+ * first of them to get it issues one vfs_fsync_range() for all of them.
+ * Every caller whose data was written before it called in is covered by
+ * the first flush that starts after its range was merged.
+ */
+static int fd_sync_range(struct fd_dev *fd_dev, loff_t start, loff_t end)
+{
+	u64 seq;
+	int ret;
+
+	spin_lock(&fd_dev->fd_sync_lock);
+	seq = ++fd_dev->fd_sync_seq;
+	fd_dev->fd_sync_requests++;
+	if (start < fd_dev->fd_sync_start)
+		fd_dev->fd_sync_start = start;
+	if (end > fd_dev->fd_sync_end)
+		fd_dev->fd_sync_end = end;
+	spin_unlock(&fd_dev->fd_sync_lock);
+
+	mutex_lock(&fd_dev->fd_sync_mutex);
+	if (fd_dev->fd_sync_done_seq >= seq) {
+		ret = fd_dev->fd_sync_ret;
+		mutex_unlock(&fd_dev->fd_sync_mutex);
+		return ret;
+	}
+
+	spin_lock(&fd_dev->fd_sync_lock);
+	seq = fd_dev->fd_sync_seq;
+	start = fd_dev->fd_sync_start;
+	end = fd_dev->fd_sync_end;
+	fd_dev->fd_sync_start = LLONG_MAX;
+	fd_dev->fd_sync_end = 0;
+	spin_unlock(&fd_dev->fd_sync_lock);
+
+	ret = vfs_fsync_range(fd_dev->fd_file, start, end, 1);
+	if (ret != 0)
+		pr_err("FILEIO: vfs_fsync_range() failed: %d\n", ret);
+
+	fd_dev->fd_sync_ret = ret;
+	fd_dev->fd_sync_done_seq = seq;
+	fd_dev->fd_sync_issued++;
+	mutex_unlock(&fd_dev->fd_sync_mutex);
+
+	return ret;
+}
+
 static void fd_emulate_sync_cache(struct se_task *task)
 {
 	struct se_cmd *cmd = task->task_se_cmd;
@@ -391,9 +558,7 @@ static void fd_emulate_sync_cache(struct se_task *task)
 			end = LLONG_MAX;
 	}
 
-	ret = vfs_fsync_range(fd_dev->fd_file, start, end, 1);
-	if (ret != 0)
-		pr_err("FILEIO: vfs_fsync_range() failed: %d\n", ret);
+	ret = fd_sync_range(fd_dev, start, end);
 
 	if (!immed)
 		transport_complete_sync_cache(cmd, ret == 0);
@@ -409,17 +574,18 @@ static void fd_emulate_write_fua(struct se_cmd *cmd, struct se_task *task)
 	struct fd_dev *fd_dev = dev->dev_ptr;
 	loff_t start = task->task_lba * dev->se_sub_dev->se_dev_attrib.block_size;
 	loff_t end = start + task->task_size;
-	int ret;
 
 	pr_debug("FILEIO: FUA WRITE LBA: %llu, bytes: %u\n",
 			task->task_lba, task->task_size);
 
-	ret = vfs_fsync_range(fd_dev->fd_file, start, end, 1);
-	if (ret != 0)
-		pr_err("FILEIO: vfs_fsync_range() failed: %d\n", ret);
+	fd_sync_range(fd_dev, start, end);
 }
 
-static int fd_do_task(struct se_task *task)
+/*
+ * Perform the READ or WRITE for a se_task through the backing struct file,
+ * returns 1 once the task can be completed with GOOD status.
+ */
+static int fd_do_rw(struct se_task *task)
 {
 	struct se_cmd *cmd = task->task_se_cmd;
 	struct se_device *dev = cmd->se_dev;
@@ -448,6 +614,217 @@ static int fd_do_task(struct se_task *task)
 
 	}
 
+	return ret;
+}
+
+/*
+ * fd_async_io=1 for a regular file: the task runs from fd_dev->fd_wq so
+ * that many tasks per LUN can be inside the filesystem at the same time,
+ * instead of one after another from the device processing thread.
+ */
+static void fd_do_work(struct work_struct *work)
+{
+	struct fd_request *req = container_of(work, struct fd_request,
+					fd_work);
+	struct se_task *task = &req->fd_task;
+
+	if (fd_do_rw(task) < 0) {
+		transport_complete_task(task, 0);
+		return;
+	}
+
+	task->task_scsi_status = GOOD;
+	transport_complete_task(task, 1);
+}
+
+static void fd_bio_done(struct bio *bio, int err)
+{
+	struct se_task *task = bio->bi_private;
+	struct fd_request *req = FILE_REQ(task);
+
+	/*
+	 * Set -EIO if !BIO_UPTODATE and the passed is still err=0
+	 */
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags) && !err)
+		err = -EIO;
+
+	if (err != 0) {
+		pr_err("FILEIO: IO error for bio: se_cmd %p, err %d\n",
+			task->task_se_cmd, err);
+		atomic_inc(&req->fd_bio_err_cnt);
+		smp_mb__after_atomic_inc();
+	}
+
+	bio_put(bio);
+
+	if (!atomic_dec_and_test(&req->fd_pending))
+		return;
+
+	if (!atomic_read(&req->fd_bio_err_cnt)) {
+		task->task_scsi_status = GOOD;
+		transport_complete_task(task, 1);
+	} else
+		transport_complete_task(task, 0);
+}
+
+static struct bio *
+fd_get_bio(struct se_task *task, struct block_device *bd, sector_t lba,
+	   u32 sg_num)
+{
+	struct fd_request *req = FILE_REQ(task);
+	struct bio *bio;
+
+	if (sg_num > BIO_MAX_PAGES)
+		sg_num = BIO_MAX_PAGES;
+
+	bio = bio_alloc(GFP_NOIO, sg_num);
+	if (!bio) {
+		pr_err("FILEIO: Unable to allocate bio (sg_num %u)\n",
+			sg_num);
+		return NULL;
+	}
+
+	bio->bi_bdev = bd;
+	bio->bi_private = task;
+	bio->bi_end_io = &fd_bio_done;
+	bio->bi_sector = lba;
+	atomic_inc(&req->fd_pending);
+
+	return bio;
+}
+
+static void fd_submit_bios(struct bio_list *list, int rw)
+{
+	struct blk_plug plug;
+	struct bio *bio;
+
+	blk_start_plug(&plug);
+	while ((bio = bio_list_pop(list)))
+		submit_bio(rw, bio);
+	blk_finish_plug(&plug);
+}
+
+/*
+ * fd_async_io=1 for a struct block_device: direct I/O from the se_task
+ * pages with completion from bio end_io, without an iovec or a bounce
+ * through the page cache.
+ */
+static int fd_do_bio_task(struct se_task *task)
+{
+	struct se_cmd *cmd = task->task_se_cmd;
+	struct se_device *dev = cmd->se_dev;
+	struct fd_dev *fd_dev = dev->dev_ptr;
+	struct fd_request *req = FILE_REQ(task);
+	struct bio *bio;
+	struct bio_list list;
+	struct scatterlist *sg;
+	u32 i, sg_num = task->task_sg_nents;
+	sector_t block_lba;
+	unsigned bio_cnt;
+	bool submitted = false;
+	int rw;
+
+	if (task->task_data_direction == DMA_TO_DEVICE) {
+		/*
+		 * Force data to disk if we pretend to not have a volatile
+		 * write cache, or the initiator set the Force Unit Access bit.
+		 */
+		if (dev->se_sub_dev->se_dev_attrib.emulate_write_cache == 0 ||
+		    (dev->se_sub_dev->se_dev_attrib.emulate_fua_write > 0 &&
+		     (cmd->se_cmd_flags & SCF_FUA)))
+			rw = WRITE_FUA;
+		else
+			rw = WRITE;
+	} else {
+		rw = READ;
+	}
+	/*
+	 * Convert from the se_task SCSI blocksize into Linux/Block 512 units.
+	 */
+	block_lba = (task->task_lba *
+		     dev->se_sub_dev->se_dev_attrib.block_size) >> FD_LBA_SHIFT;
+
+	atomic_set(&req->fd_pending, 1);
+	atomic_set(&req->fd_bio_err_cnt, 0);
+
+	bio = fd_get_bio(task, fd_dev->fd_bd, block_lba, sg_num);
+	if (!bio) {
+		cmd->scsi_sense_reason = TCM_LOGICAL_UNIT_COMMUNICATION_FAILURE;
+		return -ENOMEM;
+	}
+
+	bio_list_init(&list);
+	bio_list_add(&list, bio);
+	bio_cnt = 1;
+
+	for_each_sg(task->task_sg, sg, task->task_sg_nents, i) {
+		while (bio_add_page(bio, sg_page(sg), sg->length, sg->offset)
+				!= sg->length) {
+			if (bio_cnt >= FD_MAX_BIO_PER_TASK) {
+				fd_submit_bios(&list, rw);
+				submitted = true;
+				bio_cnt = 0;
+			}
+
+			bio = fd_get_bio(task, fd_dev->fd_bd, block_lba, sg_num);
+			if (!bio)
+				goto fail;
+			bio_list_add(&list, bio);
+			bio_cnt++;
+		}
+
+		/* Always in 512 byte units for Linux/Block */
+		block_lba += sg->length >> FD_LBA_SHIFT;
+		sg_num--;
+	}
+
+	fd_submit_bios(&list, rw);
+
+	if (atomic_dec_and_test(&req->fd_pending)) {
+		if (!atomic_read(&req->fd_bio_err_cnt)) {
+			task->task_scsi_status = GOOD;
+			transport_complete_task(task, 1);
+		} else
+			transport_complete_task(task, 0);
+	}
+	return 0;
+
+fail:
+	while ((bio = bio_list_pop(&list))) {
+		bio_put(bio);
+		atomic_dec(&req->fd_pending);
+	}
+	if (!submitted) {
+		cmd->scsi_sense_reason = TCM_LOGICAL_UNIT_COMMUNICATION_FAILURE;
+		return -ENOMEM;
+	}
+	/*
+	 * Bios already in flight still DMA into the task pages, so fail the
+	 * task from fd_bio_done() once the last of them has completed.
+	 */
+	atomic_inc(&req->fd_bio_err_cnt);
+	smp_mb__after_atomic_inc();
+	if (atomic_dec_and_test(&req->fd_pending))
+		transport_complete_task(task, 0);
+	return 0;
+}
+
+static int fd_do_task(struct se_task *task)
+{
+	struct se_cmd *cmd = task->task_se_cmd;
+	struct fd_dev *fd_dev = cmd->se_dev->dev_ptr;
+	int ret = 0;
+
+	if (fd_dev->fd_bd)
+		return fd_do_bio_task(task);
+
+	if (fd_dev->fd_wq) {
+		INIT_WORK(&FILE_REQ(task)->fd_work, fd_do_work);
+		queue_work(fd_dev->fd_wq, &FILE_REQ(task)->fd_work);
+		return 0;
+	}
+
+	ret = fd_do_rw(task);
 	if (ret < 0) {
 		cmd->scsi_sense_reason = TCM_LOGICAL_UNIT_COMMUNICATION_FAILURE;
 		return ret;
@@ -471,13 +848,15 @@ static void fd_free_task(struct se_task *task)
 }
 
 enum {
-	Opt_fd_dev_name, Opt_fd_dev_size, Opt_fd_buffered_io, Opt_err
+	Opt_fd_dev_name, Opt_fd_dev_size, Opt_fd_buffered_io, Opt_fd_async_io,
+	Opt_err
 };
 
 static match_table_t tokens = {
 	{Opt_fd_dev_name, "fd_dev_name=%s"},
 	{Opt_fd_dev_size, "fd_dev_size=%s"},
 	{Opt_fd_buffered_io, "fd_buffered_io=%d"},
+	{Opt_fd_async_io, "fd_async_io=%d"},
 	{Opt_err, NULL}
 };
 
@@ -546,6 +925,19 @@ static ssize_t fd_set_configfs_dev_params(
 
 			fd_dev->fbd_flags |= FDBD_USE_BUFFERED_IO;
 			break;
+		case Opt_fd_async_io:
+			match_int(args, &arg);
+			if (arg != 1) {
+				pr_err("bogus fd_async_io=%d value\n", arg);
+				ret = -EINVAL;
+				goto out;
+			}
+
+			pr_debug("FILEIO: Using asynchronous I/O"
+				" operations for struct fd_dev\n");
+
+			fd_dev->fbd_flags |= FDBD_USE_ASYNC_IO;
+			break;
 		default:
 			break;
 		}
@@ -577,10 +969,14 @@ static ssize_t fd_show_configfs_dev_params(
 	ssize_t bl = 0;
 
 	bl = sprintf(b + bl, "TCM FILEIO ID: %u", fd_dev->fd_dev_id);
-	bl += sprintf(b + bl, "        File: %s  Size: %llu  Mode: %s\n",
+	bl += sprintf(b + bl, "        File: %s  Size: %llu  Mode: %s%s\n",
 		fd_dev->fd_dev_name, fd_dev->fd_dev_size,
 		(fd_dev->fbd_flags & FDBD_USE_BUFFERED_IO) ?
-		"Buffered" : "Synchronous");
+		"Buffered" : "Synchronous",
+		(fd_dev->fbd_flags & FDBD_USE_ASYNC_IO) ? " Async" : "");
+	bl += sprintf(b + bl, "        Sync requests: %u  Syncs issued: %u"
+		"  Read-ahead windows: %u\n", fd_dev->fd_sync_requests,
+		fd_dev->fd_sync_issued, fd_dev->fd_ra_count);
 	return bl;
 }
 
@@ -9,16 +9,40 @@
 #define FD_BLOCKSIZE		512
 #define FD_MAX_SECTORS		1024
 
+#define FD_INLINE_IOVECS	16
+#define FD_MAX_BIO_PER_TASK	32
+#define FD_LBA_SHIFT		9
+#define FD_RA_STREAMS		8
+
 #define RRF_EMULATE_CDB		0x01
 #define RRF_GOT_LBA		0x02
 
 struct fd_request {
 	struct se_task	fd_task;
+	/* Used by fd_async_io=1 to run the task from fd_dev->fd_wq */
+	struct work_struct fd_work;
+	/* Outstanding bios and bio errors for a struct block_device backend */
+	atomic_t	fd_pending;
+	atomic_t	fd_bio_err_cnt;
+	/* Avoids an iovec allocation for task_sg_nents <= FD_INLINE_IOVECS */
+	struct iovec	fd_iov[FD_INLINE_IOVECS];
+};
+
+/*
+ * A sequential READ stream from one initiator, with its own read-ahead
+ * window so that interleaved streams do not reset each other.
+ */
+struct fd_ra_stream {
+	struct se_session *ra_sess;
+	loff_t		ra_next_pos;
+	unsigned long	ra_last_used;
+	struct file_ra_state ra_state;
 };
 
 #define FBDF_HAS_PATH		0x01
 #define FBDF_HAS_SIZE		0x02
 #define FDBD_USE_BUFFERED_IO	0x04
+#define FDBD_USE_ASYNC_IO	0x08
 
 struct fd_dev {
 	u32		fbd_flags;
@@ -31,6 +55,27 @@ struct fd_dev {
 	u32		fd_block_size;
 	unsigned long long fd_dev_size;
 	struct file	*fd_file;
+	/* Backing struct block_device for fd_async_io=1, or NULL */
+	struct block_device *fd_bd;
+	/* Runs fd_async_io=1 tasks that go through the struct file */
+	struct workqueue_struct *fd_wq;
+	/* Sequential READ stream detection for read-ahead */
+	spinlock_t	fd_ra_lock;
+	u32		fd_ra_count;
+	struct fd_ra_stream fd_ra_streams[FD_RA_STREAMS];
+	/*
+	 * FUA WRITE and SYNCHRONIZE_CACHE flush batching, fd_sync_mutex is
+	 * held while a vfs_fsync_range() covering fd_sync_seq is running.
+	 */
+	struct mutex	fd_sync_mutex;
+	spinlock_t	fd_sync_lock;
+	u64		fd_sync_seq;
+	u64		fd_sync_done_seq;
+	int		fd_sync_ret;
+	loff_t		fd_sync_start;
+	loff_t		fd_sync_end;
+	u32		fd_sync_requests;
+	u32		fd_sync_issued;
 	/* FILEIO HBA device is connected to */
 	struct fd_host *fd_host;
 } ____cacheline_aligned;
@@ -18,10 +18,15 @@ int	target_emulate_synchronize_cache(struct se_task *task);
 int	target_emulate_noop(struct se_task *task);
 
 /* target_core_device.c */
+struct se_dev_entry *core_get_se_deve(struct se_node_acl *, u32);
+struct se_dev_entry *core_alloc_se_deve(struct se_node_acl *, u32);
 struct se_dev_entry *core_get_se_deve_from_rtpi(struct se_node_acl *, u16);
 int	core_free_device_list_for_node(struct se_node_acl *,
 		struct se_portal_group *);
 void	core_dec_lacl_count(struct se_node_acl *, struct se_cmd *);
+void	core_io_stats_sum(struct se_io_stats __percpu *, struct se_io_stats *);
+void	core_port_stats_sum(struct se_port *, struct scsi_port_stats *);
+void	core_dev_io_rates(struct se_device *, struct se_io_stats *);
 void	core_update_device_list_access(u32, u32, struct se_node_acl *);
 int	core_update_device_list_for_node(struct se_lun *, struct se_lun_acl *,
 		u32, u32, struct se_node_acl *, struct se_portal_group *, int);
@@ -100,6 +105,16 @@ int	core_tpg_post_dellun(struct se_portal_group *, struct se_lun *);
 /* target_core_transport.c */
 extern struct kmem_cache *se_tmr_req_cache;
 
+/* Summed over all CPUs for /sys/kernel/config/target/mem_pool */
+struct se_mem_pool_stats {
+	u64	page_hits;
+	u64	page_allocs;
+	u64	high_order_allocs;
+	u64	sgl_hits;
+	u64	sgl_allocs;
+	u64	pages_cached;
+};
+
 int	init_se_kmem_caches(void);
 void	release_se_kmem_caches(void);
 u32	scsi_get_new_index(scsi_index_t);
@@ -107,6 +122,7 @@ void	transport_subsystem_check_init(void);
 void	transport_cmd_finish_abort(struct se_cmd *, int);
 void	__transport_remove_task_from_execute_queue(struct se_task *,
 		struct se_device *);
+void	transport_free_exec_queues(struct se_device *);
 unsigned char *transport_dump_cmd_direction(struct se_cmd *);
 void	transport_dump_dev_state(struct se_device *, char *, int *);
 void	transport_dump_dev_info(struct se_device *, struct se_lun *,
@@ -118,6 +134,7 @@ int	transport_dump_vpd_ident(struct t10_vpd *, unsigned char *, int);
 bool	target_stop_task(struct se_task *task, unsigned long *flags);
 int	transport_clear_lun_from_sessions(struct se_lun *);
 void	transport_send_task_abort(struct se_cmd *);
+void	transport_mem_pool_stats(struct se_mem_pool_stats *);
 
 /* target_core_stat.c */
 void	target_stat_setup_dev_default_groups(struct se_subsystem_dev *);
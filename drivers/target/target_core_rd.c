@@ -41,6 +41,7 @@
 
 #include "target_core_rd.h"
 
+static struct se_subsystem_api rd_dr_template;
 static struct se_subsystem_api rd_mcp_template;
 
 /*	rd_attach_hba(): (Part of se_subsystem_api_t template)
@@ -105,8 +106,8 @@ static void rd_release_device_space(struct rd_dev *rd_dev)
 		for (j = 0; j < sg_per_table; j++) {
 			pg = sg_page(&sg[j]);
 			if (pg) {
-				__free_page(pg);
-				page_count++;
+				__free_pages(pg, rd_dev->rd_page_order);
+				page_count += 1 << rd_dev->rd_page_order;
 			}
 		}
 
@@ -124,6 +125,19 @@ static void rd_release_device_space(struct rd_dev *rd_dev)
 }
 
 
+/*	rd_next_node():
+ *
+ *	Ramdisk chunks are spread round robin over the nodes with memory, so
+ *	that every NUMA node serves an equal share of the LUN.
+ */
+static int rd_next_node(int nid)
+{
+	nid = next_node(nid, node_states[N_HIGH_MEMORY]);
+	if (nid == MAX_NUMNODES)
+		nid = first_node(node_states[N_HIGH_MEMORY]);
+	return nid;
+}
+
 /*	rd_build_device_space():
  *
  *
@@ -131,20 +145,26 @@ static void rd_release_device_space(struct rd_dev *rd_dev)
 static int rd_build_device_space(struct rd_dev *rd_dev)
 {
 	u32 i = 0, j, page_offset = 0, sg_per_table, sg_tables, total_sg_needed;
-	u32 max_sg_per_table = (RD_MAX_ALLOCATION_SIZE /
-				sizeof(struct scatterlist));
+	u32 max_sg_per_table = RD_MAX_SG_PER_TABLE;
+	u32 order = rd_dev->rd_page_order;
+	gfp_t gfp_mask = GFP_KERNEL;
 	struct rd_dev_sg_table *sg_table;
 	struct page *pg;
 	struct scatterlist *sg;
+	int nid = first_node(node_states[N_HIGH_MEMORY]);
 
 	if (rd_dev->rd_page_count <= 0) {
 		pr_err("Illegal page count: %u for Ramdisk device\n",
 			rd_dev->rd_page_count);
 		return -EINVAL;
 	}
-	total_sg_needed = rd_dev->rd_page_count;
+	if (order)
+		gfp_mask |= __GFP_COMP | __GFP_NOWARN;
+
+	total_sg_needed = DIV_ROUND_UP(rd_dev->rd_page_count, 1 << order);
+	rd_dev->rd_chunk_count = total_sg_needed;
 
-	sg_tables = (total_sg_needed / max_sg_per_table) + 1;
+	sg_tables = DIV_ROUND_UP(total_sg_needed, max_sg_per_table);
 
 	sg_table = kzalloc(sg_tables * sizeof(struct rd_dev_sg_table), GFP_KERNEL);
 	if (!sg_table) {
@@ -177,14 +197,17 @@ static int rd_build_device_space(struct rd_dev *rd_dev)
 						- 1;
 
 		for (j = 0; j < sg_per_table; j++) {
-			pg = alloc_pages(GFP_KERNEL, 0);
+			pg = alloc_pages_node(nid, gfp_mask, order);
 			if (!pg) {
-				pr_err("Unable to allocate scatterlist"
-					" pages for struct rd_dev_sg_table\n");
+				pr_err("Unable to allocate order %u scatterlist"
+					" pages for struct rd_dev_sg_table\n",
+					order);
 				return -ENOMEM;
 			}
+			nid = rd_next_node(nid);
+
 			sg_assign_page(&sg[j], pg);
-			sg[j].length = PAGE_SIZE;
+			sg[j].length = PAGE_SIZE << order;
 		}
 
 		page_offset += sg_per_table;
@@ -192,8 +215,9 @@ static int rd_build_device_space(struct rd_dev *rd_dev)
 	}
 
 	pr_debug("CORE_RD[%u] - Built Ramdisk Device ID: %u space of"
-		" %u pages in %u tables\n", rd_dev->rd_host->rd_host_id,
-		rd_dev->rd_dev_id, rd_dev->rd_page_count,
+		" %u pages in %u order %u chunks and %u tables\n",
+		rd_dev->rd_host->rd_host_id, rd_dev->rd_dev_id,
+		rd_dev->rd_page_count, rd_dev->rd_chunk_count, order,
 		rd_dev->sg_table_count);
 
 	return 0;
@@ -219,6 +243,11 @@ static void *rd_allocate_virtdevice(
 	return rd_dev;
 }
 
+static void *rd_DIRECT_allocate_virtdevice(struct se_hba *hba, const char *name)
+{
+	return rd_allocate_virtdevice(hba, name, 1);
+}
+
 static void *rd_MEMCPY_allocate_virtdevice(struct se_hba *hba, const char *name)
 {
 	return rd_allocate_virtdevice(hba, name, 0);
@@ -253,10 +282,16 @@ static struct se_device *rd_create_virtdevice(
 	dev_limits.queue_depth = RD_DEVICE_QUEUE_DEPTH;
 
 	dev = transport_add_device_to_core_hba(hba,
+			(rd_dev->rd_direct) ? &rd_dr_template :
 			&rd_mcp_template, se_dev, dev_flags, rd_dev,
 			&dev_limits, PURE_PRODUCT_ID, PURE_REVISION);
 	if (!dev)
 		goto fail;
+	/*
+	 * rd_dr lends ramdisk pages for READs from rd_DIRECT_alloc_cmd_mem()
+	 */
+	if (rd_dev->rd_direct)
+		dev->dev_flags |= DF_USE_ALLOC_CMD_MEM;
 
 	rd_dev->rd_dev_id = rd_host->rd_host_dev_id_count++;
 	rd_dev->rd_queue_depth = dev->queue_depth;
@@ -275,6 +310,14 @@ fail:
 	return ERR_PTR(ret);
 }
 
+static struct se_device *rd_DIRECT_create_virtdevice(
+	struct se_hba *hba,
+	struct se_subsystem_dev *se_dev,
+	void *p)
+{
+	return rd_create_virtdevice(hba, se_dev, p, 1);
+}
+
 static struct se_device *rd_MEMCPY_create_virtdevice(
 	struct se_hba *hba,
 	struct se_subsystem_dev *se_dev,
@@ -316,24 +359,20 @@ rd_alloc_task(unsigned char *cdb)
 
 /*	rd_get_sg_table():
  *
- *
+ *	All tables but the last hold RD_MAX_SG_PER_TABLE chunks, so the table
+ *	for a chunk is found by index math.
  */
 static struct rd_dev_sg_table *rd_get_sg_table(struct rd_dev *rd_dev, u32 page)
 {
-	u32 i;
-	struct rd_dev_sg_table *sg_table;
+	u32 i = page / RD_MAX_SG_PER_TABLE;
 
-	for (i = 0; i < rd_dev->sg_table_count; i++) {
-		sg_table = &rd_dev->sg_table_array[i];
-		if ((sg_table->page_start_offset <= page) &&
-		    (sg_table->page_end_offset >= page))
-			return sg_table;
+	if (unlikely(i >= rd_dev->sg_table_count)) {
+		pr_err("Unable to locate struct rd_dev_sg_table for page: %u\n",
+				page);
+		return NULL;
 	}
 
-	pr_err("Unable to locate struct rd_dev_sg_table for page: %u\n",
-			page);
-
-	return NULL;
+	return &rd_dev->sg_table_array[i];
 }
 
 static int rd_MEMCPY(struct rd_request *req, u32 read_rd)
@@ -344,6 +383,7 @@ static int rd_MEMCPY(struct rd_request *req, u32 read_rd)
 	struct scatterlist *rd_sg;
 	struct sg_mapping_iter m;
 	u32 rd_offset = req->rd_offset;
+	u32 chunk_size = PAGE_SIZE << dev->rd_page_order;
 	u32 src_len;
 
 	table = rd_get_sg_table(dev, req->rd_page);
@@ -357,7 +397,7 @@ static int rd_MEMCPY(struct rd_request *req, u32 read_rd)
 			task->task_lba, req->rd_size, req->rd_page,
 			rd_offset);
 
-	src_len = PAGE_SIZE - rd_offset;
+	src_len = chunk_size - rd_offset;
 	sg_miter_start(&m, task->task_sg, task->task_sg_nents,
 			read_rd ? SG_MITER_TO_SG : SG_MITER_FROM_SG);
 	while (req->rd_size) {
@@ -385,10 +425,10 @@ static int rd_MEMCPY(struct rd_request *req, u32 read_rd)
 			continue;
 		}
 
-		/* rd page completed, next one please */
+		/* rd chunk completed, next one please */
 		req->rd_page++;
 		rd_offset = 0;
-		src_len = PAGE_SIZE;
+		src_len = chunk_size;
 		if (req->rd_page <= table->page_end_offset) {
 			rd_sg++;
 			continue;
@@ -414,13 +454,14 @@ static int rd_MEMCPY(struct rd_request *req, u32 read_rd)
 static int rd_MEMCPY_do_task(struct se_task *task)
 {
 	struct se_device *dev = task->task_se_cmd->se_dev;
+	struct rd_dev *rd_dev = dev->dev_ptr;
 	struct rd_request *req = RD_REQ(task);
 	u64 tmp;
 	int ret;
 
 	tmp = task->task_lba * dev->se_sub_dev->se_dev_attrib.block_size;
-	req->rd_offset = do_div(tmp, PAGE_SIZE);
-	req->rd_page = tmp;
+	req->rd_offset = tmp & ((PAGE_SIZE << rd_dev->rd_page_order) - 1);
+	req->rd_page = tmp >> (PAGE_SHIFT + rd_dev->rd_page_order);
 	req->rd_size = task->task_size;
 
 	ret = rd_MEMCPY(req, task->task_data_direction == DMA_FROM_DEVICE);
@@ -432,6 +473,119 @@ static int rd_MEMCPY_do_task(struct se_task *task)
 	return 0;
 }
 
+/*	rd_DIRECT_alloc_cmd_mem(): (Part of se_subsystem_api_t template)
+ *
+ *	Serve a single task READ by pointing cmd->t_data_sg straight at the
+ *	ramdisk pages, holding a page reference for each entry until
+ *	rd_DIRECT_free_cmd_mem().  Returns 1 for everything else, so that
+ *	the core allocates the memory and rd_MEMCPY() is used.
+ */
+static int rd_DIRECT_alloc_cmd_mem(struct se_cmd *cmd)
+{
+	struct se_device *dev = cmd->se_dev;
+	struct se_dev_attrib *attrib = &dev->se_sub_dev->se_dev_attrib;
+	struct rd_dev *rd_dev = dev->dev_ptr;
+	struct rd_dev_sg_table *table;
+	struct scatterlist *rd_sg, *sg;
+	u32 chunk_size = PAGE_SIZE << rd_dev->rd_page_order;
+	u32 length = cmd->data_length, rd_offset, rd_page, nents, i;
+	u64 tmp;
+
+	if (!(cmd->se_cmd_flags & SCF_SCSI_DATA_SG_IO_CDB) ||
+	    cmd->data_direction != DMA_FROM_DEVICE || cmd->t_bidi_data_sg ||
+	    !length || length > attrib->max_sectors * attrib->block_size)
+		return 1;
+
+	/*
+	 * Fabrics such as iscsi_target_mod walk t_data_sg assuming
+	 * page-sized entries, so only page-aligned I/O is served directly.
+	 */
+	tmp = cmd->t_task_lba * attrib->block_size;
+	if (offset_in_page(tmp) || offset_in_page(length))
+		return 1;
+	if (tmp + length > ((u64)rd_dev->rd_page_count << PAGE_SHIFT))
+		return 1;
+
+	rd_offset = tmp & (chunk_size - 1);
+	rd_page = tmp >> (PAGE_SHIFT + rd_dev->rd_page_order);
+
+	table = rd_get_sg_table(rd_dev, rd_page);
+	if (!table)
+		return 1;
+	rd_sg = &table->sg_table[rd_page - table->page_start_offset];
+
+	nents = DIV_ROUND_UP(offset_in_page(rd_offset) + length, PAGE_SIZE);
+	sg = kmalloc(sizeof(struct scatterlist) * nents, GFP_KERNEL);
+	if (!sg)
+		return -ENOMEM;
+	sg_init_table(sg, nents);
+
+	for (i = 0; i < nents; i++) {
+		struct page *pg = sg_page(rd_sg) + (rd_offset >> PAGE_SHIFT);
+		u32 off = offset_in_page(rd_offset);
+		u32 len = min_t(u32, length, PAGE_SIZE - off);
+
+		get_page(pg);
+		sg_set_page(&sg[i], pg, len, off);
+
+		length -= len;
+		rd_offset += len;
+		if (!length || rd_offset < chunk_size)
+			continue;
+
+		/* rd chunk completed, next one please */
+		rd_page++;
+		rd_offset = 0;
+		if (rd_page <= table->page_end_offset) {
+			rd_sg++;
+			continue;
+		}
+
+		table = rd_get_sg_table(rd_dev, rd_page);
+		if (!table) {
+			while (i--)
+				put_page(sg_page(&sg[i]));
+			kfree(sg);
+			return -EINVAL;
+		}
+		rd_sg = table->sg_table;
+	}
+
+	cmd->t_data_sg = sg;
+	cmd->t_data_nents = nents;
+	return 0;
+}
+
+static void rd_DIRECT_free_cmd_mem(struct se_cmd *cmd)
+{
+	struct scatterlist *sg;
+	int i;
+
+	for_each_sg(cmd->t_data_sg, sg, cmd->t_data_nents, i)
+		put_page(sg_page(sg));
+
+	kfree(cmd->t_data_sg);
+	cmd->t_data_sg = NULL;
+	cmd->t_data_nents = 0;
+}
+
+/*	rd_DIRECT_do_task(): (Part of se_subsystem_api_t template)
+ *
+ *	A READ with lent ramdisk pages already has its data in place.
+ */
+static int rd_DIRECT_do_task(struct se_task *task)
+{
+	struct se_cmd *cmd = task->task_se_cmd;
+
+	if ((cmd->alloc_cmd_mem_flags & CMD_A_CORE_MEM) ||
+	    task->task_data_direction != DMA_FROM_DEVICE)
+		return rd_MEMCPY_do_task(task);
+
+	task->task_scsi_status = GOOD;
+	transport_complete_task(task, 1);
+	return 0;
+}
+
 /*	rd_free_task(): (Part of se_subsystem_api_t template)
  *
  *
@@ -442,11 +596,12 @@ static void rd_free_task(struct se_task *task)
 }
 
 enum {
-	Opt_rd_pages, Opt_err
+	Opt_rd_pages, Opt_rd_page_order, Opt_err
 };
 
 static match_table_t tokens = {
 	{Opt_rd_pages, "rd_pages=%d"},
+	{Opt_rd_page_order, "rd_page_order=%d"},
 	{Opt_err, NULL}
 };
 
@@ -480,6 +635,28 @@ static ssize_t rd_set_configfs_dev_params(
 				" Count: %u\n", rd_dev->rd_page_count);
 			rd_dev->rd_flags |= RDF_HAS_PAGE_COUNT;
 			break;
+		case Opt_rd_page_order:
+			match_int(args, &arg);
+			if (arg < 0 || arg >= MAX_ORDER) {
+				pr_err("bogus rd_page_order=%d value\n", arg);
+				ret = -EINVAL;
+				break;
+			}
+			/*
+			 * rd_MEMCPY_do_task() and rd_release_device_space()
+			 * index and free the pages with this order.
+			 */
+			if (rd_dev->sg_table_array) {
+				pr_err("Unable to change rd_page_order after"
+					" device space has been built\n");
+				ret = -EINVAL;
+				break;
+			}
+			rd_dev->rd_page_order = arg;
+			pr_debug("RAMDISK: Referencing Page"
+				" Order: %u\n", rd_dev->rd_page_order);
+			rd_dev->rd_flags |= RDF_HAS_PAGE_ORDER;
+			break;
 		default:
 			break;
 		}
@@ -511,8 +688,9 @@ static ssize_t rd_show_configfs_dev_params(
 			rd_dev->rd_dev_id, (rd_dev->rd_direct) ?
 			"rd_direct" : "rd_mcp");
 	bl += sprintf(b + bl, "        PAGES/PAGE_SIZE: %u*%lu"
-			"  SG_table_count: %u\n", rd_dev->rd_page_count,
-			PAGE_SIZE, rd_dev->sg_table_count);
+			"  SG_table_count: %u  Page order: %u\n",
+			rd_dev->rd_page_count, PAGE_SIZE,
+			rd_dev->sg_table_count, rd_dev->rd_page_order);
 	return bl;
 }
 
@@ -535,6 +713,27 @@ static sector_t rd_get_blocks(struct se_device *dev)
 	return blocks_long;
 }
 
+static struct se_subsystem_api rd_dr_template = {
+	.name			= "rd_dr",
+	.transport_type		= TRANSPORT_PLUGIN_VHBA_VDEV,
+	.attach_hba		= rd_attach_hba,
+	.detach_hba		= rd_detach_hba,
+	.allocate_virtdevice	= rd_DIRECT_allocate_virtdevice,
+	.create_virtdevice	= rd_DIRECT_create_virtdevice,
+	.free_device		= rd_free_device,
+	.alloc_task		= rd_alloc_task,
+	.alloc_cmd_mem		= rd_DIRECT_alloc_cmd_mem,
+	.free_cmd_mem		= rd_DIRECT_free_cmd_mem,
+	.do_task		= rd_DIRECT_do_task,
+	.free_task		= rd_free_task,
+	.check_configfs_dev_params = rd_check_configfs_dev_params,
+	.set_configfs_dev_params = rd_set_configfs_dev_params,
+	.show_configfs_dev_params = rd_show_configfs_dev_params,
+	.get_device_rev		= rd_get_device_rev,
+	.get_device_type	= rd_get_device_type,
+	.get_blocks		= rd_get_blocks,
+};
+
 static struct se_subsystem_api rd_mcp_template = {
 	.name			= "rd_mcp",
 	.transport_type		= TRANSPORT_PLUGIN_VHBA_VDEV,
@@ -558,8 +757,13 @@ int __init rd_module_init(void)
 {
 	int ret;
 
+	ret = transport_subsystem_register(&rd_dr_template);
+	if (ret < 0)
+		return ret;
+
 	ret = transport_subsystem_register(&rd_mcp_template);
 	if (ret < 0) {
+		transport_subsystem_release(&rd_dr_template);
 		return ret;
 	}
 
@@ -568,5 +772,6 @@ int __init rd_module_init(void)
 
 void rd_module_exit(void)
 {
+	transport_subsystem_release(&rd_dr_template);
 	transport_subsystem_release(&rd_mcp_template);
 }
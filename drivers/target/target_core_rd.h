@@ -7,6 +7,8 @@
 
 /* Largest piece of memory kmalloc can allocate */
 #define RD_MAX_ALLOCATION_SIZE	65536
+/* Every struct rd_dev_sg_table but the last holds exactly this many entries */
+#define RD_MAX_SG_PER_TABLE	(RD_MAX_ALLOCATION_SIZE / sizeof(struct scatterlist))
 #define RD_DEVICE_QUEUE_DEPTH	32
 #define RD_MAX_DEVICE_QUEUE_DEPTH 128
 #define RD_BLOCKSIZE		512
@@ -22,9 +24,9 @@ void rd_module_exit(void);
 struct rd_request {
 	struct se_task	rd_task;
 
-	/* Offset from start of page */
+	/* Offset from start of ramdisk chunk */
 	u32		rd_offset;
-	/* Starting page in Ramdisk for request */
+	/* Starting chunk in Ramdisk for request */
 	u32		rd_page;
 	/* Total number of pages needed for request */
 	u32		rd_page_count;
@@ -40,6 +42,7 @@ struct rd_dev_sg_table {
 } ____cacheline_aligned;
 
 #define RDF_HAS_PAGE_COUNT	0x01
+#define RDF_HAS_PAGE_ORDER	0x02
 
 struct rd_dev {
 	int		rd_direct;
@@ -48,6 +51,12 @@ struct rd_dev {
 	u32		rd_dev_id;
 	/* Total page count for ramdisk device */
 	u32		rd_page_count;
+	/*
+	 * Each scatterlist entry in sg_table_array is a compound page of
+	 * PAGE_SIZE << rd_page_order bytes, rd_chunk_count of them in total.
+	 */
+	u32		rd_page_order;
+	u32		rd_chunk_count;
 	/* Number of SG tables in sg_table_array */
 	u32		sg_table_count;
 	u32		rd_queue_depth;
@@ -523,13 +523,15 @@ static ssize_t target_stat_scsi_lu_show_attr_num_cmds(
 	struct se_subsystem_dev *se_subdev = container_of(sgrps,
 			struct se_subsystem_dev, dev_stat_grps);
 	struct se_device *dev = se_subdev->se_dev_ptr;
+	struct se_io_stats stats;
 
 	if (!dev)
 		return -ENODEV;
 
 	/* scsiLuNumCommands */
+	core_io_stats_sum(dev->io_stats, &stats);
 	return snprintf(page, PAGE_SIZE, "%llu\n",
-			(unsigned long long)dev->num_cmds);
+			(unsigned long long)stats.num_cmds);
 }
 DEV_STAT_SCSI_LU_ATTR_RO(num_cmds);
 
@@ -539,12 +541,14 @@ static ssize_t target_stat_scsi_lu_show_attr_read_mbytes(
 	struct se_subsystem_dev *se_subdev = container_of(sgrps,
 			struct se_subsystem_dev, dev_stat_grps);
 	struct se_device *dev = se_subdev->se_dev_ptr;
+	struct se_io_stats stats;
 
 	if (!dev)
 		return -ENODEV;
 
 	/* scsiLuReadMegaBytes */
-	return snprintf(page, PAGE_SIZE, "%u\n", (u32)(dev->read_bytes >> 20));
+	core_io_stats_sum(dev->io_stats, &stats);
+	return snprintf(page, PAGE_SIZE, "%u\n", (u32)(stats.read_bytes >> 20));
 }
 DEV_STAT_SCSI_LU_ATTR_RO(read_mbytes);
 
@@ -554,12 +558,14 @@ static ssize_t target_stat_scsi_lu_show_attr_write_mbytes(
 	struct se_subsystem_dev *se_subdev = container_of(sgrps,
 			struct se_subsystem_dev, dev_stat_grps);
 	struct se_device *dev = se_subdev->se_dev_ptr;
+	struct se_io_stats stats;
 
 	if (!dev)
 		return -ENODEV;
 
 	/* scsiLuWrittenMegaBytes */
-	return snprintf(page, PAGE_SIZE, "%u\n", (u32)(dev->write_bytes >> 20));
+	core_io_stats_sum(dev->io_stats, &stats);
+	return snprintf(page, PAGE_SIZE, "%u\n", (u32)(stats.write_bytes >> 20));
 }
 DEV_STAT_SCSI_LU_ATTR_RO(write_mbytes);
 
@@ -599,15 +605,72 @@ static ssize_t target_stat_scsi_lu_show_attr_hs_num_cmds(
 	struct se_subsystem_dev *se_subdev = container_of(sgrps,
 			struct se_subsystem_dev, dev_stat_grps);
 	struct se_device *dev = se_subdev->se_dev_ptr;
+	struct se_io_stats stats;
 
 	if (!dev)
 		return -ENODEV;
 
-	/* FIXME: scsiLuHSInCommands */
-	return snprintf(page, PAGE_SIZE, "%u\n", 0);
+	/* scsiLuHSInCommands */
+	core_io_stats_sum(dev->io_stats, &stats);
+	return snprintf(page, PAGE_SIZE, "%llu\n",
+			(unsigned long long)stats.num_cmds);
 }
 DEV_STAT_SCSI_LU_ATTR_RO(hs_num_cmds);
 
+static ssize_t target_stat_scsi_lu_show_attr_cmds_per_sec(
+	struct se_dev_stat_grps *sgrps, char *page)
+{
+	struct se_subsystem_dev *se_subdev = container_of(sgrps,
+			struct se_subsystem_dev, dev_stat_grps);
+	struct se_device *dev = se_subdev->se_dev_ptr;
+	struct se_io_stats stats;
+
+	if (!dev)
+		return -ENODEV;
+
+	/* Not in the MIB: commands per second */
+	core_dev_io_rates(dev, &stats);
+	return snprintf(page, PAGE_SIZE, "%llu\n",
+			(unsigned long long)stats.num_cmds);
+}
+DEV_STAT_SCSI_LU_ATTR_RO(cmds_per_sec);
+
+static ssize_t target_stat_scsi_lu_show_attr_read_kbytes_per_sec(
+	struct se_dev_stat_grps *sgrps, char *page)
+{
+	struct se_subsystem_dev *se_subdev = container_of(sgrps,
+			struct se_subsystem_dev, dev_stat_grps);
+	struct se_device *dev = se_subdev->se_dev_ptr;
+	struct se_io_stats stats;
+
+	if (!dev)
+		return -ENODEV;
+
+	/* Not in the MIB: KB read per second */
+	core_dev_io_rates(dev, &stats);
+	return snprintf(page, PAGE_SIZE, "%llu\n",
+			(unsigned long long)(stats.read_bytes >> 10));
+}
+DEV_STAT_SCSI_LU_ATTR_RO(read_kbytes_per_sec);
+
+static ssize_t target_stat_scsi_lu_show_attr_write_kbytes_per_sec(
+	struct se_dev_stat_grps *sgrps, char *page)
+{
+	struct se_subsystem_dev *se_subdev = container_of(sgrps,
+			struct se_subsystem_dev, dev_stat_grps);
+	struct se_device *dev = se_subdev->se_dev_ptr;
+	struct se_io_stats stats;
+
+	if (!dev)
+		return -ENODEV;
+
+	/* Not in the MIB: KB written per second */
+	core_dev_io_rates(dev, &stats);
+	return snprintf(page, PAGE_SIZE, "%llu\n",
+			(unsigned long long)(stats.write_bytes >> 10));
+}
+DEV_STAT_SCSI_LU_ATTR_RO(write_kbytes_per_sec);
+
 static ssize_t target_stat_scsi_lu_show_attr_creation_time(
 	struct se_dev_stat_grps *sgrps, char *page)
 {
@@ -624,6 +687,54 @@ static ssize_t target_stat_scsi_lu_show_attr_creation_time(
 }
 DEV_STAT_SCSI_LU_ATTR_RO(creation_time);
 
+static ssize_t target_stat_scsi_lu_show_attr_abort_task_aborted(
+	struct se_dev_stat_grps *sgrps, char *page)
+{
+	struct se_subsystem_dev *se_subdev = container_of(sgrps,
+			struct se_subsystem_dev, dev_stat_grps);
+	struct se_device *dev = se_subdev->se_dev_ptr;
+
+	if (!dev)
+		return -ENODEV;
+
+	/* Not in the MIB: ABORT_TASK requests that aborted a command */
+	return snprintf(page, PAGE_SIZE, "%u\n",
+			atomic_read(&dev->abort_task_aborted));
+}
+DEV_STAT_SCSI_LU_ATTR_RO(abort_task_aborted);
+
+static ssize_t target_stat_scsi_lu_show_attr_abort_task_complete(
+	struct se_dev_stat_grps *sgrps, char *page)
+{
+	struct se_subsystem_dev *se_subdev = container_of(sgrps,
+			struct se_subsystem_dev, dev_stat_grps);
+	struct se_device *dev = se_subdev->se_dev_ptr;
+
+	if (!dev)
+		return -ENODEV;
+
+	/* Not in the MIB: ABORT_TASK requests for an already completed command */
+	return snprintf(page, PAGE_SIZE, "%u\n",
+			atomic_read(&dev->abort_task_complete));
+}
+DEV_STAT_SCSI_LU_ATTR_RO(abort_task_complete);
+
+static ssize_t target_stat_scsi_lu_show_attr_abort_task_not_found(
+	struct se_dev_stat_grps *sgrps, char *page)
+{
+	struct se_subsystem_dev *se_subdev = container_of(sgrps,
+			struct se_subsystem_dev, dev_stat_grps);
+	struct se_device *dev = se_subdev->se_dev_ptr;
+
+	if (!dev)
+		return -ENODEV;
+
+	/* Not in the MIB: ABORT_TASK requests for an unknown task tag */
+	return snprintf(page, PAGE_SIZE, "%u\n",
+			atomic_read(&dev->abort_task_not_found));
+}
+DEV_STAT_SCSI_LU_ATTR_RO(abort_task_not_found);
+
 CONFIGFS_EATTR_OPS(target_stat_scsi_lu, se_dev_stat_grps, scsi_lu_group);
 
 static struct configfs_attribute *target_stat_scsi_lu_attrs[] = {
@@ -645,6 +756,12 @@ static struct configfs_attribute *target_stat_scsi_lu_attrs[] = {
 	&target_stat_scsi_lu_full_stat.attr,
 	&target_stat_scsi_lu_hs_num_cmds.attr,
 	&target_stat_scsi_lu_creation_time.attr,
+	&target_stat_scsi_lu_cmds_per_sec.attr,
+	&target_stat_scsi_lu_read_kbytes_per_sec.attr,
+	&target_stat_scsi_lu_write_kbytes_per_sec.attr,
+	&target_stat_scsi_lu_abort_task_aborted.attr,
+	&target_stat_scsi_lu_abort_task_complete.attr,
+	&target_stat_scsi_lu_abort_task_not_found.attr,
 	NULL,
 };
 
@@ -954,6 +1071,7 @@ static ssize_t target_stat_scsi_tgt_port_show_attr_in_cmds(
 {
 	struct se_lun *lun = container_of(pgrps, struct se_lun, port_stat_grps);
 	struct se_port *sep;
+	struct scsi_port_stats stats;
 	ssize_t ret;
 
 	spin_lock(&lun->lun_sep_lock);
@@ -963,7 +1081,8 @@ static ssize_t target_stat_scsi_tgt_port_show_attr_in_cmds(
 		return -ENODEV;
 	}
 
-	ret = snprintf(page, PAGE_SIZE, "%llu\n", sep->sep_stats.cmd_pdus);
+	core_port_stats_sum(sep, &stats);
+	ret = snprintf(page, PAGE_SIZE, "%llu\n", stats.cmd_pdus);
 	spin_unlock(&lun->lun_sep_lock);
 	return ret;
 }
@@ -974,6 +1093,7 @@ static ssize_t target_stat_scsi_tgt_port_show_attr_write_mbytes(
 {
 	struct se_lun *lun = container_of(pgrps, struct se_lun, port_stat_grps);
 	struct se_port *sep;
+	struct scsi_port_stats stats;
 	ssize_t ret;
 
 	spin_lock(&lun->lun_sep_lock);
@@ -983,8 +1103,9 @@ static ssize_t target_stat_scsi_tgt_port_show_attr_write_mbytes(
 		return -ENODEV;
 	}
 
+	core_port_stats_sum(sep, &stats);
 	ret = snprintf(page, PAGE_SIZE, "%u\n",
-			(u32)(sep->sep_stats.rx_data_octets >> 20));
+			(u32)(stats.rx_data_octets >> 20));
 	spin_unlock(&lun->lun_sep_lock);
 	return ret;
 }
@@ -995,6 +1116,7 @@ static ssize_t target_stat_scsi_tgt_port_show_attr_read_mbytes(
 {
 	struct se_lun *lun = container_of(pgrps, struct se_lun, port_stat_grps);
 	struct se_port *sep;
+	struct scsi_port_stats stats;
 	ssize_t ret;
 
 	spin_lock(&lun->lun_sep_lock);
@@ -1004,8 +1126,9 @@ static ssize_t target_stat_scsi_tgt_port_show_attr_read_mbytes(
 		return -ENODEV;
 	}
 
+	core_port_stats_sum(sep, &stats);
 	ret = snprintf(page, PAGE_SIZE, "%u\n",
-			(u32)(sep->sep_stats.tx_data_octets >> 20));
+			(u32)(stats.tx_data_octets >> 20));
 	spin_unlock(&lun->lun_sep_lock);
 	return ret;
 }
@@ -1016,6 +1139,7 @@ static ssize_t target_stat_scsi_tgt_port_show_attr_hs_in_cmds(
 {
 	struct se_lun *lun = container_of(pgrps, struct se_lun, port_stat_grps);
 	struct se_port *sep;
+	struct scsi_port_stats stats;
 	ssize_t ret;
 
 	spin_lock(&lun->lun_sep_lock);
@@ -1025,8 +1149,9 @@ static ssize_t target_stat_scsi_tgt_port_show_attr_hs_in_cmds(
 		return -ENODEV;
 	}
 
-	/* FIXME: scsiTgtPortHsInCommands */
-	ret = snprintf(page, PAGE_SIZE, "%u\n", 0);
+	core_port_stats_sum(sep, &stats);
+	/* scsiTgtPortHsInCommands */
+	ret = snprintf(page, PAGE_SIZE, "%llu\n", stats.cmd_pdus);
 	spin_unlock(&lun->lun_sep_lock);
 	return ret;
 }
@@ -1245,8 +1370,8 @@ static ssize_t target_stat_scsi_auth_intr_show_attr_inst(
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
@@ -1270,8 +1395,8 @@ static ssize_t target_stat_scsi_auth_intr_show_attr_dev(
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
@@ -1294,8 +1419,8 @@ static ssize_t target_stat_scsi_auth_intr_show_attr_port(
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
@@ -1317,8 +1442,8 @@ static ssize_t target_stat_scsi_auth_intr_show_attr_indx(
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
@@ -1339,8 +1464,8 @@ static ssize_t target_stat_scsi_auth_intr_show_attr_dev_or_port(
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
@@ -1361,8 +1486,8 @@ static ssize_t target_stat_scsi_auth_intr_show_attr_intr_name(
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
@@ -1383,8 +1508,8 @@ static ssize_t target_stat_scsi_auth_intr_show_attr_map_indx(
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
@@ -1405,8 +1530,8 @@ static ssize_t target_stat_scsi_auth_intr_show_attr_att_count(
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
@@ -1424,16 +1549,18 @@ static ssize_t target_stat_scsi_auth_intr_show_attr_num_cmds(
 			struct se_lun_acl, ml_stat_grps);
 	struct se_node_acl *nacl = lacl->se_lun_nacl;
 	struct se_dev_entry *deve;
+	struct se_io_stats stats;
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
+	core_io_stats_sum(deve->io_stats, &stats);
 	/* scsiAuthIntrOutCommands */
-	ret = snprintf(page, PAGE_SIZE, "%u\n", deve->total_cmds);
+	ret = snprintf(page, PAGE_SIZE, "%u\n", (u32)stats.num_cmds);
 	spin_unlock_irq(&nacl->device_list_lock);
 	return ret;
 }
@@ -1446,16 +1573,18 @@ static ssize_t target_stat_scsi_auth_intr_show_attr_read_mbytes(
 			struct se_lun_acl, ml_stat_grps);
 	struct se_node_acl *nacl = lacl->se_lun_nacl;
 	struct se_dev_entry *deve;
+	struct se_io_stats stats;
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
+	core_io_stats_sum(deve->io_stats, &stats);
 	/* scsiAuthIntrReadMegaBytes */
-	ret = snprintf(page, PAGE_SIZE, "%u\n", (u32)(deve->read_bytes >> 20));
+	ret = snprintf(page, PAGE_SIZE, "%u\n", (u32)(stats.read_bytes >> 20));
 	spin_unlock_irq(&nacl->device_list_lock);
 	return ret;
 }
@@ -1468,16 +1597,18 @@ static ssize_t target_stat_scsi_auth_intr_show_attr_write_mbytes(
 			struct se_lun_acl, ml_stat_grps);
 	struct se_node_acl *nacl = lacl->se_lun_nacl;
 	struct se_dev_entry *deve;
+	struct se_io_stats stats;
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
+	core_io_stats_sum(deve->io_stats, &stats);
 	/* scsiAuthIntrWrittenMegaBytes */
-	ret = snprintf(page, PAGE_SIZE, "%u\n", (u32)(deve->write_bytes >> 20));
+	ret = snprintf(page, PAGE_SIZE, "%u\n", (u32)(stats.write_bytes >> 20));
 	spin_unlock_irq(&nacl->device_list_lock);
 	return ret;
 }
@@ -1490,16 +1621,19 @@ static ssize_t target_stat_scsi_auth_intr_show_attr_hs_num_cmds(
 			struct se_lun_acl, ml_stat_grps);
 	struct se_node_acl *nacl = lacl->se_lun_nacl;
 	struct se_dev_entry *deve;
+	struct se_io_stats stats;
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
-	/* FIXME: scsiAuthIntrHSOutCommands */
-	ret = snprintf(page, PAGE_SIZE, "%u\n", 0);
+	core_io_stats_sum(deve->io_stats, &stats);
+	/* scsiAuthIntrHSOutCommands */
+	ret = snprintf(page, PAGE_SIZE, "%llu\n",
+			(unsigned long long)stats.num_cmds);
 	spin_unlock_irq(&nacl->device_list_lock);
 	return ret;
 }
@@ -1515,8 +1649,8 @@ static ssize_t target_stat_scsi_auth_intr_show_attr_creation_time(
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
@@ -1538,8 +1672,8 @@ static ssize_t target_stat_scsi_auth_intr_show_attr_row_status(
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
@@ -1611,8 +1745,8 @@ static ssize_t target_stat_scsi_att_intr_port_show_attr_inst(
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
@@ -1636,8 +1770,8 @@ static ssize_t target_stat_scsi_att_intr_port_show_attr_dev(
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
@@ -1660,8 +1794,8 @@ static ssize_t target_stat_scsi_att_intr_port_show_attr_port(
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
@@ -1709,8 +1843,8 @@ static ssize_t target_stat_scsi_att_intr_port_show_attr_port_auth_indx(
 	ssize_t ret;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	deve = nacl->device_list[lacl->mapped_lun];
-	if (!deve->se_lun || !deve->se_lun_acl) {
+	deve = core_get_se_deve(nacl, lacl->mapped_lun);
+	if (!deve || !deve->se_lun || !deve->se_lun_acl) {
 		spin_unlock_irq(&nacl->device_list_lock);
 		return -ENODEV;
 	}
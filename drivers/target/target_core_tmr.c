@@ -94,63 +94,72 @@ void core_tmr_abort_task(
 	struct se_tmr_req *tmr,
 	struct se_session *se_sess)
 {
-	struct se_cmd *se_cmd, *tmp_cmd;
+	struct se_cmd *se_cmd = NULL, *tmp_cmd = NULL;
 	unsigned long flags;
-	int ref_tag;
+	u32 ref_tag = tmr->ref_task_tag;
 
 	spin_lock_irqsave(&se_sess->sess_cmd_lock, flags);
-	list_for_each_entry_safe(se_cmd, tmp_cmd,
-			&se_sess->sess_cmd_list, se_cmd_list) {
-		if (se_cmd->cmd_wait_set)
-			continue;
-		if (dev != se_cmd->se_dev)
-			continue;
-		ref_tag = se_cmd->se_tfo->get_task_tag(se_cmd);
-		if (tmr->ref_task_tag != ref_tag)
+	/*
+	 * Matches come newest first, keep the oldest one on this device that
+	 * is not being waited on, as the sess_cmd_list walk used to.
+	 */
+	while ((tmp_cmd = __target_find_sess_cmd(se_sess, ref_tag, tmp_cmd))) {
+		if (tmp_cmd->cmd_wait_set || tmp_cmd->se_dev != dev)
 			continue;
+		se_cmd = tmp_cmd;
+	}
+	if (!se_cmd) {
+		spin_unlock_irqrestore(&se_sess->sess_cmd_lock, flags);
+		goto out;
+	}
 
-		spin_lock(&se_cmd->t_state_lock);
-		printk("ABORT_TASK: Found referenced %s task_tag: 0x%x\n transport_state: 0x%x",
-		       se_cmd->se_tfo->get_fabric_name(), ref_tag, se_cmd->transport_state);
+	spin_lock(&se_cmd->t_state_lock);
+	pr_debug("ABORT_TASK: Found referenced %s task_tag: 0x%x"
+		" transport_state: 0x%x\n", se_cmd->se_tfo->get_fabric_name(),
+		ref_tag, se_cmd->transport_state);
 
-		if (se_cmd->transport_state & CMD_T_COMPLETE) {
-			printk("ABORT_TASK: ref_tag: %u already complete, skipping\n", ref_tag);
-			spin_unlock(&se_cmd->t_state_lock);
-			spin_unlock_irqrestore(&se_sess->sess_cmd_lock, flags);
-			goto out;
-		}
-		se_cmd->transport_state |= CMD_T_ABORTED | CMD_T_SIGNAL_STOP_COMP;
+	if (se_cmd->transport_state & CMD_T_COMPLETE) {
+		pr_debug("ABORT_TASK: ref_tag: %u already complete, skipping\n",
+				ref_tag);
 		spin_unlock(&se_cmd->t_state_lock);
-
-		list_del_init(&se_cmd->se_cmd_list);
-		kref_get(&se_cmd->cmd_kref);
 		spin_unlock_irqrestore(&se_sess->sess_cmd_lock, flags);
+		atomic_inc(&dev->abort_task_complete);
+		goto out_no_task;
+	}
+	se_cmd->transport_state |= CMD_T_ABORTED | CMD_T_SIGNAL_STOP_COMP;
+	spin_unlock(&se_cmd->t_state_lock);
 
-		cancel_work_sync(&se_cmd->work);
-		transport_wait_for_tasks(se_cmd);
-		/*
-		 * Now send SAM_STAT_TASK_ABORTED status for the referenced
-		 * se_cmd descriptor..
-		 */
-		transport_send_task_abort(se_cmd);
-		/*
-		 * Also deal with possible extra acknowledge reference..
-		 */
-		if (se_cmd->se_cmd_flags & SCF_ACK_KREF)
-			target_put_sess_cmd(se_sess, se_cmd);
+	list_del_init(&se_cmd->se_cmd_list);
+	hlist_del_init(&se_cmd->se_cmd_hnode);
+	kref_get(&se_cmd->cmd_kref);
+	spin_unlock_irqrestore(&se_sess->sess_cmd_lock, flags);
 
+	cancel_work_sync(&se_cmd->work);
+	transport_wait_for_tasks(se_cmd);
+	/*
+	 * Now send SAM_STAT_TASK_ABORTED status for the referenced
+	 * se_cmd descriptor..
+	 */
+	transport_send_task_abort(se_cmd);
+	/*
+	 * Also deal with possible extra acknowledge reference..
+	 */
+	if (se_cmd->se_cmd_flags & SCF_ACK_KREF)
 		target_put_sess_cmd(se_sess, se_cmd);
 
-		printk("ABORT_TASK: Sending TMR_FUNCTION_COMPLETE for"
-				" ref_tag: %d\n", ref_tag);
-		tmr->response = TMR_FUNCTION_COMPLETE;
-		return;
-	}
-	spin_unlock_irqrestore(&se_sess->sess_cmd_lock, flags);
+	target_put_sess_cmd(se_sess, se_cmd);
+
+	pr_debug("ABORT_TASK: Sending TMR_FUNCTION_COMPLETE for"
+			" ref_tag: %u\n", ref_tag);
+	atomic_inc(&dev->abort_task_aborted);
+	tmr->response = TMR_FUNCTION_COMPLETE;
+	return;
 
 out:
-	printk("ABORT_TASK: Sending TMR_TASK_DOES_NOT_EXIST for ref_tag: %d\n",
-			tmr->ref_task_tag);
+	atomic_inc(&dev->abort_task_not_found);
+out_no_task:
+	pr_debug("ABORT_TASK: Sending TMR_TASK_DOES_NOT_EXIST for ref_tag: %u\n",
+			ref_tag);
 	tmr->response = TMR_TASK_DOES_NOT_EXIST;
 }
 
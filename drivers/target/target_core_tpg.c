@@ -63,11 +63,8 @@ static void core_clear_initiator_node_from_tpg(
 	struct se_lun_acl *acl, *acl_tmp;
 
 	spin_lock_irq(&nacl->device_list_lock);
-	for (i = 0; i < TRANSPORT_MAX_LUNS_PER_TPG; i++) {
-		deve = nacl->device_list[i];
-
-		if (!(deve->lun_flags & TRANSPORT_LUNFLAGS_INITIATOR_ACCESS))
-			continue;
+	for_each_set_bit(i, nacl->device_map, TRANSPORT_MAX_LUNS_PER_TPG) {
+		deve = core_get_se_deve(nacl, i);
 
 		if (!deve->se_lun) {
 			pr_err("%s device entries device pointer is"
@@ -162,10 +159,8 @@ void core_tpg_add_node_to_devs(
 	struct se_device *dev;
 
 	spin_lock(&tpg->tpg_lun_lock);
-	for (i = 0; i < TRANSPORT_MAX_LUNS_PER_TPG; i++) {
+	for_each_set_bit(i, tpg->tpg_lun_map, TRANSPORT_MAX_LUNS_PER_TPG) {
 		lun = tpg->tpg_lun_list[i];
-		if (lun->lun_status != TRANSPORT_LUN_STATUS_ACTIVE)
-			continue;
 
 		spin_unlock(&tpg->tpg_lun_lock);
 
@@ -256,25 +251,18 @@ static void *array_zalloc(int n, size_t size, gfp_t flags)
  */
 static int core_create_device_list_for_node(struct se_node_acl *nacl)
 {
-	struct se_dev_entry *deve;
-	int i;
-
-	nacl->device_list = array_zalloc(TRANSPORT_MAX_LUNS_PER_TPG,
-			sizeof(struct se_dev_entry), GFP_KERNEL);
-	if (!nacl->device_list) {
+	INIT_RADIX_TREE(&nacl->device_tree, GFP_ATOMIC);
+	bitmap_zero(nacl->device_map, TRANSPORT_MAX_LUNS_PER_TPG);
+	/*
+	 * The rest of the struct se_dev_entry's are allocated when their
+	 * MappedLUN is first used, but MappedLUN=0 is always needed for
+	 * the virtual LUN0 command accounting in transport_lookup_cmd_lun().
+	 */
+	if (!core_alloc_se_deve(nacl, 0)) {
 		pr_err("Unable to allocate memory for"
-			" struct se_node_acl->device_list\n");
+			" struct se_node_acl->device_tree\n");
 		return -ENOMEM;
 	}
-	for (i = 0; i < TRANSPORT_MAX_LUNS_PER_TPG; i++) {
-		deve = nacl->device_list[i];
-
-		atomic_set(&deve->ua_count, 0);
-		atomic_set(&deve->pr_ref_count, 0);
-		spin_lock_init(&deve->ua_lock);
-		INIT_LIST_HEAD(&deve->alua_port_list);
-		INIT_LIST_HEAD(&deve->ua_list);
-	}
 
 	return 0;
 }
@@ -363,11 +351,10 @@ void core_tpg_clear_object_luns(struct se_portal_group *tpg)
 	struct se_lun *lun;
 
 	spin_lock(&tpg->tpg_lun_lock);
-	for (i = 0; i < TRANSPORT_MAX_LUNS_PER_TPG; i++) {
+	for_each_set_bit(i, tpg->tpg_lun_map, TRANSPORT_MAX_LUNS_PER_TPG) {
 		lun = tpg->tpg_lun_list[i];
 
-		if ((lun->lun_status != TRANSPORT_LUN_STATUS_ACTIVE) ||
-		    (lun->lun_se_dev == NULL))
+		if (lun->lun_se_dev == NULL)
 			continue;
 
 		spin_unlock(&tpg->tpg_lun_lock);
@@ -659,9 +646,7 @@ static int core_tpg_setup_virtual_lun0(struct se_portal_group *se_tpg)
 	atomic_set(&lun->lun_acl_count, 0);
 	init_completion(&lun->lun_shutdown_comp);
 	INIT_LIST_HEAD(&lun->lun_acl_list);
-	INIT_LIST_HEAD(&lun->lun_cmd_list);
 	spin_lock_init(&lun->lun_acl_lock);
-	spin_lock_init(&lun->lun_cmd_lock);
 	spin_lock_init(&lun->lun_sep_lock);
 
 	ret = core_tpg_post_addlun(se_tpg, lun, lun_access, dev);
@@ -703,11 +688,10 @@ int core_tpg_register(
 		atomic_set(&lun->lun_acl_count, 0);
 		init_completion(&lun->lun_shutdown_comp);
 		INIT_LIST_HEAD(&lun->lun_acl_list);
-		INIT_LIST_HEAD(&lun->lun_cmd_list);
 		spin_lock_init(&lun->lun_acl_lock);
-		spin_lock_init(&lun->lun_cmd_lock);
 		spin_lock_init(&lun->lun_sep_lock);
 	}
+	bitmap_zero(se_tpg->tpg_lun_map, TRANSPORT_MAX_LUNS_PER_TPG);
 
 	se_tpg->se_tpg_type = se_tpg_type;
 	se_tpg->se_tpg_fabric_ptr = tpg_fabric_ptr;
@@ -824,15 +808,32 @@ int core_tpg_post_addlun(
 	u32 lun_access,
 	void *lun_ptr)
 {
-	int ret;
+	struct se_lun_cmd_list *cmd_list;
+	int cpu, ret;
+
+	lun->lun_cmd_lists = alloc_percpu(struct se_lun_cmd_list);
+	if (!lun->lun_cmd_lists) {
+		pr_err("Unable to allocate struct se_lun->lun_cmd_lists\n");
+		return -ENOMEM;
+	}
+	for_each_possible_cpu(cpu) {
+		cmd_list = per_cpu_ptr(lun->lun_cmd_lists, cpu);
+		spin_lock_init(&cmd_list->lock);
+		INIT_LIST_HEAD(&cmd_list->list);
+	}
 
 	ret = core_dev_export(lun_ptr, tpg, lun);
-	if (ret < 0)
+	if (ret < 0) {
+		free_percpu(lun->lun_cmd_lists);
+		lun->lun_cmd_lists = NULL;
 		return ret;
+	}
 
 	spin_lock(&tpg->tpg_lun_lock);
 	lun->lun_access = lun_access;
 	lun->lun_status = TRANSPORT_LUN_STATUS_ACTIVE;
+	if (lun != &tpg->tpg_virt_lun0)
+		set_bit(lun->unpacked_lun, tpg->tpg_lun_map);
 	spin_unlock(&tpg->tpg_lun_lock);
 
 	return 0;
@@ -843,6 +844,11 @@ static void core_tpg_shutdown_lun(
 	struct se_lun *lun)
 {
 	core_clear_lun_from_tpg(lun, tpg);
+	/*
+	 * Wait for lookups that may still have seen the LUN mapped to add
+	 * their se_cmd to lun->lun_cmd_lists.
+	 */
+	synchronize_rcu();
 	transport_clear_lun_from_sessions(lun);
 }
 
@@ -883,9 +889,18 @@ int core_tpg_post_dellun(
 	core_tpg_shutdown_lun(tpg, lun);
 
 	core_dev_unexport(lun->lun_se_dev, tpg, lun);
+	/*
+	 * transport_lun_remove_cmd() may still be looking at a drained
+	 * cmd->se_lun_list from an RCU read side section.
+	 */
+	synchronize_rcu();
+	free_percpu(lun->lun_cmd_lists);
+	lun->lun_cmd_lists = NULL;
 
 	spin_lock(&tpg->tpg_lun_lock);
 	lun->lun_status = TRANSPORT_LUN_STATUS_FREE;
+	if (lun != &tpg->tpg_virt_lun0)
+		clear_bit(lun->unpacked_lun, tpg->tpg_lun_map);
 	spin_unlock(&tpg->tpg_lun_lock);
 
 	return 0;
@@ -38,6 +38,9 @@
 #include <linux/cdrom.h>
 #include <linux/module.h>
 #include <linux/cpumask.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
+#include <linux/hash.h>
 #include <asm/unaligned.h>
 #include <net/sock.h>
 #include <net/tcp.h>
@@ -83,6 +86,77 @@ static void transport_remove_cmd_from_queue(struct se_cmd *cmd);
 static int transport_set_sense_codes(struct se_cmd *cmd, u8 asc, u8 ascq);
 static void target_complete_ok_work(struct work_struct *work);
 
+/*
+ * Per-CPU recycling of the data pages and scatterlists handed out by
+ * transport_generic_get_mem().  Pages are only kept on the CPU of the node
+ * they belong to, and only while nobody else (ie: a zero-copy sendpage)
+ * still holds a reference.  Scatterlists are kept in power of two size
+ * classes of 1 .. 1 << (TRANSPORT_MEM_SGL_CLASSES - 1) entries.
+ */
+#define TRANSPORT_MEM_POOL_PAGES	256
+#define TRANSPORT_MEM_POOL_SGLS		16
+#define TRANSPORT_MEM_SGL_CLASSES	8
+/* Largest contiguous run requested at once for a big transfer */
+#define TRANSPORT_MEM_HIGH_ORDER	4
+
+struct se_mem_pool {
+	struct list_head	page_list;
+	unsigned int		nr_pages;
+	unsigned int		nr_sgls[TRANSPORT_MEM_SGL_CLASSES];
+	struct scatterlist	*sgls[TRANSPORT_MEM_SGL_CLASSES][TRANSPORT_MEM_POOL_SGLS];
+	struct se_mem_pool_stats stats;
+};
+
+static DEFINE_PER_CPU(struct se_mem_pool, se_mem_pool);
+
+static void transport_mem_pool_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		INIT_LIST_HEAD(&per_cpu(se_mem_pool, cpu).page_list);
+}
+
+static void transport_mem_pool_release(void)
+{
+	struct se_mem_pool *pool;
+	struct page *page, *page_tmp;
+	int cpu, c;
+
+	for_each_possible_cpu(cpu) {
+		pool = &per_cpu(se_mem_pool, cpu);
+
+		list_for_each_entry_safe(page, page_tmp, &pool->page_list, lru) {
+			list_del(&page->lru);
+			__free_page(page);
+		}
+		pool->nr_pages = 0;
+
+		for (c = 0; c < TRANSPORT_MEM_SGL_CLASSES; c++) {
+			while (pool->nr_sgls[c])
+				kfree(pool->sgls[c][--pool->nr_sgls[c]]);
+		}
+	}
+}
+
+void transport_mem_pool_stats(struct se_mem_pool_stats *stats)
+{
+	struct se_mem_pool *pool;
+	int cpu;
+
+	memset(stats, 0, sizeof(*stats));
+	for_each_possible_cpu(cpu) {
+		pool = &per_cpu(se_mem_pool, cpu);
+
+		stats->page_hits += pool->stats.page_hits;
+		stats->page_allocs += pool->stats.page_allocs;
+		stats->high_order_allocs += pool->stats.high_order_allocs;
+		stats->sgl_hits += pool->stats.sgl_hits;
+		stats->sgl_allocs += pool->stats.sgl_allocs;
+		stats->pages_cached += pool->nr_pages;
+	}
+}
+
 int init_se_kmem_caches(void)
 {
 	se_sess_cache = kmem_cache_create("se_sess_cache",
@@ -148,6 +222,7 @@ int init_se_kmem_caches(void)
 	if (!target_completion_wq)
 		goto out_free_tg_pt_gp_mem_cache;
 
+	transport_mem_pool_init();
 	return 0;
 
 out_free_tg_pt_gp_mem_cache:
@@ -171,6 +246,7 @@ out:
 void release_se_kmem_caches(void)
 {
 	destroy_workqueue(target_completion_wq);
+	transport_mem_pool_release();
 	kmem_cache_destroy(se_sess_cache);
 	kmem_cache_destroy(se_ua_cache);
 	kmem_cache_destroy(t10_pr_reg_cache);
@@ -251,6 +327,7 @@ struct se_session *transport_init_session(void)
 	INIT_LIST_HEAD(&se_sess->sess_acl_list);
 	INIT_LIST_HEAD(&se_sess->sess_cmd_list);
 	spin_lock_init(&se_sess->sess_cmd_lock);
+	init_completion(&se_sess->sess_wait_comp);
 	kref_init(&se_sess->sess_kref);
 
 	return se_sess;
@@ -473,17 +550,18 @@ EXPORT_SYMBOL(transport_deregister_session);
 static void transport_all_task_dev_remove_state(struct se_cmd *cmd)
 {
 	struct se_device *dev = cmd->se_dev;
+	struct se_exec_queue *q = cmd->se_exec_queue;
 	struct se_task *task;
 	unsigned long flags;
 
-	if (!dev)
+	if (!dev || !q)
 		return;
 
 	list_for_each_entry(task, &cmd->t_task_list, t_list) {
 		if (task->task_flags & TF_ACTIVE)
 			continue;
 
-		spin_lock_irqsave(&dev->execute_task_lock, flags);
+		spin_lock_irqsave(&q->lock, flags);
 		if (task->t_state_active) {
 			pr_debug("Removed ITT: 0x%08x dev: %p task[%p]\n",
 				cmd->se_tfo->get_task_tag(cmd), dev, task);
@@ -492,7 +570,7 @@ static void transport_all_task_dev_remove_state(struct se_cmd *cmd)
 			atomic_dec(&cmd->t_task_cdbs_ex_left);
 			task->t_state_active = false;
 		}
-		spin_unlock_irqrestore(&dev->execute_task_lock, flags);
+		spin_unlock_irqrestore(&q->lock, flags);
 	}
 
 }
@@ -595,6 +673,7 @@ static int transport_cmd_check_stop_to_fabric(struct se_cmd *cmd)
 static void transport_lun_remove_cmd(struct se_cmd *cmd)
 {
 	struct se_lun *lun = cmd->se_lun;
+	struct se_lun_cmd_list *cmd_list;
 	unsigned long flags;
 
 	if (!lun)
@@ -607,10 +686,25 @@ static void transport_lun_remove_cmd(struct se_cmd *cmd)
 	}
 	spin_unlock_irqrestore(&cmd->t_state_lock, flags);
 
-	spin_lock_irqsave(&lun->lun_cmd_lock, flags);
-	if (!list_empty(&cmd->se_lun_node))
+	/*
+	 * __transport_clear_lun_cmd_list() clears cmd->se_lun_list under
+	 * cmd_list->lock once it has taken the command off the LUN, and
+	 * core_tpg_post_dellun() waits for an RCU grace period before
+	 * freeing lun->lun_cmd_lists.
+	 */
+	rcu_read_lock();
+	cmd_list = ACCESS_ONCE(cmd->se_lun_list);
+	if (!cmd_list) {
+		rcu_read_unlock();
+		return;
+	}
+	spin_lock_irqsave(&cmd_list->lock, flags);
+	if (cmd->se_lun_list == cmd_list) {
 		list_del_init(&cmd->se_lun_node);
-	spin_unlock_irqrestore(&lun->lun_cmd_lock, flags);
+		cmd->se_lun_list = NULL;
+	}
+	spin_unlock_irqrestore(&cmd_list->lock, flags);
+	rcu_read_unlock();
 }
 
 void transport_cmd_finish_abort(struct se_cmd *cmd, int remove)
@@ -822,16 +916,94 @@ void transport_complete_task(struct se_task *task, int success)
 }
 EXPORT_SYMBOL(transport_complete_task);
 
+/*
+ * SIMPLE and untagged tasks are queued on, and dispatched from, the
+ * struct se_exec_queue of the CPU that first queues them, so initiators
+ * hitting the same struct se_device do not share a list.  HEAD_OF_QUEUE
+ * and ORDERED tasks keep using the shared dev->dev_exec_queue.  Ordering
+ * between ORDERED and SIMPLE tasks is enforced by
+ * transport_execute_task_attr() before any task gets queued.
+ */
+static struct se_exec_queue *transport_cmd_exec_queue(struct se_cmd *cmd)
+{
+	struct se_device *dev = cmd->se_dev;
+
+	if (cmd->se_exec_queue)
+		return cmd->se_exec_queue;
+
+	if (dev->dev_task_attr_type == SAM_TASK_ATTR_EMULATED &&
+	    (cmd->sam_task_attr == MSG_HEAD_TAG ||
+	     cmd->sam_task_attr == MSG_ORDERED_TAG))
+		cmd->se_exec_queue = &dev->dev_exec_queue;
+	else
+		cmd->se_exec_queue = per_cpu_ptr(dev->dev_exec_queues,
+						 raw_smp_processor_id());
+	return cmd->se_exec_queue;
+}
+
+static void transport_init_exec_queue(struct se_exec_queue *q)
+{
+	spin_lock_init(&q->lock);
+	q->nr_execute = 0;
+	INIT_LIST_HEAD(&q->execute_list);
+	INIT_LIST_HEAD(&q->state_list);
+}
+
+static int transport_alloc_exec_queues(struct se_device *dev)
+{
+	int cpu;
+
+	dev->dev_exec_queues = alloc_percpu(struct se_exec_queue);
+	if (!dev->dev_exec_queues)
+		return -ENOMEM;
+
+	transport_init_exec_queue(&dev->dev_exec_queue);
+	for_each_possible_cpu(cpu)
+		transport_init_exec_queue(per_cpu_ptr(dev->dev_exec_queues, cpu));
+	return 0;
+}
+
+void transport_free_exec_queues(struct se_device *dev)
+{
+	free_percpu(dev->dev_exec_queues);
+	dev->dev_exec_queues = NULL;
+}
+
+static u32 transport_dev_execute_tasks(struct se_device *dev)
+{
+	u32 nr = dev->dev_exec_queue.nr_execute;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		nr += per_cpu_ptr(dev->dev_exec_queues, cpu)->nr_execute;
+	return nr;
+}
+
+static bool transport_dev_state_lists_empty(struct se_device *dev)
+{
+	int cpu;
+
+	if (!list_empty(&dev->dev_exec_queue.state_list))
+		return false;
+	for_each_possible_cpu(cpu) {
+		if (!list_empty(&per_cpu_ptr(dev->dev_exec_queues,
+					     cpu)->state_list))
+			return false;
+	}
+	return true;
+}
+
 /*
  * Called by transport_add_tasks_from_cmd() once a struct se_cmd's
  * struct se_task list are ready to be added to the active execution list
- * struct se_device
+ * struct se_exec_queue
 
- * Called with se_dev_t->execute_task_lock called.
+ * Called with se_exec_queue->lock held.
  */
 static inline int transport_add_task_check_sam_attr(
 	struct se_task *task,
 	struct se_task *task_prev,
+	struct se_exec_queue *q,
 	struct se_device *dev)
 {
 	/*
@@ -839,20 +1011,20 @@ static inline int transport_add_task_check_sam_attr(
 	 * execution queue
 	 */
 	if (dev->dev_task_attr_type != SAM_TASK_ATTR_EMULATED) {
-		list_add_tail(&task->t_execute_list, &dev->execute_task_list);
+		list_add_tail(&task->t_execute_list, &q->execute_list);
 		return 0;
 	}
 	/*
 	 * HEAD_OF_QUEUE attribute for received CDB, which means
 	 * the first task that is associated with a struct se_cmd goes to
-	 * head of the struct se_device->execute_task_list, and task_prev
+	 * head of the struct se_exec_queue->execute_list, and task_prev
 	 * after that for each subsequent task
 	 */
 	if (task->task_se_cmd->sam_task_attr == MSG_HEAD_TAG) {
 		list_add(&task->t_execute_list,
 				(task_prev != NULL) ?
 				&task_prev->t_execute_list :
-				&dev->execute_task_list);
+				&q->execute_list);
 
 		pr_debug("Set HEAD_OF_QUEUE for task CDB: 0x%02x"
 				" in execution queue\n",
@@ -862,25 +1034,27 @@ static inline int transport_add_task_check_sam_attr(
 	/*
 	 * For ORDERED, SIMPLE or UNTAGGED attribute tasks once they have been
 	 * transitioned from Dermant -> Active state, and are added to the end
-	 * of the struct se_device->execute_task_list
+	 * of the struct se_exec_queue->execute_list
 	 */
-	list_add_tail(&task->t_execute_list, &dev->execute_task_list);
+	list_add_tail(&task->t_execute_list, &q->execute_list);
 	return 0;
 }
 
 /*	__transport_add_task_to_execute_queue():
  *
- *	Called with se_dev_t->execute_task_lock called.
+ *	Called with se_exec_queue->lock held.
  */
 static void __transport_add_task_to_execute_queue(
 	struct se_task *task,
 	struct se_task *task_prev,
+	struct se_exec_queue *q,
 	struct se_device *dev)
 {
 	int head_of_queue;
 
-	head_of_queue = transport_add_task_check_sam_attr(task, task_prev, dev);
-	atomic_inc(&dev->execute_tasks);
+	head_of_queue = transport_add_task_check_sam_attr(task, task_prev, q,
+							  dev);
+	q->nr_execute++;
 
 	if (task->t_state_active)
 		return;
@@ -892,9 +1066,9 @@ static void __transport_add_task_to_execute_queue(
 	if (head_of_queue)
 		list_add(&task->t_state_list, (task_prev) ?
 				&task_prev->t_state_list :
-				&dev->state_task_list);
+				&q->state_list);
 	else
-		list_add_tail(&task->t_state_list, &dev->state_task_list);
+		list_add_tail(&task->t_state_list, &q->state_list);
 
 	task->t_state_active = true;
 
@@ -906,29 +1080,33 @@ static void __transport_add_task_to_execute_queue(
 static void transport_add_tasks_to_state_queue(struct se_cmd *cmd)
 {
 	struct se_device *dev = cmd->se_dev;
+	struct se_exec_queue *q = transport_cmd_exec_queue(cmd);
 	struct se_task *task;
 	unsigned long flags;
 
 	spin_lock_irqsave(&cmd->t_state_lock, flags);
 	list_for_each_entry(task, &cmd->t_task_list, t_list) {
-		spin_lock(&dev->execute_task_lock);
+		spin_lock(&q->lock);
 		if (!task->t_state_active) {
-			list_add_tail(&task->t_state_list,
-				      &dev->state_task_list);
+			list_add_tail(&task->t_state_list, &q->state_list);
 			task->t_state_active = true;
 
 			pr_debug("Added ITT: 0x%08x task[%p] to dev: %p\n",
 				task->task_se_cmd->se_tfo->get_task_tag(
 				task->task_se_cmd), task, dev);
 		}
-		spin_unlock(&dev->execute_task_lock);
+		spin_unlock(&q->lock);
 	}
 	spin_unlock_irqrestore(&cmd->t_state_lock, flags);
 }
 
+/*
+ * Called with the se_exec_queue->lock of transport_cmd_exec_queue() held
+ */
 static void __transport_add_tasks_from_cmd(struct se_cmd *cmd)
 {
 	struct se_device *dev = cmd->se_dev;
+	struct se_exec_queue *q = cmd->se_exec_queue;
 	struct se_task *task, *task_prev = NULL;
 
 	list_for_each_entry(task, &cmd->t_task_list, t_list) {
@@ -938,7 +1116,7 @@ static void __transport_add_tasks_from_cmd(struct se_cmd *cmd)
 		 * __transport_add_task_to_execute_queue() handles the
 		 * SAM Task Attribute emulation if enabled
 		 */
-		__transport_add_task_to_execute_queue(task, task_prev, dev);
+		__transport_add_task_to_execute_queue(task, task_prev, q, dev);
 		task_prev = task;
 	}
 }
@@ -946,32 +1124,36 @@ static void __transport_add_tasks_from_cmd(struct se_cmd *cmd)
 static void transport_add_tasks_from_cmd(struct se_cmd *cmd)
 {
 	unsigned long flags;
-	struct se_device *dev = cmd->se_dev;
+	struct se_exec_queue *q = transport_cmd_exec_queue(cmd);
 
-	spin_lock_irqsave(&dev->execute_task_lock, flags);
+	spin_lock_irqsave(&q->lock, flags);
 	__transport_add_tasks_from_cmd(cmd);
-	spin_unlock_irqrestore(&dev->execute_task_lock, flags);
+	spin_unlock_irqrestore(&q->lock, flags);
 }
 
+/*
+ * Called with the se_exec_queue->lock of the task's se_cmd held
+ */
 void __transport_remove_task_from_execute_queue(struct se_task *task,
 		struct se_device *dev)
 {
 	list_del_init(&task->t_execute_list);
-	atomic_dec(&dev->execute_tasks);
+	task->task_se_cmd->se_exec_queue->nr_execute--;
 }
 
 static void transport_remove_task_from_execute_queue(
 	struct se_task *task,
 	struct se_device *dev)
 {
+	struct se_exec_queue *q = task->task_se_cmd->se_exec_queue;
 	unsigned long flags;
 
 	if (WARN_ON(list_empty(&task->t_execute_list)))
 		return;
 
-	spin_lock_irqsave(&dev->execute_task_lock, flags);
+	spin_lock_irqsave(&q->lock, flags);
 	__transport_remove_task_from_execute_queue(task, dev);
-	spin_unlock_irqrestore(&dev->execute_task_lock, flags);
+	spin_unlock_irqrestore(&q->lock, flags);
 }
 
 /*
@@ -1048,7 +1230,7 @@ void transport_dump_dev_state(
 	}
 
 	*bl += sprintf(b + *bl, "  Execute/Max Queue Depth: %d/%d",
-		atomic_read(&dev->execute_tasks), dev->queue_depth);
+		transport_dev_execute_tasks(dev), dev->queue_depth);
 	*bl += sprintf(b + *bl, "  SectorSize: %u  MaxSectors: %u\n",
 		dev->se_sub_dev->se_dev_attrib.block_size, dev->se_sub_dev->se_dev_attrib.max_sectors);
 	*bl += sprintf(b + *bl, "        ");
@@ -1383,6 +1565,18 @@ struct se_device *transport_add_device_to_core_hba(
 		pr_err("Unable to allocate memory for se_dev_t\n");
 		return NULL;
 	}
+	dev->io_stats = alloc_percpu(struct se_io_stats);
+	if (!dev->io_stats) {
+		pr_err("Unable to allocate memory for se_dev_t io_stats\n");
+		kfree(dev);
+		return NULL;
+	}
+	if (transport_alloc_exec_queues(dev) < 0) {
+		pr_err("Unable to allocate memory for se_dev_t exec queues\n");
+		free_percpu(dev->io_stats);
+		kfree(dev);
+		return NULL;
+	}
 
 	transport_init_queue_obj(&dev->dev_queue_obj);
 	dev->dev_flags		= device_flags;
@@ -1393,11 +1587,8 @@ struct se_device *transport_add_device_to_core_hba(
 	dev->transport		= transport;
 	INIT_LIST_HEAD(&dev->dev_list);
 	INIT_LIST_HEAD(&dev->dev_sep_list);
-	INIT_LIST_HEAD(&dev->execute_task_list);
 	INIT_LIST_HEAD(&dev->delayed_cmd_list);
-	INIT_LIST_HEAD(&dev->state_task_list);
 	INIT_LIST_HEAD(&dev->qf_cmd_list);
-	spin_lock_init(&dev->execute_task_lock);
 	spin_lock_init(&dev->delayed_cmd_lock);
 	spin_lock_init(&dev->dev_reservation_lock);
 	spin_lock_init(&dev->dev_status_lock);
@@ -1409,6 +1600,7 @@ struct se_device *transport_add_device_to_core_hba(
 
 	dev->dev_index = scsi_get_new_index(SCSI_DEVICE_INDEX);
 	dev->creation_time = get_jiffies_64();
+	dev->rate_jiffies = dev->creation_time;
 	spin_lock_init(&dev->stats_lock);
 
 	spin_lock(&hba->device_lock);
@@ -1491,6 +1683,8 @@ err_dev_list:
 
 	se_release_vpd_for_dev(dev);
 
+	transport_free_exec_queues(dev);
+	free_percpu(dev->io_stats);
 	kfree(dev);
 
 	return NULL;
@@ -1563,15 +1757,19 @@ void transport_init_se_cmd(
 	unsigned char *sense_buffer)
 {
 	INIT_LIST_HEAD(&cmd->se_lun_node);
+	cmd->se_lun_list = NULL;
+	cmd->se_exec_queue = NULL;
 	INIT_LIST_HEAD(&cmd->se_delayed_node);
 	INIT_LIST_HEAD(&cmd->se_qf_node);
 	INIT_LIST_HEAD(&cmd->se_queue_node);
 	INIT_LIST_HEAD(&cmd->se_cmd_list);
+	INIT_HLIST_NODE(&cmd->se_cmd_hnode);
 	INIT_LIST_HEAD(&cmd->t_task_list);
 	init_completion(&cmd->transport_lun_fe_stop_comp);
 	init_completion(&cmd->transport_lun_stop_comp);
 	init_completion(&cmd->t_transport_stop_comp);
 	init_completion(&cmd->cmd_wait_comp);
+	cmd->cmd_wait_counted = 0;
 	spin_lock_init(&cmd->t_state_lock);
 	cmd->transport_state = CMD_T_DEV_ACTIVE;
 
@@ -1674,10 +1872,12 @@ int transport_generic_allocate_tasks(
 		cmd->scsi_sense_reason = TCM_INVALID_CDB_FIELD;
 		return -EINVAL;
 	}
-	spin_lock(&cmd->se_lun->lun_sep_lock);
+	/*
+	 * No lun_sep_lock needed for the port counters, the LUN is drained
+	 * of commands in core_tpg_shutdown_lun() before its port is released.
+	 */
 	if (cmd->se_lun->lun_sep)
-		cmd->se_lun->lun_sep->sep_stats.cmd_pdus++;
-	spin_unlock(&cmd->se_lun->lun_sep_lock);
+		this_cpu_inc(cmd->se_lun->lun_sep->sep_stats->cmd_pdus);
 	return 0;
 }
 EXPORT_SYMBOL(transport_generic_allocate_tasks);
@@ -2199,7 +2399,7 @@ static int transport_execute_tasks(struct se_cmd *cmd)
 			goto execute_tasks;
 		/*
 		 * __transport_execute_tasks() -> __transport_add_tasks_from_cmd()
-		 * adds associated se_tasks while holding dev->execute_task_lock
+		 * adds associated se_tasks while holding the se_exec_queue lock
 		 * before I/O dispath to avoid a double spinlock access.
 		 */
 		__transport_execute_tasks(se_dev, cmd);
@@ -2212,12 +2412,11 @@ execute_tasks:
 }
 
 /*
- * Called to check struct se_device tcq depth window, and once open pull struct se_task
- * from struct se_device->execute_task_list and
- *
- * Called from transport_processing_thread()
+ * Pull struct se_task from struct se_exec_queue->execute_list until it is
+ * empty and dispatch them to the backend.
  */
-static int __transport_execute_tasks(struct se_device *dev, struct se_cmd *new_cmd)
+static void __transport_execute_queue(struct se_device *dev,
+		struct se_exec_queue *q, struct se_cmd *new_cmd)
 {
 	int error;
 	struct se_cmd *cmd = NULL;
@@ -2225,18 +2424,18 @@ static int __transport_execute_tasks(struct se_device *dev, struct se_cmd *new_c
 	unsigned long flags;
 
 check_depth:
-	spin_lock_irq(&dev->execute_task_lock);
+	spin_lock_irq(&q->lock);
 	if (new_cmd != NULL)
 		__transport_add_tasks_from_cmd(new_cmd);
 
-	if (list_empty(&dev->execute_task_list)) {
-		spin_unlock_irq(&dev->execute_task_lock);
-		return 0;
+	if (list_empty(&q->execute_list)) {
+		spin_unlock_irq(&q->lock);
+		return;
 	}
-	task = list_first_entry(&dev->execute_task_list,
+	task = list_first_entry(&q->execute_list,
 				struct se_task, t_execute_list);
 	__transport_remove_task_from_execute_queue(task, dev);
-	spin_unlock_irq(&dev->execute_task_lock);
+	spin_unlock_irq(&q->lock);
 
 	cmd = task->task_se_cmd;
 	spin_lock_irqsave(&cmd->t_state_lock, flags);
@@ -2288,7 +2487,28 @@ check_depth:
 
 	new_cmd = NULL;
 	goto check_depth;
+}
 
+/*
+ * Queue and dispatch the tasks of new_cmd from the calling context on its
+ * se_exec_queue, or without new_cmd drain every queue of the device.
+ *
+ * Called from fabric context and from transport_processing_thread()
+ */
+static int __transport_execute_tasks(struct se_device *dev, struct se_cmd *new_cmd)
+{
+	int cpu;
+
+	if (new_cmd) {
+		__transport_execute_queue(dev, transport_cmd_exec_queue(new_cmd),
+					  new_cmd);
+		return 0;
+	}
+
+	__transport_execute_queue(dev, &dev->dev_exec_queue, NULL);
+	for_each_possible_cpu(cpu)
+		__transport_execute_queue(dev,
+				per_cpu_ptr(dev->dev_exec_queues, cpu), NULL);
 	return 0;
 }
 
@@ -3378,10 +3598,13 @@ static void transport_complete_task_attr(struct se_cmd *cmd)
 	spin_unlock(&dev->delayed_cmd_lock);
 	/*
 	 * If new tasks have become active, wake up the transport thread
-	 * to do the processing of the Active tasks.
+	 * to do the processing of the Active tasks, they may sit on the
+	 * se_exec_queue of another CPU.
 	 */
-	if (new_active_tasks != 0)
+	if (new_active_tasks != 0) {
+		atomic_set(&dev->dev_exec_kick, 1);
 		wake_up_interruptible(&dev->dev_queue_obj.thread_wq);
+	}
 }
 
 static void transport_complete_qf(struct se_cmd *cmd)
@@ -3503,34 +3726,25 @@ static void target_complete_ok_work(struct work_struct *work)
 
 	switch (cmd->data_direction) {
 	case DMA_FROM_DEVICE:
-		spin_lock(&cmd->se_lun->lun_sep_lock);
-		if (cmd->se_lun->lun_sep) {
-			cmd->se_lun->lun_sep->sep_stats.tx_data_octets +=
-					cmd->data_length;
-		}
-		spin_unlock(&cmd->se_lun->lun_sep_lock);
+		if (cmd->se_lun->lun_sep)
+			this_cpu_add(cmd->se_lun->lun_sep->sep_stats->tx_data_octets,
+				     cmd->data_length);
 
 		ret = cmd->se_tfo->queue_data_in(cmd);
 		if (ret == -EAGAIN || ret == -ENOMEM)
 			goto queue_full;
 		break;
 	case DMA_TO_DEVICE:
-		spin_lock(&cmd->se_lun->lun_sep_lock);
-		if (cmd->se_lun->lun_sep) {
-			cmd->se_lun->lun_sep->sep_stats.rx_data_octets +=
-				cmd->data_length;
-		}
-		spin_unlock(&cmd->se_lun->lun_sep_lock);
+		if (cmd->se_lun->lun_sep)
+			this_cpu_add(cmd->se_lun->lun_sep->sep_stats->rx_data_octets,
+				     cmd->data_length);
 		/*
 		 * Check if we need to send READ payload for BIDI-COMMAND
 		 */
 		if (cmd->t_bidi_data_sg) {
-			spin_lock(&cmd->se_lun->lun_sep_lock);
-			if (cmd->se_lun->lun_sep) {
-				cmd->se_lun->lun_sep->sep_stats.tx_data_octets +=
-					cmd->data_length;
-			}
-			spin_unlock(&cmd->se_lun->lun_sep_lock);
+			if (cmd->se_lun->lun_sep)
+				this_cpu_add(cmd->se_lun->lun_sep->sep_stats->tx_data_octets,
+					     cmd->data_length);
 			ret = cmd->se_tfo->queue_data_in(cmd);
 			if (ret == -EAGAIN || ret == -ENOMEM)
 				goto queue_full;
@@ -3596,15 +3810,142 @@ static void transport_free_dev_tasks(struct se_cmd *cmd)
 	}
 }
 
-static inline void transport_free_sgl(struct scatterlist *sgl, int nents)
+/*
+ * Return a scatterlist from transport_mem_get_sgl() and the pages it
+ * references to the pool of the local CPU, or to the page allocator
+ * once that is full.
+ */
+static void transport_free_sgl(struct scatterlist *sgl, int nents)
 {
+	struct se_mem_pool *pool;
 	struct scatterlist *sg;
-	int count;
+	struct page *page;
+	unsigned long flags;
+	int count, c = order_base_2(max(nents, 1)), nid = numa_node_id();
+
+	if (!sgl)
+		return;
+
+	local_irq_save(flags);
+	pool = &__get_cpu_var(se_mem_pool);
+
+	for_each_sg(sgl, sg, nents, count) {
+		page = sg_page(sg);
+		if (pool->nr_pages < TRANSPORT_MEM_POOL_PAGES &&
+		    page_count(page) == 1 && page_to_nid(page) == nid) {
+			list_add(&page->lru, &pool->page_list);
+			pool->nr_pages++;
+		} else
+			__free_page(page);
+	}
 
-	for_each_sg(sgl, sg, nents, count)
-		__free_page(sg_page(sg));
+	if (c < TRANSPORT_MEM_SGL_CLASSES &&
+	    pool->nr_sgls[c] < TRANSPORT_MEM_POOL_SGLS)
+		pool->sgls[c][pool->nr_sgls[c]++] = sgl;
+	else
+		kfree(sgl);
 
-	kfree(sgl);
+	local_irq_restore(flags);
+}
+
+static struct scatterlist *transport_mem_get_sgl(unsigned int nents)
+{
+	struct se_mem_pool *pool;
+	struct scatterlist *sgl = NULL;
+	unsigned long flags;
+	int c = order_base_2(max_t(unsigned int, nents, 1));
+
+	if (c >= TRANSPORT_MEM_SGL_CLASSES)
+		return kmalloc(sizeof(struct scatterlist) * nents, GFP_KERNEL);
+
+	local_irq_save(flags);
+	pool = &__get_cpu_var(se_mem_pool);
+	if (pool->nr_sgls[c]) {
+		sgl = pool->sgls[c][--pool->nr_sgls[c]];
+		pool->stats.sgl_hits++;
+	} else
+		pool->stats.sgl_allocs++;
+	local_irq_restore(flags);
+
+	if (!sgl)
+		sgl = kmalloc(sizeof(struct scatterlist) << c, GFP_KERNEL);
+
+	return sgl;
+}
+
+/*
+ * Fill sgl[0 .. nents - 1] with PAGE_SIZE entries, first from the pool of
+ * the local CPU and then from the page allocator, asking for contiguous
+ * runs of up to 1 << TRANSPORT_MEM_HIGH_ORDER pages for large transfers.
+ */
+static int transport_mem_get_pages(struct scatterlist *sgl,
+	unsigned int nents, bool zero)
+{
+	struct se_mem_pool *pool;
+	struct page *page;
+	unsigned long flags;
+	unsigned int i = 0, j, hits, run, high_order = 0, allocs = 0;
+	gfp_t gfp_mask = GFP_KERNEL | (zero ? __GFP_ZERO : 0);
+	int nid = numa_node_id();
+
+	local_irq_save(flags);
+	pool = &__get_cpu_var(se_mem_pool);
+	while (i < nents && !list_empty(&pool->page_list)) {
+		page = list_first_entry(&pool->page_list, struct page, lru);
+		list_del(&page->lru);
+		pool->nr_pages--;
+
+		sg_set_page(&sgl[i++], page, PAGE_SIZE, 0);
+	}
+	local_irq_restore(flags);
+	hits = i;
+
+	if (zero) {
+		for (j = 0; j < hits; j++)
+			clear_highpage(sg_page(&sgl[j]));
+	}
+
+	while (i < nents) {
+		run = min_t(unsigned int, nents - i,
+			    1 << TRANSPORT_MEM_HIGH_ORDER);
+		page = NULL;
+		if (run > 1) {
+			void *addr;
+			/*
+			 * alloc_pages_exact_nid() splits the block, so every
+			 * page can still be freed on its own.
+			 */
+			addr = alloc_pages_exact_nid(nid, run << PAGE_SHIFT,
+					gfp_mask | __GFP_NOWARN | __GFP_NORETRY);
+			if (addr) {
+				page = virt_to_page(addr);
+				high_order++;
+			}
+		}
+		if (!page) {
+			run = 1;
+			page = alloc_pages_node(nid, gfp_mask, 0);
+			if (!page)
+				goto out;
+		}
+
+		for (j = 0; j < run; j++)
+			sg_set_page(&sgl[i++], page + j, PAGE_SIZE, 0);
+		allocs += run;
+	}
+
+	local_irq_save(flags);
+	pool = &__get_cpu_var(se_mem_pool);
+	pool->stats.page_hits += hits;
+	pool->stats.page_allocs += allocs;
+	pool->stats.high_order_allocs += high_order;
+	local_irq_restore(flags);
+	return 0;
+
+out:
+	while (i > 0)
+		__free_page(sg_page(&sgl[--i]));
+	return -ENOMEM;
 }
 
 static inline void transport_free_pages(struct se_cmd *cmd)
@@ -3612,7 +3953,8 @@ static inline void transport_free_pages(struct se_cmd *cmd)
 	if (cmd->se_cmd_flags & SCF_PASSTHROUGH_SG_TO_MEM_NOALLOC)
 		return;
 
-	if (cmd->se_dev->dev_flags & DF_USE_ALLOC_CMD_MEM) {
+	if ((cmd->se_dev->dev_flags & DF_USE_ALLOC_CMD_MEM) &&
+	    !(cmd->alloc_cmd_mem_flags & CMD_A_CORE_MEM)) {
 		cmd->se_dev->transport->free_cmd_mem(cmd);
 		return;
 	}
@@ -3794,43 +4136,42 @@ transport_generic_get_mem(struct se_cmd *cmd)
 {
 	u32 length = cmd->data_length;
 	unsigned int nents;
-	struct page *page;
-	gfp_t zero_flag;
-	int i = 0;
+	int ret;
 
-	if (cmd->se_dev->dev_flags & DF_USE_ALLOC_CMD_MEM)
-		return cmd->se_dev->transport->alloc_cmd_mem(cmd);
+	/*
+	 * A backend ->alloc_cmd_mem() returning > 0 declines the command,
+	 * which then gets pages from the core like any other device.
+	 */
+	if (cmd->se_dev->dev_flags & DF_USE_ALLOC_CMD_MEM) {
+		ret = cmd->se_dev->transport->alloc_cmd_mem(cmd);
+		if (ret <= 0)
+			return ret;
+
+		cmd->alloc_cmd_mem_flags |= CMD_A_CORE_MEM;
+	}
 
 	nents = DIV_ROUND_UP(length, PAGE_SIZE);
-	cmd->t_data_sg = kmalloc(sizeof(struct scatterlist) * nents, GFP_KERNEL);
+	cmd->t_data_sg = transport_mem_get_sgl(nents);
 	if (!cmd->t_data_sg)
 		return -ENOMEM;
 
 	cmd->t_data_nents = nents;
-	sg_init_table(cmd->t_data_sg, nents);
-
-	zero_flag = cmd->se_cmd_flags & SCF_SCSI_DATA_SG_IO_CDB ? 0 : __GFP_ZERO;
+	if (!nents)
+		return 0;
 
-	while (length) {
-		u32 page_len = min_t(u32, length, PAGE_SIZE);
-		page = alloc_page(GFP_KERNEL | zero_flag);
-		if (!page)
-			goto out;
+	sg_init_table(cmd->t_data_sg, nents);
 
-		sg_set_page(&cmd->t_data_sg[i], page, page_len, 0);
-		length -= page_len;
-		i++;
+	ret = transport_mem_get_pages(cmd->t_data_sg, nents,
+			!(cmd->se_cmd_flags & SCF_SCSI_DATA_SG_IO_CDB));
+	if (ret < 0) {
+		kfree(cmd->t_data_sg);
+		cmd->t_data_sg = NULL;
+		cmd->t_data_nents = 0;
+		return ret;
 	}
+	/* Trim the last entry to the end of the data */
+	cmd->t_data_sg[nents - 1].length = length - ((nents - 1) << PAGE_SHIFT);
 	return 0;
-
-out:
-	while (i >= 0) {
-		__free_page(sg_page(&cmd->t_data_sg[i]));
-		i--;
-	}
-	kfree(cmd->t_data_sg);
-	cmd->t_data_sg = NULL;
-	return -ENOMEM;
 }
 
 /* Reduce sectors if they are too long for the device */
@@ -3907,7 +4248,8 @@ transport_allocate_data_tasks(struct se_cmd *cmd,
 		 * the backend then we better not get commands with
 		 * multiple tasks.
 		 */
-		BUG_ON(cmd->se_dev->dev_flags & DF_USE_ALLOC_CMD_MEM);
+		BUG_ON((cmd->se_dev->dev_flags & DF_USE_ALLOC_CMD_MEM) &&
+		       !(cmd->alloc_cmd_mem_flags & CMD_A_CORE_MEM));
 	}
 
 	for (i = 0; i < task_count; i++) {
@@ -4178,6 +4520,40 @@ void transport_generic_free_cmd(struct se_cmd *cmd, int wait_for_tasks)
 }
 EXPORT_SYMBOL(transport_generic_free_cmd);
 
+static inline struct hlist_head *target_sess_cmd_bucket(
+	struct se_session *se_sess,
+	u32 tag)
+{
+	return &se_sess->sess_cmd_hash[hash_32(tag, SE_SESS_CMD_HASH_BITS)];
+}
+
+/* __target_find_sess_cmd - Lookup active command by fabric task tag
+ * @se_sess:	session to search
+ * @tag:	fabric task tag of the command
+ * @prev:	previous match to continue from, or NULL
+ *
+ * Called with se_sess->sess_cmd_lock held.  TMR descriptors are never
+ * returned.  Matches are returned newest first.
+ */
+struct se_cmd *__target_find_sess_cmd(struct se_session *se_sess, u32 tag,
+				      struct se_cmd *prev)
+{
+	struct se_cmd *se_cmd;
+	struct hlist_node *pos;
+
+	pos = prev ? prev->se_cmd_hnode.next :
+		     target_sess_cmd_bucket(se_sess, tag)->first;
+	hlist_for_each_entry_from(se_cmd, pos, se_cmd_hnode) {
+		if (se_cmd->se_cmd_tag != tag)
+			continue;
+		if (se_cmd->se_cmd_flags & SCF_SCSI_TMR_CDB)
+			continue;
+		return se_cmd;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(__target_find_sess_cmd);
+
 /* target_get_sess_cmd - Add command to active ->sess_cmd_list
  * @se_sess:	session to reference
  * @se_cmd:	command descriptor to add
@@ -4206,6 +4582,13 @@ static int target_get_sess_cmd(struct se_session *se_sess, struct se_cmd *se_cmd
 		goto out;
 	}
 	list_add_tail(&se_cmd->se_cmd_list, &se_sess->sess_cmd_list);
+	/*
+	 * Also hash by fabric task tag so that ABORT_TASK and fabric
+	 * exchange lookups do not have to walk the whole sess_cmd_list.
+	 */
+	se_cmd->se_cmd_tag = se_cmd->se_tfo->get_task_tag(se_cmd);
+	hlist_add_head(&se_cmd->se_cmd_hnode,
+		target_sess_cmd_bucket(se_sess, se_cmd->se_cmd_tag));
 	se_cmd->check_release = 1;
 
 out:
@@ -4224,11 +4607,14 @@ static void target_release_cmd_kref(struct kref *kref)
 		return;
 	}
 	if (se_sess->sess_tearing_down && se_cmd->cmd_wait_set) {
-		spin_unlock(&se_sess->sess_cmd_lock);
 		complete(&se_cmd->cmd_wait_comp);
+		if (se_cmd->cmd_wait_counted && !--se_sess->sess_wait_count)
+			complete(&se_sess->sess_wait_comp);
+		spin_unlock(&se_sess->sess_cmd_lock);
 		return;
 	}
 	list_del(&se_cmd->se_cmd_list);
+	hlist_del_init(&se_cmd->se_cmd_hnode);
 	spin_unlock(&se_sess->sess_cmd_lock);
 
 	se_cmd->se_tfo->release_cmd(se_cmd);
@@ -4272,47 +4658,180 @@ void target_sess_cmd_list_set_waiting(struct se_session *se_sess)
 }
 EXPORT_SYMBOL(target_sess_cmd_list_set_waiting);
 
-/* target_wait_for_sess_cmds - Wait for outstanding descriptors
+/*
+ * Lower bound for the single teardown wait before outstanding descriptors
+ * are reported, so that a disabled hung task detector
+ * (sysctl_hung_task_timeout_secs == 0) does not turn every session
+ * teardown into a dump of all in-flight commands.
+ */
+#define TARGET_SESS_WAIT_MIN_TIMEOUT	(30 * HZ)
+
+static unsigned long target_sess_wait_timeout(void)
+{
+	return max_t(unsigned long, sysctl_hung_task_timeout_secs * (HZ/2),
+			TARGET_SESS_WAIT_MIN_TIMEOUT);
+}
+
+#define TARGET_SESS_CMD_STOP		1
+#define TARGET_SESS_CMD_LUN_STOP	2
+
+/*
+ * Called with sess_cmd_lock held.  Marks @se_cmd CMD_T_ABORTED so that
+ * its status is not delivered, and with @stop also asks the storage engine
+ * to hand it back through t_transport_stop_comp, the same way
+ * transport_wait_for_tasks() does.  Returns TARGET_SESS_CMD_STOP if
+ * CMD_T_STOP was set, or TARGET_SESS_CMD_LUN_STOP if a LUN shutdown holds
+ * the descriptor and transport_wait_for_tasks() must hand it back.
+ *
+ * A WRITE that is not active in the core may still be waiting for fabric
+ * data; aborting that requires ->write_pending_status() (see
+ * transport_send_task_abort()), so it is left to complete normally.
+ */
+static int __target_abort_sess_cmd(struct se_cmd *se_cmd, bool stop)
+{
+	int ret = 0;
+
+	spin_lock(&se_cmd->t_state_lock);
+	if (se_cmd->data_direction != DMA_TO_DEVICE ||
+	    (se_cmd->transport_state & CMD_T_ACTIVE))
+		se_cmd->transport_state |= CMD_T_ABORTED;
+
+	if (!stop ||
+	    !(se_cmd->se_cmd_flags & (SCF_SE_LUN_CMD | SCF_SCSI_TMR_CDB)) ||
+	    !(se_cmd->se_cmd_flags & (SCF_SUPPORTED_SAM_OPCODE |
+				      SCF_SCSI_TMR_CDB)) ||
+	    (se_cmd->transport_state & CMD_T_STOP))
+		goto out;
+
+	if (se_cmd->transport_state & CMD_T_LUN_STOP) {
+		ret = TARGET_SESS_CMD_LUN_STOP;
+	} else if (se_cmd->transport_state & CMD_T_ACTIVE) {
+		se_cmd->transport_state |= CMD_T_STOP;
+		ret = TARGET_SESS_CMD_STOP;
+	}
+out:
+	spin_unlock(&se_cmd->t_state_lock);
+	return ret;
+}
+
+/* target_wait_for_sess_cmds - Abort and wait for outstanding descriptors
  * @se_sess:    session to wait for active I/O
- * @wait_for_tasks:	Make extra transport_wait_for_tasks call
+ * @wait_for_tasks:	Also stop descriptors active in the storage engine
+ *
+ * The whole sess_cmd_list is taken over and aborted in one pass under
+ * sess_cmd_lock, and the caller then sleeps once for the stopped
+ * descriptors and once on se_sess->sess_wait_comp for the rest, so that
+ * teardown time is bounded by the slowest command rather than the sum of
+ * all of them.
  */
 void target_wait_for_sess_cmds(
 	struct se_session *se_sess,
 	int wait_for_tasks)
 {
 	struct se_cmd *se_cmd, *tmp_cmd;
-	bool rc = false;
-
-	list_for_each_entry_safe(se_cmd, tmp_cmd,
-				&se_sess->sess_cmd_list, se_cmd_list) {
-		list_del(&se_cmd->se_cmd_list);
+	LIST_HEAD(drain_list);
+	LIST_HEAD(stop_list);
+	LIST_HEAD(lun_stop_list);
+	unsigned long flags, timeout = target_sess_wait_timeout();
+	u32 pending = 0, stopped = 0;
 
-		pr_info("Waiting for se_cmd: %p t_state: %d, transport state: 0x%x, fabric state: %d, kref:%d\n",
-			se_cmd, se_cmd->t_state, se_cmd->transport_state,
-			se_cmd->se_tfo->get_cmd_state(se_cmd),
-			atomic_read(&se_cmd->cmd_kref.refcount));
-		if (se_cmd->se_tfo->dump_cmd)
-			se_cmd->se_tfo->dump_cmd(se_cmd);
+	spin_lock_irqsave(&se_sess->sess_cmd_lock, flags);
+	list_splice_init(&se_sess->sess_cmd_list, &drain_list);
+	list_for_each_entry_safe(se_cmd, tmp_cmd, &drain_list, se_cmd_list) {
+		hlist_del_init(&se_cmd->se_cmd_hnode);
+		/*
+		 * Descriptors stopped here are handed back to us through
+		 * t_transport_stop_comp and will not complete cmd_wait_comp.
+		 */
+		switch (__target_abort_sess_cmd(se_cmd, wait_for_tasks)) {
+		case TARGET_SESS_CMD_STOP:
+			list_move_tail(&se_cmd->se_cmd_list, &stop_list);
+			stopped++;
+			break;
+		case TARGET_SESS_CMD_LUN_STOP:
+			list_move_tail(&se_cmd->se_cmd_list, &lun_stop_list);
+			break;
+		default:
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&se_sess->sess_cmd_lock, flags);
 
-		if (wait_for_tasks) {
-			pr_info("Calling transport_wait_for_tasks se_cmd: %p t_state: %d,"
-				" fabric state: %d\n", se_cmd, se_cmd->t_state,
-				se_cmd->se_tfo->get_cmd_state(se_cmd));
+	list_for_each_entry(se_cmd, &stop_list, se_cmd_list)
+		wake_up_interruptible(&se_cmd->se_dev->dev_queue_obj.thread_wq);
+	/*
+	 * Every stop was requested above, so these waits overlap.
+	 */
+	list_for_each_entry(se_cmd, &stop_list, se_cmd_list) {
+		if (!wait_for_completion_timeout(&se_cmd->t_transport_stop_comp,
+						 timeout)) {
+			pr_warn("Waiting for stopped se_cmd: %p t_state: %d,"
+				" transport state: 0x%x\n", se_cmd,
+				se_cmd->t_state, se_cmd->transport_state);
+			wait_for_completion(&se_cmd->t_transport_stop_comp);
+		}
+		spin_lock_irqsave(&se_cmd->t_state_lock, flags);
+		se_cmd->transport_state &= ~(CMD_T_ACTIVE | CMD_T_STOP);
+		spin_unlock_irqrestore(&se_cmd->t_state_lock, flags);
+	}
+	/*
+	 * Descriptors held by a LUN shutdown go through the
+	 * transport_lun_stop_comp/transport_lun_fe_stop_comp handshake in
+	 * transport_wait_for_tasks() one at a time.
+	 */
+	list_for_each_entry_safe(se_cmd, tmp_cmd, &lun_stop_list, se_cmd_list) {
+		if (transport_wait_for_tasks(se_cmd)) {
+			list_move_tail(&se_cmd->se_cmd_list, &stop_list);
+			stopped++;
+		} else
+			list_move_tail(&se_cmd->se_cmd_list, &drain_list);
+	}
+	/*
+	 * Everything left on drain_list that has not dropped its final
+	 * reference yet is accounted for in sess_wait_count, and
+	 * target_release_cmd_kref() completes sess_wait_comp for the last one.
+	 */
+	spin_lock_irqsave(&se_sess->sess_cmd_lock, flags);
+	list_for_each_entry(se_cmd, &drain_list, se_cmd_list) {
+		if (completion_done(&se_cmd->cmd_wait_comp))
+			continue;
+		se_cmd->cmd_wait_counted = 1;
+		pending++;
+	}
+	se_sess->sess_wait_count = pending;
+	spin_unlock_irqrestore(&se_sess->sess_cmd_lock, flags);
 
-			rc = transport_wait_for_tasks(se_cmd);
+	pr_debug("se_sess %p: stopped %u, waiting for %u outstanding"
+			" commands\n", se_sess, stopped, pending);
 
-			pr_info("After transport_wait_for_tasks se_cmd: %p t_state: %d,"
-				" fabric state: %d rc: %d\n", se_cmd, se_cmd->t_state,
-				se_cmd->se_tfo->get_cmd_state(se_cmd), rc);
-		}
+	if (pending && !wait_for_completion_timeout(&se_sess->sess_wait_comp,
+						    timeout)) {
+		list_for_each_entry(se_cmd, &drain_list, se_cmd_list) {
+			if (completion_done(&se_cmd->cmd_wait_comp))
+				continue;
 
-		if (!rc) {
-			wait_for_completion(&se_cmd->cmd_wait_comp);
-			pr_info("After cmd_wait_comp: se_cmd: %p t_state: %d"
-				" fabric state: %d\n", se_cmd, se_cmd->t_state,
+			pr_warn("Waiting for se_cmd: %p t_state: %d, transport"
+				" state: 0x%x, fabric state: %d\n", se_cmd,
+				se_cmd->t_state, se_cmd->transport_state,
 				se_cmd->se_tfo->get_cmd_state(se_cmd));
+			if (se_cmd->se_tfo->dump_cmd)
+				se_cmd->se_tfo->dump_cmd(se_cmd);
 		}
+		wait_for_completion(&se_sess->sess_wait_comp);
+	}
 
+	list_for_each_entry_safe(se_cmd, tmp_cmd, &drain_list, se_cmd_list) {
+		/*
+		 * Should already be done, sess_wait_comp only fires after
+		 * the last counted descriptor.
+		 */
+		wait_for_completion(&se_cmd->cmd_wait_comp);
+		list_del(&se_cmd->se_cmd_list);
+		se_cmd->se_tfo->release_cmd(se_cmd);
+	}
+
+	list_for_each_entry_safe(se_cmd, tmp_cmd, &stop_list, se_cmd_list) {
+		list_del(&se_cmd->se_cmd_list);
 		se_cmd->se_tfo->release_cmd(se_cmd);
 	}
 }
@@ -4362,7 +4881,8 @@ static int transport_lun_wait_for_tasks(struct se_cmd *cmd, struct se_lun *lun)
 	return 0;
 }
 
-static void __transport_clear_lun_from_sessions(struct se_lun *lun)
+static void __transport_clear_lun_cmd_list(struct se_lun *lun,
+					  struct se_lun_cmd_list *cmd_list)
 {
 	struct se_cmd *cmd = NULL;
 	unsigned long lun_flags, cmd_flags;
@@ -4370,11 +4890,12 @@ static void __transport_clear_lun_from_sessions(struct se_lun *lun)
 	 * Do exception processing and return CHECK_CONDITION status to the
 	 * Initiator Port.
 	 */
-	spin_lock_irqsave(&lun->lun_cmd_lock, lun_flags);
-	while (!list_empty(&lun->lun_cmd_list)) {
-		cmd = list_first_entry(&lun->lun_cmd_list,
+	spin_lock_irqsave(&cmd_list->lock, lun_flags);
+	while (!list_empty(&cmd_list->list)) {
+		cmd = list_first_entry(&cmd_list->list,
 		       struct se_cmd, se_lun_node);
 		list_del_init(&cmd->se_lun_node);
+		cmd->se_lun_list = NULL;
 
 		/*
 		 * This will notify iscsi_target_transport.c:
@@ -4395,7 +4916,7 @@ static void __transport_clear_lun_from_sessions(struct se_lun *lun)
 		}
 		spin_unlock(&cmd->t_state_lock);
 
-		spin_unlock_irqrestore(&lun->lun_cmd_lock, lun_flags);
+		spin_unlock_irqrestore(&cmd_list->lock, lun_flags);
 
 		if (!cmd->se_lun) {
 			pr_err("ITT: 0x%08x, [i,t]_state: %u/%u\n",
@@ -4412,7 +4933,7 @@ static void __transport_clear_lun_from_sessions(struct se_lun *lun)
 			cmd->se_tfo->get_task_tag(cmd));
 
 		if (transport_lun_wait_for_tasks(cmd, cmd->se_lun) < 0) {
-			spin_lock_irqsave(&lun->lun_cmd_lock, lun_flags);
+			spin_lock_irqsave(&cmd_list->lock, lun_flags);
 			continue;
 		}
 
@@ -4456,16 +4977,25 @@ check_cond:
 					cmd_flags);
 			transport_cmd_check_stop(cmd, 1, 0);
 			complete(&cmd->transport_lun_fe_stop_comp);
-			spin_lock_irqsave(&lun->lun_cmd_lock, lun_flags);
+			spin_lock_irqsave(&cmd_list->lock, lun_flags);
 			continue;
 		}
 		pr_debug("SE_LUN[%d] - ITT: 0x%08x finished processing\n",
 			lun->unpacked_lun, cmd->se_tfo->get_task_tag(cmd));
 
 		spin_unlock_irqrestore(&cmd->t_state_lock, cmd_flags);
-		spin_lock_irqsave(&lun->lun_cmd_lock, lun_flags);
+		spin_lock_irqsave(&cmd_list->lock, lun_flags);
 	}
-	spin_unlock_irqrestore(&lun->lun_cmd_lock, lun_flags);
+	spin_unlock_irqrestore(&cmd_list->lock, lun_flags);
+}
+
+static void __transport_clear_lun_from_sessions(struct se_lun *lun)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		__transport_clear_lun_cmd_list(lun,
+				per_cpu_ptr(lun->lun_cmd_lists, cpu));
 }
 
 static int transport_clear_lun_thread(void *p)
@@ -4940,7 +5470,8 @@ EXPORT_SYMBOL(transport_generic_handle_tmr);
 /* Return true if the transport processing thread has work */
 static inline bool transport_process_work(struct se_device *dev)
 {
-	return atomic_read(&dev->dev_queue_obj.queue_cnt) || kthread_should_stop();
+	return atomic_read(&dev->dev_queue_obj.queue_cnt) ||
+	       atomic_read(&dev->dev_exec_kick) || kthread_should_stop();
 }
 
 /*	transport_processing_thread():
@@ -4987,6 +5518,10 @@ get_cmd:
 			time_limit = jiffies + budget;
 		}
 
+		if (atomic_read(&dev->dev_exec_kick) &&
+		    atomic_xchg(&dev->dev_exec_kick, 0))
+			__transport_execute_tasks(dev, NULL);
+
 		cmd = transport_get_cmd_from_queue(&dev->dev_queue_obj);
 		if (!cmd)
 			continue;
@@ -5054,7 +5589,7 @@ get_cmd:
 	}
 
 out:
-	WARN_ON(!list_empty(&dev->state_task_list));
+	WARN_ON(!transport_dev_state_lists_empty(dev));
 	WARN_ON(!list_empty(&dev->dev_queue_obj.qobj_list));
 	dev->process_thread = NULL;
 	return 0;
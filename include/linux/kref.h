@@ -24,6 +24,7 @@ struct kref {
 
 void kref_init(struct kref *kref);
 void kref_get(struct kref *kref);
+int kref_get_unless_zero(struct kref *kref);
 int kref_put(struct kref *kref, void (*release) (struct kref *kref));
 int kref_put_and_lock(struct kref *kref, void (*release) (struct kref *kref),
 		spinlock_t *lock);
@@ -5,6 +5,7 @@
 #include <linux/configfs.h>
 #include <linux/dma-mapping.h>
 #include <linux/blkdev.h>
+#include <linux/radix-tree.h>
 #include <scsi/scsi_cmnd.h>
 #include <net/sock.h>
 #include <net/tcp.h>
@@ -544,6 +545,8 @@ struct se_cmd {
 	/* Used to signal cmd->se_tfo->check_release_cmd() usage per cmd */
 	unsigned		check_release:1;
 	unsigned		cmd_wait_set:1;
+	/* Accounted in se_sess->sess_wait_count, under sess_cmd_lock */
+	unsigned		cmd_wait_counted:1;
 	unsigned		unknown_data_length:1;
 	/* Timestamps moved from qla_target.h */
 	ktime_t			recv_time;
@@ -565,6 +568,10 @@ struct se_cmd {
 	void			*sense_buffer;
 	struct list_head	se_delayed_node;
 	struct list_head	se_lun_node;
+	/* Per-CPU list of se_lun holding se_lun_node */
+	struct se_lun_cmd_list	*se_lun_list;
+	/* Execution queue of se_dev holding the tasks */
+	struct se_exec_queue	*se_exec_queue;
 	struct list_head	se_qf_node;
 	struct se_device      *se_dev;
 	struct se_dev_entry   *se_deve;
@@ -574,6 +581,9 @@ struct se_cmd {
 	struct se_tmr_req	se_tmr_req;
 	struct list_head	se_queue_node;
 	struct list_head	se_cmd_list;
+	/* se_sess->sess_cmd_hash bucket entry, keyed by se_cmd_tag */
+	struct hlist_node	se_cmd_hnode;
+	u32			se_cmd_tag;
 	struct completion	cmd_wait_comp;
 
 	struct ps_ioreq		*ps_iop;
@@ -582,6 +592,7 @@ struct se_cmd {
 	unsigned int		alloc_cmd_mem_flags;
 #define CMD_A_FAIL_WHEN_EMPTY		(1 << 0)	/* iblock_alloc_cmd_mem fails when there are no buffers */
 #define CMD_A_FAILED_EMPTY		(1 << 1)	/* iblock_alloc_cmd_mem failed because there were no buffers */
+#define CMD_A_CORE_MEM			(1 << 2)	/* ->alloc_cmd_mem declined, t_data_sg is from the core */
 
 	struct kref		cmd_kref;
 	struct target_core_fabric_ops *se_tfo;
@@ -648,7 +659,10 @@ struct se_node_acl {
 	spinlock_t		stats_lock;
 	/* Used for PR SPEC_I_PT=1 and REGISTER_AND_MOVE */
 	atomic_t		acl_pr_ref_count;
-	struct se_dev_entry	**device_list;
+	/* struct se_dev_entry by mapped_lun, see core_get_se_deve() */
+	struct radix_tree_root	device_tree;
+	/* mapped_luns with TRANSPORT_LUNFLAGS_INITIATOR_ACCESS set */
+	DECLARE_BITMAP(device_map, TRANSPORT_MAX_LUNS_PER_TPG);
 	struct se_session	*nacl_sess;
 	struct se_portal_group *se_tpg;
 	spinlock_t		device_list_lock;
@@ -667,6 +681,9 @@ struct se_node_acl {
 	u64			acl_serial;
 };
 
+#define SE_SESS_CMD_HASH_BITS	8
+#define SE_SESS_CMD_HASH_SIZE	(1 << SE_SESS_CMD_HASH_BITS)
+
 struct se_session {
 	unsigned		sess_tearing_down:1;
 	u64			sess_bin_isid;
@@ -676,7 +693,12 @@ struct se_session {
 	struct list_head	sess_list;
 	struct list_head	sess_acl_list;
 	struct list_head	sess_cmd_list;
+	/* Commands on sess_cmd_list hashed by fabric task tag */
+	struct hlist_head	sess_cmd_hash[SE_SESS_CMD_HASH_SIZE];
 	spinlock_t		sess_cmd_lock;
+	/* Descriptors target_wait_for_sess_cmds() still waits for */
+	u32			sess_wait_count;
+	struct completion	sess_wait_comp;
 	struct kref		sess_kref;
 };
 
@@ -700,21 +722,26 @@ struct se_lun_acl {
 	struct se_ml_stat_grps	ml_stat_grps;
 };
 
+/* Per-CPU I/O counters, summed on read by core_io_stats_sum() */
+struct se_io_stats {
+	u64			num_cmds;
+	u64			read_bytes;
+	u64			write_bytes;
+};
+
 struct se_dev_entry {
 	bool			def_pr_registered;
 	/* See transport_lunflags_table */
 	u32			lun_flags;
-	u32			deve_cmds;
+	atomic_t		deve_cmds;
 	u32			mapped_lun;
 	u32			average_bytes;
 	u32			last_byte_count;
-	u32			total_cmds;
-	u32			total_bytes;
 	u64			pr_res_key;
 	u64			creation_time;
 	u32			attach_count;
-	u64			read_bytes;
-	u64			write_bytes;
+	/* Allocated on first enable, lives as long as the se_node_acl */
+	struct se_io_stats __percpu *io_stats;
 	atomic_t		ua_count;
 	/* Used for PR SPEC_I_PT=1 and REGISTER_AND_MOVE */
 	atomic_t		pr_ref_count;
@@ -797,6 +824,14 @@ struct se_subsystem_dev {
 	struct se_dev_stat_grps dev_stat_grps;
 };
 
+/* struct se_task execution and state lists, see transport_cmd_exec_queue() */
+struct se_exec_queue {
+	spinlock_t		lock;
+	u32			nr_execute;
+	struct list_head	execute_list;
+	struct list_head	state_list;
+};
+
 struct se_device {
 	/* RELATIVE TARGET PORT IDENTIFER Counter */
 	u16			dev_rpti_counter;
@@ -816,22 +851,28 @@ struct se_device {
 	u32			dev_index;
 	u64			creation_time;
 	u32			num_resets;
-	u64			num_cmds;
-	u64			read_bytes;
-	u64			write_bytes;
+	/* ABORT_TASK outcomes, see core_tmr_abort_task() */
+	atomic_t		abort_task_aborted;
+	atomic_t		abort_task_complete;
+	atomic_t		abort_task_not_found;
+	struct se_io_stats __percpu *io_stats;
+	/* Protects num_resets and the rate_* sample below */
 	spinlock_t		stats_lock;
+	u64			rate_jiffies;
+	struct se_io_stats	rate_snap;
+	struct se_io_stats	rate;
 	/* Active commands on this virtual SE device */
 	atomic_t		simple_cmds;
 	atomic_t		dev_ordered_id;
-	atomic_t		execute_tasks;
 	atomic_t		dev_ordered_sync;
+	/* Ask the processing thread to drain all execution queues */
+	atomic_t		dev_exec_kick;
 	atomic_t		dev_qf_count;
 	struct se_obj		dev_obj;
 	struct se_obj		dev_access_obj;
 	struct se_obj		dev_export_obj;
 	struct se_queue_obj	dev_queue_obj;
 	spinlock_t		delayed_cmd_lock;
-	spinlock_t		execute_task_lock;
 	spinlock_t		dev_reservation_lock;
 	spinlock_t		dev_status_lock;
 	spinlock_t		se_port_lock;
@@ -848,9 +889,11 @@ struct se_device {
 	struct workqueue_struct *tmr_wq;
 	struct work_struct	qf_work_queue;
 	struct list_head	delayed_cmd_list;
-	struct list_head	execute_task_list;
-	struct list_head	state_task_list;
 	struct list_head	qf_cmd_list;
+	/* HEAD_OF_QUEUE and ORDERED tasks */
+	struct se_exec_queue	dev_exec_queue;
+	/* SIMPLE tasks, dispatched from the submitting CPU */
+	struct se_exec_queue __percpu *dev_exec_queues;
 	/* Pointer to associated SE HBA */
 	struct se_hba		*se_hba;
 	struct se_subsystem_dev *se_sub_dev;
@@ -886,6 +929,12 @@ struct se_port_stat_grps {
 	struct config_group scsi_transport_group;
 };
 
+/* Commands active on a struct se_lun, one list per CPU */
+struct se_lun_cmd_list {
+	spinlock_t		lock;
+	struct list_head	list;
+};
+
 struct se_lun {
 	/* See transport_lun_status_table */
 	enum transport_lun_status_table lun_status;
@@ -894,10 +943,10 @@ struct se_lun {
 	u32			unpacked_lun;
 	atomic_t		lun_acl_count;
 	spinlock_t		lun_acl_lock;
-	spinlock_t		lun_cmd_lock;
 	spinlock_t		lun_sep_lock;
 	struct completion	lun_shutdown_comp;
-	struct list_head	lun_cmd_list;
+	/* Allocated while the LUN is active, see core_tpg_post_addlun() */
+	struct se_lun_cmd_list __percpu *lun_cmd_lists;
 	struct list_head	lun_acl_list;
 	struct se_device	*lun_se_dev;
 	struct se_port		*lun_sep;
@@ -905,6 +954,7 @@ struct se_lun {
 	struct se_port_stat_grps port_stat_grps;
 };
 
+/* Per-CPU, summed on read by core_port_stats_sum() */
 struct scsi_port_stats {
        u64     cmd_pdus;
        u64     tx_data_octets;
@@ -917,7 +967,7 @@ struct se_port {
 	int		sep_tg_pt_secondary_stat;
 	int		sep_tg_pt_secondary_write_md;
 	u32		sep_index;
-	struct scsi_port_stats sep_stats;
+	struct scsi_port_stats __percpu *sep_stats;
 	/* Used for ALUA Target Port Groups membership */
 	atomic_t	sep_tg_pt_secondary_offline;
 	/* Used for PR ALL_TG_PT=1 */
@@ -954,6 +1004,8 @@ struct se_portal_group {
 	/* linked list for initiator ACL list */
 	struct list_head	acl_node_list;
 	struct se_lun		**tpg_lun_list;
+	/* unpacked_luns in TRANSPORT_LUN_STATUS_ACTIVE, under tpg_lun_lock */
+	DECLARE_BITMAP(tpg_lun_map, TRANSPORT_MAX_LUNS_PER_TPG);
 	struct se_lun		tpg_virt_lun0;
 	/* List of TCM sessions associated wth this TPG */
 	struct list_head	tpg_sess_list;
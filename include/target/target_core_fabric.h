@@ -145,6 +145,8 @@ int	transport_send_check_condition_and_sense(struct se_cmd *, u8, int);
 
 void	target_put_sess_cmd(struct se_session *, struct se_cmd *);
 void	target_sess_cmd_list_set_waiting(struct se_session *);
+struct se_cmd *__target_find_sess_cmd(struct se_session *, u32,
+		struct se_cmd *);
 void	target_wait_for_sess_cmds(struct se_session *, int);
 
 int	core_alua_check_nonop_delay(struct se_cmd *);
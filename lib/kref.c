@@ -36,6 +36,19 @@ void kref_get(struct kref *kref)
 	smp_mb__after_atomic_inc();
 }
 
+/**
+ * kref_get_unless_zero - increment refcount for object unless it is zero.
+ * @kref: object.
+ *
+ * For lookups that find the object without holding a reference, e.g. under
+ * rcu_read_lock(), and may race with the final kref_put().
+ * Return non-zero if the increment succeeded, otherwise return 0.
+ */
+int kref_get_unless_zero(struct kref *kref)
+{
+	return atomic_add_unless(&kref->refcount, 1, 0);
+}
+
 /**
  * kref_put - decrement refcount for object.
  * @kref: object.
@@ -118,6 +131,7 @@ int kref_sub(struct kref *kref, unsigned int count,
 
 EXPORT_SYMBOL(kref_init);
 EXPORT_SYMBOL(kref_get);
+EXPORT_SYMBOL(kref_get_unless_zero);
 EXPORT_SYMBOL(kref_put);
 EXPORT_SYMBOL(kref_put_and_lock);
 EXPORT_SYMBOL(kref_sub);